@@ -12,6 +12,7 @@
 
 #include <cstring>
 #include "RTC.h"
+#include "save_state.h"
 
 
 void RTC::init()
@@ -63,4 +64,28 @@ void RTC::latch()
         time_latched = false;
         update_time_registers();
     }
-}
\ No newline at end of file
+}
+
+void RTC::save_state(StateWriter& writer) const
+{
+    writer.WriteU8(s);
+    writer.WriteU8(m);
+    writer.WriteU8(h);
+    writer.WriteU8(dl);
+    writer.WriteU8(dh);
+    writer.WriteF64(time);
+    writer.WriteBool(time_latched);
+    writer.WriteBool(time_latching);
+}
+
+void RTC::load_state(StateReader& reader)
+{
+    s = reader.ReadU8();
+    m = reader.ReadU8();
+    h = reader.ReadU8();
+    dl = reader.ReadU8();
+    dh = reader.ReadU8();
+    time = reader.ReadF64();
+    time_latched = reader.ReadBool();
+    time_latching = reader.ReadBool();
+}
@@ -16,6 +16,9 @@
 #include "type.h"
 #include "bit_oper.h"
 
+class StateWriter;
+class StateReader;
+
 class RTC {
 public:
     u8 s; // Seconds.
@@ -35,6 +38,8 @@ public:
     void update_time_registers();
     void update_timestamp();
     void latch();
+    void save_state(StateWriter& writer) const;
+    void load_state(StateReader& reader);
     u16 days() const { return (u16)dl + (((u16)(dh & 0x01)) << 8); }
     bool halted() const { return bitTest(&dh, 6); }
     bool day_overflow() const { return bitTest(&dh, 7); }
@@ -8,12 +8,27 @@
   ******************************************************************************
   */
 
+#include <chrono>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
 
 
 #include "app.h"
+#include "file_helper.h"
+#include "log-min.h"
+
+// The Game Boy runs one frame every 70224 cycles, 59.73 frames per second.
+constexpr f64 EMULATOR_FRAME_TIME = (f64)Emulator::GB_CLOCK_CYCLES_PER_FRAME / Emulator::GB_CLOCK_FREQUENCY;
+
+// Snapshots are taken every 5 frames of emulated time, the LCD being on or off. Holding backspace
+// steps back one snapshot per frame of the emulator thread.
+constexpr u32 REWIND_FRAMES_PER_SNAPSHOT = 5;
+constexpr u64 REWIND_MEMORY_BUDGET = 32 * mb;
+
+// The audio output format and the target latency of its ring buffer.
+constexpr u32 AUDIO_SAMPLE_RATE = 48000;
+constexpr u32 AUDIO_LATENCY_MS = 60;
 
 
 inline void saveRunningImg(const unsigned char* data, int width, int height) {
@@ -86,24 +101,82 @@ void App::Update() {
 
 void App::RenderLoop() {
 
-    auto lastFrame = std::chrono::high_resolution_clock::now();
+    isEmulatorThreadRunning = true;
+    emulatorThread = std::thread(&App::EmulatorLoop, this);
 
     while(!glfwWindowShouldClose(_mainWindow)) {
         Update();
+    }
+
+    isEmulatorThreadRunning = false;
+    emulatorThread.join();
+}
 
-        if(emulator->isCartLoaded) {
-            auto frame = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double> fp_s = frame - lastFrame;
-            lastFrame = frame;
+void App::EmulatorLoop() {
+    using clock = std::chrono::steady_clock;
 
-            emulator->Update(fp_s.count());
+    auto nextFrame = clock::now();
+
+    while(isEmulatorThreadRunning) {
+        {
+            std::lock_guard<std::mutex> lock(emulatorMutex);
+            run_commands();
+            if(emulator->isCartLoaded) {
+                u8 buttons = inputButtons.load(std::memory_order_relaxed);
+                emulator->input.SetButtons(buttons);
+                movie.SetButtons(emulator.get(), buttons);
+                if(isRewinding) {
+                    rewind.Rewind(emulator.get());
+                }
+                else {
+                    emulator->Update(EMULATOR_FRAME_TIME);
+                    audio.Push(emulator.get());
+                    rewind.Update(emulator.get());
+                }
+            }
+            publish_status();
         }
+
+        // The pace is fixed, Update() scales the cycles it runs by the speed scale.
+        nextFrame += std::chrono::duration_cast<clock::duration>(std::chrono::duration<f64>(EMULATOR_FRAME_TIME));
+        auto now = clock::now();
+        if(now > nextFrame + std::chrono::milliseconds(100)) {
+            // Fell too far behind (debugger, slow machine), do not try to catch up.
+            nextFrame = now;
+        }
+        std::this_thread::sleep_until(nextFrame);
     }
 }
 
 
 App::~App() {
-    // TODO
+    if(emulatorThread.joinable()) {
+        isEmulatorThreadRunning = false;
+        emulatorThread.join();
+    }
+}
+
+void App::post_command(std::function<void()> command) {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.push_back(std::move(command));
+}
+
+void App::run_commands() {
+    std::vector<std::function<void()>> pending;
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        pending.swap(commands);
+    }
+    for(std::function<void()>& command : pending) {
+        command();
+    }
+}
+
+void App::publish_status() {
+    isCartLoaded.store(emulator->isCartLoaded, std::memory_order_relaxed);
+    isRecordingVideo.store(recorder.IsOpen(), std::memory_order_relaxed);
+    isRecordingMovie.store(movie.IsRecording(), std::memory_order_relaxed);
+    isRecordingAudio.store(audio.IsRunning(), std::memory_order_relaxed);
 }
 
 void App::DrawGui() {
@@ -111,7 +184,11 @@ void App::DrawGui() {
     ImGui::NewFrame();
 
     DrawMainMenuBar();
-    _debugWindow.DrawGui(emulator.get());
+    if(_debugWindow.show) {
+        // The debug window reads and changes the emulator as it is, between two frames.
+        std::lock_guard<std::mutex> lock(emulatorMutex);
+        _debugWindow.DrawGui(emulator.get());
+    }
     DrawOpenCartridgePanel();
 
     ImGui::SetNextWindowPos(ImVec2(0, 20));
@@ -119,18 +196,32 @@ void App::DrawGui() {
     ImGui::Begin("GameView", NULL, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoCollapse
                                                     | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize);
 
-    if(emulator->romData) {
-        renderer.GeneTex((const unsigned char*)emulator->ppu.pixels + ((emulator->ppu.current_back_buffer + 1) % 2) * PPU_XRES * PPU_YRES * 4,
-                         PPU_XRES, PPU_YRES, ColorMode::RGBA);
+    if(isCartLoaded) {
+        // Read without locking, the frame format is set once when the emulator is created.
+        const FrameExchange& frames = emulator->ppu.frames;
+        PPUFrameFormat format = emulator->ppu.frame_format;
+        // Only a new frame is uploaded, the GUI frames in between draw the texture as it is.
+        if(displayFrame.empty() || frames.LatestFrameId() != displayFrameId || !renderer.HasTex()) {
+            displayFrame.resize(PPU_XRES * PPU_YRES * 4);
+            if(format == PPUFrameFormat::RGBA) {
+                displayFrameId = frames.CopyLatest(displayFrame.data());
+            }
+            else {
+                shadeFrame.resize(frames.FrameSize());
+                displayFrameId = frames.CopyLatest(shadeFrame.data());
+                expand_frame_to_rgba(shadeFrame.data(), format, displayFrame.data());
+            }
+            renderer.GeneTex(displayFrame.data(), PPU_XRES, PPU_YRES, ColorMode::RGBA);
+        }
+        const u8* frame = displayFrame.data();
         renderer.Render(PPU_XRES * 3);
 
         if(ImGui::Button("save screenshot as ppm")) {
-            saveRunningImg((const unsigned char*)emulator->ppu.pixels + ((emulator->ppu.current_back_buffer + 1) % 2) * PPU_XRES * PPU_YRES * 4,
-                        PPU_XRES, PPU_YRES);
+            saveRunningImg((const unsigned char*)frame, PPU_XRES, PPU_YRES);
         }
     }
 
-    if(emulator->isCartLoaded) {
+    if(isCartLoaded) {
         update_emulator_input();
     }
 
@@ -152,7 +243,7 @@ void App::DrawMainMenuBar() {
             }
             if(ImGui::MenuItem("Close"))
             {
-                emulator->Close();
+                post_command([this] { emulator->Close(); });
             }
             ImGui::EndMenu();
         }
@@ -160,18 +251,86 @@ void App::DrawMainMenuBar() {
         {
             if(ImGui::MenuItem("Play"))
             {
-                if(emulator)
+                post_command([this] { emulator->isPaused = false; });
+            }
+            if(ImGui::MenuItem("Pause"))
+            {
+                post_command([this] { emulator->isPaused = true; });
+            }
+            if(ImGui::MenuItem("Save State", nullptr, false, isCartLoaded))
+            {
+                post_command([this] { if(emulator->isCartLoaded) save_emulator_state(); });
+            }
+            if(ImGui::MenuItem("Load State", nullptr, false, isCartLoaded))
+            {
+                post_command([this] { if(emulator->isCartLoaded) load_emulator_state(); });
+            }
+            // The menus show the state of the last frame, a command posted twice before the
+            // next one finds its work done.
+            if(!isRecordingVideo)
+            {
+                if(ImGui::MenuItem("Start Recording", nullptr, false, isCartLoaded))
                 {
-                    emulator->isPaused = false;
+                    post_command([this] {
+                        if(emulator->isCartLoaded && !recorder.IsOpen() && recorder.Open("recording.y4m")) {
+                            emulator->ppu.frame_hook = &recorder;
+                        }
+                    });
                 }
             }
-            if(ImGui::MenuItem("Pause"))
+            else if(ImGui::MenuItem("Stop Recording"))
+            {
+                post_command([this] {
+                    if(recorder.IsOpen()) {
+                        emulator->ppu.frame_hook = nullptr;
+                        recorder.Close();
+                        INFO("Recorded %llu frames to recording.y4m.", (unsigned long long)recorder.FramesWritten());
+                    }
+                });
+            }
+            if(!isRecordingMovie)
             {
-                if(emulator)
+                if(ImGui::MenuItem("Start Movie Recording", nullptr, false, isCartLoaded))
                 {
-                    emulator->isPaused = true;
+                    post_command([this] {
+                        if(emulator->isCartLoaded && !movie.IsRecording()) {
+                            movie.Start(emulator.get());
+                        }
+                    });
                 }
             }
+            else if(ImGui::MenuItem("Stop Movie Recording"))
+            {
+                post_command([this] {
+                    if(movie.IsRecording()) {
+                        stop_movie_recording();
+                    }
+                });
+            }
+            if(!isRecordingAudio)
+            {
+                if(ImGui::MenuItem("Start Audio Recording", nullptr, false, isCartLoaded))
+                {
+                    post_command([this] {
+                        if(!emulator->isCartLoaded || audio.IsRunning()) return;
+                        std::unique_ptr<WavAudioSink> sink(new WavAudioSink());
+                        if(sink->Open("recording.wav")) {
+                            audio.Start(emulator.get(), std::move(sink), AUDIO_SAMPLE_RATE, AUDIO_LATENCY_MS);
+                        }
+                    });
+                }
+            }
+            else if(ImGui::MenuItem("Stop Audio Recording"))
+            {
+                post_command([this] {
+                    if(!audio.IsRunning()) return;
+                    WavAudioSink* sink = static_cast<WavAudioSink*>(audio.Sink());
+                    sink->Close();
+                    u64 frames = sink->FramesWritten();
+                    audio.Stop(emulator.get());
+                    INFO("Recorded %llu audio frames to recording.wav.", (unsigned long long)frames);
+                });
+            }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Debug"))
@@ -204,41 +363,12 @@ void App::DrawOpenCartridgePanel() {
 
     if(ImGui::Button("Confirm")) {
         _showOpenCartridgePanel = false;
-
-        // load the cartridge data
-        FILE* file = fopen(cart_path, "rb");
-        if(!file) {
-            assert(false && "failed to open file.");
-        }
-        fseek(file, 0, SEEK_END);
-        long fileSize = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        char* source = new char[fileSize];
-        fread(source, sizeof(byte), fileSize, file);
-        fclose(file);
-
-        emulator->Init(cart_path, source, fileSize);
+        open_cartridge(cart_path, false);
     }
     ImGui::SameLine();
     if(ImGui::Button("Confirm without playing")) {
         _showOpenCartridgePanel = false;
-
-        // load the cartridge data
-        FILE* file = fopen(cart_path, "rb");
-        if(!file) {
-            assert(false && "failed to open file.");
-        }
-        fseek(file, 0, SEEK_END);
-        long fileSize = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        char* source = new char[fileSize];
-        fread(source, sizeof(byte), fileSize, file);
-        fclose(file);
-
-        emulator->Init(cart_path, source, fileSize);
-        if(emulator) {
-            emulator->isPaused = true;
-        }
+        open_cartridge(cart_path, true);
     }
     ImGui::SameLine();
     if(ImGui::Button("Cancel")) {
@@ -260,29 +390,109 @@ void App::FileBrowser() {
 }
 
 void App::update_emulator_input() {
-    auto& joypad = emulator->joypad;
-
     if(ImGui::IsWindowFocused()) {
-        joypad.up = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_UpArrow))
-                || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_W));
+        u8 buttons = 0;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_UpArrow))
+                || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_W))) buttons |= JOYPAD_BUTTON_UP;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_LeftArrow))
+                || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_A))) buttons |= JOYPAD_BUTTON_LEFT;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_DownArrow))
+                || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_S))) buttons |= JOYPAD_BUTTON_DOWN;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_RightArrow))
+                || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_D))) buttons |= JOYPAD_BUTTON_RIGHT;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_J))) buttons |= JOYPAD_BUTTON_A;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_K))) buttons |= JOYPAD_BUTTON_B;
+
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Space))) buttons |= JOYPAD_BUTTON_SELECT;
 
-        joypad.left = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_LeftArrow))
-                    || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_A));
+        if(ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Enter))) buttons |= JOYPAD_BUTTON_START;
 
-        joypad.down = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_DownArrow))
-                    || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_S));
+        // Picked up by the emulator thread at the start of its next frame.
+        inputButtons.store(buttons, std::memory_order_relaxed);
 
-        joypad.right = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_RightArrow))
-                    || ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_D));
+        isRewinding = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Backspace));
+    }
+}
+
+void App::open_cartridge(const char *path, bool paused) {
+    // load the cartridge data
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        assert(false && "failed to open file.");
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::shared_ptr<std::vector<char>> source(new std::vector<char>(fileSize));
+    fread(source->data(), sizeof(byte), fileSize, file);
+    fclose(file);
+
+    std::string cartridgePath = path;
+    post_command([this, cartridgePath, source, paused] {
+        if(movie.IsRecording()) {
+            stop_movie_recording();
+        }
+        emulator->Init(cartridgePath, source->data(), source->size());
+        init_rewind();
+        if(paused) {
+            emulator->isPaused = true;
+        }
+    });
+}
+
+std::string App::get_state_path() const {
+    return emulator->cartridge_path.substr(0, emulator->cartridge_path.length() - 2) + "state";
+}
+
+std::string App::get_movie_path() const {
+    return emulator->cartridge_path.substr(0, emulator->cartridge_path.length() - 2) + "gbm";
+}
 
-        joypad.a = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_J));
+void App::stop_movie_recording() {
+    const Movie& recorded = movie.Stop(emulator.get());
+    auto path = get_movie_path();
+    if(recorded.Save(path.c_str())) {
+        INFO("Recorded %u frames of input to %s.", recorded.Frames(), path.c_str());
+    }
+}
 
-        joypad.b = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_K));
+void App::save_emulator_state() {
+    std::vector<u8> state(emulator->GetStateSize());
+    u64 size = emulator->SaveState(state.data(), state.size());
 
-        joypad.select = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Space));
+    auto path = get_state_path();
+    std::ofstream stateFile(path, std::ios::out | std::ios::binary);
+    stateFile.write((const char*)state.data(), (std::streamsize)size);
+    stateFile.close();
 
-        joypad.start = ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_Enter));
+    INFO("Save state to %s.", path.c_str());
+}
 
+void App::load_emulator_state() {
+    auto path = get_state_path();
+    void* data = nullptr;
+    size_t size = LoadFile(path.c_str(), data);
+    if(!size) {
+        WARN("save state not found: %s", path.c_str());
+        return;
+    }
+    if(movie.IsRecording()) {
+        // The loaded state does not follow from the recorded input.
+        stop_movie_recording();
     }
+    if(emulator->LoadState(data, size)) {
+        INFO("Load state from %s.", path.c_str());
+    }
+    free(data);
 }
 
+void App::init_rewind() {
+    rewind.Init(emulator->GetStateSize(), REWIND_MEMORY_BUDGET, REWIND_FRAMES_PER_SNAPSHOT);
+}
@@ -13,11 +13,20 @@
 #ifndef GAMEBOY_EMULATOR_APP_H
 #define GAMEBOY_EMULATOR_APP_H
 
+#include "audio_output.h"
 #include "debug_window.h"
 #include "emulator.h"
 #include "imgui_pixel_renderer.h"
+#include "movie.h"
+#include "rewind.h"
+#include "video_recorder.h"
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -37,6 +46,44 @@ public:
 
     std::unique_ptr<Emulator> emulator;
     ImGuiPixelRenderer renderer;
+    //! The RGBA frame shown in the game view, copied out of PPU::frames when a new one is published.
+    std::vector<u8> displayFrame;
+    //! The copied frame before it is expanded to RGBA, if the PPU outputs shade indices.
+    std::vector<u8> shadeFrame;
+    u64 displayFrameId = 0;
+
+    //! Records the game view to recording.y4m.
+    VideoRecorder recorder;
+    //! Records the sound to recording.wav through the audio ring buffer and the rate control,
+    //! played as a device would.
+    AudioOutput audio;
+    //! Records the input to <name>.gbm for deterministic replays (see gb_bench --movie).
+    MovieRecorder movie;
+
+    RewindBuffer rewind;
+    //! True while the rewind key is held, the emulator steps back instead of running then.
+    std::atomic<bool> isRewinding{false};
+
+    //! The emulator runs on its own thread at the Game Boy frame rate, independent from vsync.
+    //! The emulator, the rewind buffer and the recorders belong to that thread. The GUI hands
+    //! it commands (load a cartridge or a state, pause, start a recording...) through
+    //! post_command(), which it runs between two frames. Frames come back through PPU::frames,
+    //! input goes through inputButtons, and the state the menus show through the atomics
+    //! below, all without locking. Only the debug window, which inspects the emulator as it
+    //! is, holds emulatorMutex while it is shown, the thread holds it while it runs a frame.
+    std::thread emulatorThread;
+    std::atomic<bool> isEmulatorThreadRunning{false};
+    std::mutex emulatorMutex;
+    //! The pressed buttons, see Joypad::get_buttons().
+    std::atomic<u8> inputButtons{0};
+    //! Commands posted by the GUI and not run yet, guarded by commandMutex.
+    std::vector<std::function<void()>> commands;
+    std::mutex commandMutex;
+    //! Published by the emulator thread after every frame for the menus.
+    std::atomic<bool> isCartLoaded{false};
+    std::atomic<bool> isRecordingVideo{false};
+    std::atomic<bool> isRecordingMovie{false};
+    std::atomic<bool> isRecordingAudio{false};
 
 public:
     ~App();
@@ -44,6 +91,7 @@ public:
     void Init();
     void Update();
     void RenderLoop();
+    void EmulatorLoop();
 
     void DrawGui();
     void DrawMainMenuBar();
@@ -52,6 +100,28 @@ public:
     void FileBrowser();
 
     void update_emulator_input();
+
+    // queues command to run on the emulator thread before its next frame
+    void post_command(std::function<void()> command);
+    // runs the posted commands, on the emulator thread
+    void run_commands();
+    // publishes the state shown by the menus, on the emulator thread
+    void publish_status();
+
+    // reads the cartridge file and posts loading it, paused or not
+    void open_cartridge(const char* path, bool paused);
+
+    // save states are stored next to the cartridge as <name>.state
+    std::string get_state_path() const;
+    // movies are stored next to the cartridge as <name>.gbm
+    std::string get_movie_path() const;
+    // the methods below run on the emulator thread
+    void stop_movie_recording();
+    void save_emulator_state();
+    void load_emulator_state();
+
+    // resets the rewind history for the newly loaded cartridge
+    void init_rewind();
 public:
     App() = default;
 };
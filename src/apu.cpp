@@ -0,0 +1,701 @@
+/**
+  ******************************************************************************
+  * @file           : apu.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "apu.h"
+#include "emulator.h"
+#include "save_state.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+//! The duty waveforms, one bit per duty step, the most significant bit first.
+static const u8 DUTY_WAVEFORMS[4] = {
+    0x01,   // 12.5%
+    0x81,   // 25%
+    0x87,   // 50%
+    0x7E,   // 75%
+};
+
+//! The wave RAM after the boot ROM, it is random on the real hardware.
+static const u8 INITIAL_WAVE_RAM[16] = {
+    0x84, 0x40, 0x43, 0xAA, 0x2D, 0x78, 0x92, 0x3C, 0x60, 0x59, 0x59, 0xB0, 0x34, 0xB8, 0x2E, 0xDA,
+};
+
+//! While the wave channel plays, the CPU only reaches the wave RAM within this many clock cycles
+//! after the channel read it, and then accesses the byte the channel read.
+constexpr u64 APU_WAVE_ACCESS_CYCLES = 2;
+
+u8 APUSquareChannel::Output() const {
+    if(!enabled) return 0;
+    return ((DUTY_WAVEFORMS[duty] >> (7 - dutyPosition)) & 1) ? envelope.volume : 0;
+}
+
+u8 APU::WaveOutput() const {
+    if(!wave.enabled || !wave.volumeCode) return 0;
+    u8 sample = (wave.position & 1) ? (wave.sampleBuffer & 0x0F) : (wave.sampleBuffer >> 4);
+    return sample >> (wave.volumeCode - 1);
+}
+
+u8 APU::NoiseOutput() const {
+    return (noise.enabled && !(noise.lfsr & 1)) ? noise.envelope.volume : 0;
+}
+
+u32 APUNoiseChannel::Period() const {
+    u32 divisorCode = polynomial & 0x07;
+    u32 divisor = divisorCode ? divisorCode * 16 : 8;
+    return divisor << (polynomial >> 4);
+}
+
+void APU::Init(u64 clockCycles) {
+    memset(&square1, 0, sizeof(square1));
+    memset(&square2, 0, sizeof(square2));
+    memset(&wave, 0, sizeof(wave));
+    memset(&noise, 0, sizeof(noise));
+    memcpy(waveRam, INITIAL_WAVE_RAM, sizeof(waveRam));
+
+    // The registers as the boot ROM leaves them, after its sound on channel 1 faded out.
+    powered = true;
+    nr50 = 0x77;
+    nr51 = 0xF3;
+    frameSequencerStep = 0;
+    square1.enabled = true;
+    square1.duty = 2;
+    square1.length.counter = 1;
+    square1.envelope.reg = 0xF3;
+    square1.timer = square1.Period();
+    square2.timer = square2.Period();
+    wave.timer = wave.Period();
+    wave.volumeCode = 0;
+    noise.lfsr = 0x7FFF;
+    noise.timer = noise.Period();
+    syncCycles = clockCycles;
+
+    blockStart = clockCycles;
+    for(u8 channel = 0; channel < 4; ++channel) {
+        outputLeft[channel] = 0;
+        outputRight[channel] = 0;
+    }
+    if(outputRate) {
+        left.Clear();
+        right.Clear();
+        UpdateOutput();
+    }
+}
+
+void APU::Sync(Emulator *emu) {
+    u64 end = emu->clockCycles;
+    if(end == syncCycles) return;
+    GB_PROFILE_SCOPE(emu, ProfileSection::Apu);
+    // DIV is only reset after a sync, so it has counted every cycle since the last one.
+    const u16 divMask = APU_FRAME_SEQUENCER_DIV_BIT * 2 - 1;
+    u16 div = (u16)(emu->timer.div - (u16)(end - syncCycles));
+    u64 nextStep = syncCycles + (divMask + 1) - (div & divMask);
+    while(syncCycles < end) {
+        // Run up to the next frame sequencer step or block end, which change the channels.
+        u64 until = std::min(end, nextStep);
+        if(outputRate) {
+            until = std::min(until, blockStart + APU_BLOCK_CYCLES);
+        }
+        if(powered) {
+            RunSquare(square1, 0, until);
+            RunSquare(square2, 1, until);
+            if(wave.enabled) {
+                RunWave(until);
+            }
+            RunNoise(until);
+        }
+        syncCycles = until;
+        if(until == nextStep) {
+            StepFrameSequencer();
+            nextStep += divMask + 1;
+        }
+        if(outputRate && until == blockStart + APU_BLOCK_CYCLES) {
+            EndBlock(until);
+        }
+    }
+}
+
+void APU::RunSquare(APUSquareChannel &channel, u8 index, u64 end) {
+    u64 cycles = end - syncCycles;
+    if(cycles < channel.timer) {
+        channel.timer -= (u32)cycles;
+        return;
+    }
+    u32 period = channel.Period();
+    if(!outputRate) {
+        u64 rest = cycles - channel.timer;
+        channel.dutyPosition = (u8)((channel.dutyPosition + 1 + rest / period) & 0x07);
+        channel.timer = period - (u32)(rest % period);
+        return;
+    }
+    u64 cycle = syncCycles + channel.timer;
+    for(; cycle <= end; cycle += period) {
+        channel.dutyPosition = (channel.dutyPosition + 1) & 0x07;
+        Emit(index, channel.Output(), cycle);
+    }
+    channel.timer = (u32)(cycle - end);
+}
+
+void APU::RunWave(u64 end) {
+    u64 cycles = end - syncCycles;
+    if(cycles < wave.timer) {
+        wave.timer -= (u32)cycles;
+        return;
+    }
+    u32 period = wave.Period();
+    if(!outputRate) {
+        u64 rest = cycles - wave.timer;
+        wave.position = (u8)((wave.position + 1 + rest / period) & 0x1F);
+        wave.sampleBuffer = waveRam[wave.position / 2];
+        wave.lastReadCycle = end - rest % period;
+        wave.timer = period - (u32)(rest % period);
+        return;
+    }
+    u64 cycle = syncCycles + wave.timer;
+    for(; cycle <= end; cycle += period) {
+        wave.position = (wave.position + 1) & 0x1F;
+        wave.sampleBuffer = waveRam[wave.position / 2];
+        wave.lastReadCycle = cycle;
+        Emit(2, WaveOutput(), cycle);
+    }
+    wave.timer = (u32)(cycle - end);
+}
+
+void APU::RunNoise(u64 end) {
+    u64 cycles = end - syncCycles;
+    if(cycles < noise.timer) {
+        noise.timer -= (u32)cycles;
+        return;
+    }
+    // The LFSR has to be stepped one by one, but only the output is skipped when disabled.
+    u32 period = noise.Period();
+    bool narrow = (noise.polynomial & 0x08) != 0;
+    u16 lfsr = noise.lfsr;
+    u64 cycle = syncCycles + noise.timer;
+    for(; cycle <= end; cycle += period) {
+        u16 feedback = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (u16)((lfsr >> 1) | (feedback << 14));
+        if(narrow) {
+            // 7-bit mode.
+            lfsr = (u16)((lfsr & ~0x40) | (feedback << 6));
+        }
+        if(outputRate) {
+            noise.lfsr = lfsr;
+            Emit(3, NoiseOutput(), cycle);
+        }
+    }
+    noise.lfsr = lfsr;
+    noise.timer = (u32)(cycle - end);
+}
+
+void APU::StepFrameSequencer() {
+    if(!powered) return;
+    switch(frameSequencerStep) {
+        case 0:
+        case 4:
+            ClockLengths();
+            break;
+        case 2:
+        case 6:
+            ClockLengths();
+            ClockSweep();
+            break;
+        case 7:
+            square1.envelope.Clock();
+            square2.envelope.Clock();
+            noise.envelope.Clock();
+            break;
+        default:
+            break;
+    }
+    frameSequencerStep = (frameSequencerStep + 1) & 0x07;
+    if(outputRate) {
+        UpdateOutput();
+    }
+}
+
+void APU::ClockLengths() {
+    for(u8 channel = 0; channel < 4; ++channel) {
+        if(!Length(channel).Clock()) {
+            Enabled(channel) = false;
+        }
+    }
+}
+
+APULength &APU::Length(u8 channel) {
+    switch(channel) {
+        case 0: return square1.length;
+        case 1: return square2.length;
+        case 2: return wave.length;
+        default: return noise.length;
+    }
+}
+
+bool &APU::Enabled(u8 channel) {
+    switch(channel) {
+        case 0: return square1.enabled;
+        case 1: return square2.enabled;
+        case 2: return wave.enabled;
+        default: return noise.enabled;
+    }
+}
+
+u16 APU::SweepCalculate() {
+    u16 delta = square1.sweepShadow >> (square1.sweepReg & 0x07);
+    u16 frequency;
+    if(square1.sweepReg & 0x08) {
+        frequency = square1.sweepShadow - delta;
+        square1.sweepNegateUsed = true;
+    }
+    else {
+        frequency = square1.sweepShadow + delta;
+    }
+    if(frequency > 2047) {
+        square1.enabled = false;
+    }
+    return frequency;
+}
+
+void APU::ClockSweep() {
+    if(square1.sweepTimer) --square1.sweepTimer;
+    if(square1.sweepTimer) return;
+    u8 period = (square1.sweepReg >> 4) & 0x07;
+    square1.sweepTimer = period ? period : 8;
+    if(!square1.sweepEnabled || !period) return;
+    u16 frequency = SweepCalculate();
+    if(frequency <= 2047 && (square1.sweepReg & 0x07)) {
+        square1.sweepShadow = frequency;
+        square1.frequency = frequency;
+        // The new frequency is checked for overflow again, but not written.
+        SweepCalculate();
+    }
+}
+
+void APU::TriggerSquare(APUSquareChannel &channel) {
+    channel.enabled = channel.envelope.IsDacEnabled();
+    channel.timer = channel.Period();
+    channel.envelope.Trigger();
+    if(&channel == &square1) {
+        u8 period = (square1.sweepReg >> 4) & 0x07;
+        u8 shift = square1.sweepReg & 0x07;
+        square1.sweepShadow = square1.frequency;
+        square1.sweepTimer = period ? period : 8;
+        square1.sweepEnabled = period || shift;
+        square1.sweepNegateUsed = false;
+        if(shift) {
+            SweepCalculate();
+        }
+    }
+}
+
+void APU::TriggerWave() {
+    if(wave.enabled && wave.timer == 2) {
+        // Retriggering while the channel reads the wave RAM corrupts its first bytes (DMG only):
+        // the byte, or the 4-byte block, about to be read is copied to the start.
+        u8 next = ((wave.position + 1) & 0x1F) / 2;
+        if(next < 4) {
+            waveRam[0] = waveRam[next];
+        }
+        else {
+            memcpy(waveRam, waveRam + (next & ~3), 4);
+        }
+    }
+    wave.enabled = wave.dacEnabled;
+    wave.position = 0;
+    // The first sample is read 3 APU cycles (6 clock cycles) later than a period.
+    wave.timer = wave.Period() + 6;
+}
+
+void APU::TriggerNoise() {
+    noise.enabled = noise.envelope.IsDacEnabled();
+    noise.lfsr = 0x7FFF;
+    noise.timer = noise.Period();
+    noise.envelope.Trigger();
+}
+
+void APU::WriteNRx4(u8 channel, u8 data) {
+    APULength& length = Length(channel);
+    u16 maxLength = channel == 2 ? 256 : 64;
+    bool wasLengthEnabled = length.enabled;
+    length.enabled = (data & 0x40) != 0;
+    // If the next frame sequencer step does not clock the lengths, enabling the length counter
+    // clocks it once right away.
+    bool lengthClockSkipped = (frameSequencerStep & 1) != 0;
+    if(lengthClockSkipped && !wasLengthEnabled && length.enabled && length.counter) {
+        if(--length.counter == 0 && !(data & 0x80)) {
+            Enabled(channel) = false;
+        }
+    }
+    if(!(data & 0x80)) {
+        return;
+    }
+    if(!length.counter) {
+        length.counter = maxLength;
+        if(length.enabled && lengthClockSkipped) {
+            --length.counter;
+        }
+    }
+    switch(channel) {
+        case 0: TriggerSquare(square1); break;
+        case 1: TriggerSquare(square2); break;
+        case 2: TriggerWave(); break;
+        default: TriggerNoise(); break;
+    }
+}
+
+void APU::PowerOff() {
+    // Powering off clears all registers, the length counters are kept on the DMG.
+    u16 lengths[4];
+    for(u8 channel = 0; channel < 4; ++channel) {
+        lengths[channel] = Length(channel).counter;
+    }
+    memset(&square1, 0, sizeof(square1));
+    memset(&square2, 0, sizeof(square2));
+    memset(&wave, 0, sizeof(wave));
+    memset(&noise, 0, sizeof(noise));
+    for(u8 channel = 0; channel < 4; ++channel) {
+        Length(channel).counter = lengths[channel];
+    }
+    square1.timer = square1.Period();
+    square2.timer = square2.Period();
+    wave.timer = wave.Period();
+    noise.timer = noise.Period();
+    nr50 = 0;
+    nr51 = 0;
+    powered = false;
+}
+
+u8 APU::BusRead(u16 addr) {
+    assert(addr >= 0xFF10 && addr <= 0xFF3F && "APU register address illegal!");
+    if(addr >= 0xFF30) {
+        if(wave.enabled) {
+            return syncCycles - wave.lastReadCycle < APU_WAVE_ACCESS_CYCLES ? waveRam[wave.position / 2] : 0xFF;
+        }
+        return waveRam[addr - 0xFF30];
+    }
+    // The unused and write-only bits read as 1.
+    switch(addr) {
+        case 0xFF10: return 0x80 | square1.sweepReg;
+        case 0xFF11: return 0x3F | (u8)(square1.duty << 6);
+        case 0xFF12: return square1.envelope.reg;
+        case 0xFF14: return 0xBF | (square1.length.enabled ? 0x40 : 0);
+        case 0xFF16: return 0x3F | (u8)(square2.duty << 6);
+        case 0xFF17: return square2.envelope.reg;
+        case 0xFF19: return 0xBF | (square2.length.enabled ? 0x40 : 0);
+        case 0xFF1A: return 0x7F | (wave.dacEnabled ? 0x80 : 0);
+        case 0xFF1C: return 0x9F | (u8)(wave.volumeCode << 5);
+        case 0xFF1E: return 0xBF | (wave.length.enabled ? 0x40 : 0);
+        case 0xFF21: return noise.envelope.reg;
+        case 0xFF22: return noise.polynomial;
+        case 0xFF23: return 0xBF | (noise.length.enabled ? 0x40 : 0);
+        case 0xFF24: return nr50;
+        case 0xFF25: return nr51;
+        case 0xFF26:
+            return 0x70 | (powered ? 0x80 : 0) |
+                   (square1.enabled ? 0x01 : 0) | (square2.enabled ? 0x02 : 0) |
+                   (wave.enabled ? 0x04 : 0) | (noise.enabled ? 0x08 : 0);
+        default:
+            return 0xFF;
+    }
+}
+
+void APU::BusWrite(u16 addr, u8 data) {
+    assert(addr >= 0xFF10 && addr <= 0xFF3F && "APU register address illegal!");
+    if(addr >= 0xFF30) {
+        if(!wave.enabled) {
+            waveRam[addr - 0xFF30] = data;
+        }
+        else if(syncCycles - wave.lastReadCycle < APU_WAVE_ACCESS_CYCLES) {
+            waveRam[wave.position / 2] = data;
+        }
+        return;
+    }
+    if(addr == 0xFF26) {
+        bool power = (data & 0x80) != 0;
+        if(powered && !power) {
+            PowerOff();
+        }
+        else if(!powered && power) {
+            powered = true;
+            frameSequencerStep = 0;
+            square1.dutyPosition = 0;
+            square2.dutyPosition = 0;
+            wave.sampleBuffer = 0;
+        }
+    }
+    else if(!powered) {
+        // Only the length counters are writable while powered off (DMG only).
+        switch(addr) {
+            case 0xFF11: square1.length.counter = 64 - (data & 0x3F); break;
+            case 0xFF16: square2.length.counter = 64 - (data & 0x3F); break;
+            case 0xFF1B: wave.length.counter = 256 - data; break;
+            case 0xFF20: noise.length.counter = 64 - (data & 0x3F); break;
+            default: break;
+        }
+        return;
+    }
+    switch(addr) {
+        case 0xFF10:
+            if(square1.sweepNegateUsed && (square1.sweepReg & 0x08) && !(data & 0x08)) {
+                square1.enabled = false;
+            }
+            square1.sweepReg = data & 0x7F;
+            break;
+        case 0xFF11:
+            square1.duty = data >> 6;
+            square1.length.counter = 64 - (data & 0x3F);
+            break;
+        case 0xFF12:
+            square1.envelope.reg = data;
+            if(!square1.envelope.IsDacEnabled()) square1.enabled = false;
+            break;
+        case 0xFF13:
+            square1.frequency = (u16)((square1.frequency & 0x700) | data);
+            break;
+        case 0xFF14:
+            square1.frequency = (u16)((square1.frequency & 0xFF) | ((data & 0x07) << 8));
+            WriteNRx4(0, data);
+            break;
+        case 0xFF16:
+            square2.duty = data >> 6;
+            square2.length.counter = 64 - (data & 0x3F);
+            break;
+        case 0xFF17:
+            square2.envelope.reg = data;
+            if(!square2.envelope.IsDacEnabled()) square2.enabled = false;
+            break;
+        case 0xFF18:
+            square2.frequency = (u16)((square2.frequency & 0x700) | data);
+            break;
+        case 0xFF19:
+            square2.frequency = (u16)((square2.frequency & 0xFF) | ((data & 0x07) << 8));
+            WriteNRx4(1, data);
+            break;
+        case 0xFF1A:
+            wave.dacEnabled = (data & 0x80) != 0;
+            if(!wave.dacEnabled) wave.enabled = false;
+            break;
+        case 0xFF1B:
+            wave.length.counter = 256 - data;
+            break;
+        case 0xFF1C:
+            wave.volumeCode = (data >> 5) & 0x03;
+            break;
+        case 0xFF1D:
+            wave.frequency = (u16)((wave.frequency & 0x700) | data);
+            break;
+        case 0xFF1E:
+            wave.frequency = (u16)((wave.frequency & 0xFF) | ((data & 0x07) << 8));
+            WriteNRx4(2, data);
+            break;
+        case 0xFF20:
+            noise.length.counter = 64 - (data & 0x3F);
+            break;
+        case 0xFF21:
+            noise.envelope.reg = data;
+            if(!noise.envelope.IsDacEnabled()) noise.enabled = false;
+            break;
+        case 0xFF22:
+            noise.polynomial = data;
+            break;
+        case 0xFF23:
+            WriteNRx4(3, data);
+            break;
+        case 0xFF24:
+            nr50 = data;
+            break;
+        case 0xFF25:
+            nr51 = data;
+            break;
+        default:
+            break;
+    }
+    if(outputRate) {
+        UpdateOutput();
+    }
+}
+
+void APU::UpdateOutput() {
+    leftGain = (((nr50 >> 4) & 0x07) + 1) * APU_OUTPUT_SCALE;
+    rightGain = ((nr50 & 0x07) + 1) * APU_OUTPUT_SCALE;
+    Emit(0, square1.Output(), syncCycles);
+    Emit(1, square2.Output(), syncCycles);
+    Emit(2, WaveOutput(), syncCycles);
+    Emit(3, NoiseOutput(), syncCycles);
+}
+
+void APU::EndBlock(u64 cycle) {
+    left.EndBlock((u32)(cycle - blockStart));
+    right.EndBlock((u32)(cycle - blockStart));
+    blockStart = cycle;
+    if(left.MaxBlockClocks() < APU_BLOCK_CYCLES) {
+        // The host is not reading the samples, drop the older half.
+        u32 count = left.SamplesAvailable() / 2;
+        left.RemoveSamples(count);
+        right.RemoveSamples(count);
+    }
+}
+
+void APU::SetOutputRate(u32 sampleRate) {
+    outputRate = sampleRate;
+    blockStart = syncCycles;
+    for(u8 channel = 0; channel < 4; ++channel) {
+        outputLeft[channel] = 0;
+        outputRight[channel] = 0;
+    }
+    if(sampleRate) {
+        // Half a second of samples.
+        u32 capacity = sampleRate / 2 + 1;
+        left.Init((u32)Emulator::GB_CLOCK_FREQUENCY, sampleRate, capacity);
+        right.Init((u32)Emulator::GB_CLOCK_FREQUENCY, sampleRate, capacity);
+        UpdateOutput();
+    }
+}
+
+u32 APU::SamplesAvailable(Emulator *emu) {
+    if(!outputRate) return 0;
+    Sync(emu);
+    EndBlock(syncCycles);
+    return left.SamplesAvailable();
+}
+
+u32 APU::ReadSamples(Emulator *emu, i16 *out, u32 maxFrames) {
+    if(!outputRate) return 0;
+    Sync(emu);
+    EndBlock(syncCycles);
+    u32 count = left.ReadSamples(out, maxFrames, 2);
+    right.ReadSamples(out + 1, count, 2);
+    return count;
+}
+
+static void SaveLength(const APULength& length, StateWriter& writer) {
+    writer.WriteU16(length.counter);
+    writer.WriteBool(length.enabled);
+}
+
+static void LoadLength(APULength& length, StateReader& reader) {
+    length.counter = reader.ReadU16();
+    length.enabled = reader.ReadBool();
+}
+
+static void SaveEnvelope(const APUEnvelope& envelope, StateWriter& writer) {
+    writer.WriteU8(envelope.reg);
+    writer.WriteU8(envelope.volume);
+    writer.WriteU8(envelope.timer);
+}
+
+static void LoadEnvelope(APUEnvelope& envelope, StateReader& reader) {
+    envelope.reg = reader.ReadU8();
+    envelope.volume = reader.ReadU8();
+    envelope.timer = reader.ReadU8();
+}
+
+static void SaveSquare(const APUSquareChannel& channel, StateWriter& writer) {
+    writer.WriteBool(channel.enabled);
+    writer.WriteU8(channel.duty);
+    writer.WriteU8(channel.dutyPosition);
+    writer.WriteU16(channel.frequency);
+    writer.WriteU32(channel.timer);
+    SaveLength(channel.length, writer);
+    SaveEnvelope(channel.envelope, writer);
+    writer.WriteU8(channel.sweepReg);
+    writer.WriteU16(channel.sweepShadow);
+    writer.WriteU8(channel.sweepTimer);
+    writer.WriteBool(channel.sweepEnabled);
+    writer.WriteBool(channel.sweepNegateUsed);
+}
+
+static void LoadSquare(APUSquareChannel& channel, StateReader& reader) {
+    channel.enabled = reader.ReadBool();
+    channel.duty = reader.ReadU8();
+    channel.dutyPosition = reader.ReadU8();
+    channel.frequency = reader.ReadU16();
+    channel.timer = reader.ReadU32();
+    LoadLength(channel.length, reader);
+    LoadEnvelope(channel.envelope, reader);
+    channel.sweepReg = reader.ReadU8();
+    channel.sweepShadow = reader.ReadU16();
+    channel.sweepTimer = reader.ReadU8();
+    channel.sweepEnabled = reader.ReadBool();
+    channel.sweepNegateUsed = reader.ReadBool();
+}
+
+void APU::SaveState(StateWriter &writer) const {
+    writer.WriteBool(powered);
+    writer.WriteU8(nr50);
+    writer.WriteU8(nr51);
+    writer.WriteU8(frameSequencerStep);
+    writer.WriteU64(syncCycles);
+
+    SaveSquare(square1, writer);
+    SaveSquare(square2, writer);
+
+    writer.WriteBool(wave.enabled);
+    writer.WriteBool(wave.dacEnabled);
+    writer.WriteU8(wave.volumeCode);
+    writer.WriteU16(wave.frequency);
+    writer.WriteU32(wave.timer);
+    writer.WriteU8(wave.position);
+    writer.WriteU8(wave.sampleBuffer);
+    writer.WriteU64(wave.lastReadCycle);
+    SaveLength(wave.length, writer);
+
+    writer.WriteBool(noise.enabled);
+    writer.WriteU8(noise.polynomial);
+    writer.WriteU16(noise.lfsr);
+    writer.WriteU32(noise.timer);
+    SaveLength(noise.length, writer);
+    SaveEnvelope(noise.envelope, writer);
+
+    writer.WriteBytes(waveRam, sizeof(waveRam));
+}
+
+void APU::LoadState(StateReader &reader) {
+    if(outputRate) {
+        // Finish the output up to the old time.
+        EndBlock(syncCycles);
+    }
+    powered = reader.ReadBool();
+    nr50 = reader.ReadU8();
+    nr51 = reader.ReadU8();
+    frameSequencerStep = reader.ReadU8();
+    syncCycles = reader.ReadU64();
+
+    LoadSquare(square1, reader);
+    LoadSquare(square2, reader);
+
+    wave.enabled = reader.ReadBool();
+    wave.dacEnabled = reader.ReadBool();
+    wave.volumeCode = reader.ReadU8();
+    wave.frequency = reader.ReadU16();
+    wave.timer = reader.ReadU32();
+    wave.position = reader.ReadU8();
+    wave.sampleBuffer = reader.ReadU8();
+    wave.lastReadCycle = reader.ReadU64();
+    LoadLength(wave.length, reader);
+
+    noise.enabled = reader.ReadBool();
+    noise.polynomial = reader.ReadU8();
+    noise.lfsr = reader.ReadU16();
+    noise.timer = reader.ReadU32();
+    LoadLength(noise.length, reader);
+    LoadEnvelope(noise.envelope, reader);
+
+    reader.ReadBytes(waveRam, sizeof(waveRam));
+
+    // Continue the output from the loaded amplitude.
+    if(outputRate) {
+        blockStart = syncCycles;
+        UpdateOutput();
+    }
+}
@@ -0,0 +1,239 @@
+/**
+  ******************************************************************************
+  * @file           : apu.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_APU_H
+#define GAMEBOY_EMULATOR_APU_H
+
+#include "type.h"
+#include "blip_buffer.h"
+
+class Emulator;
+class StateWriter;
+class StateReader;
+
+//! The frame sequencer steps on the falling edge of this DIV bit (512Hz).
+constexpr u16 APU_FRAME_SEQUENCER_DIV_BIT = 1 << 12;
+//! The output is synthesized in blocks of at most this many clock cycles.
+constexpr u32 APU_BLOCK_CYCLES = 8192;
+//! The amplitude of one step of one channel at master volume 1, the loudest mix
+//! (4 channels * 15 * volume 8) stays below 32768.
+constexpr i32 APU_OUTPUT_SCALE = 64;
+
+//! The length counter shared by all channels, disables the channel when it reaches 0.
+struct APULength {
+    u16 counter;
+    bool enabled;
+
+    // clocked by the frame sequencer steps 0, 2, 4 and 6, returns false if the channel is turned off.
+    bool Clock() {
+        if(enabled && counter) {
+            --counter;
+            return counter != 0;
+        }
+        return true;
+    }
+};
+
+//! The volume envelope of the square and noise channels.
+struct APUEnvelope {
+    //! NRx2, initial volume, direction and period.
+    u8 reg;
+    u8 volume;
+    u8 timer;
+
+    bool IsDacEnabled() const { return (reg & 0xF8) != 0; }
+    void Trigger() {
+        volume = reg >> 4;
+        timer = reg & 0x07;
+    }
+    // clocked by the frame sequencer step 7.
+    void Clock() {
+        u8 period = reg & 0x07;
+        if(!period) return;
+        if(timer) --timer;
+        if(timer) return;
+        timer = period;
+        if((reg & 0x08) && volume < 15) ++volume;
+        else if(!(reg & 0x08) && volume > 0) --volume;
+    }
+};
+
+//! Channel 1 and 2. Channel 2 has no sweep, its sweep registers stay 0.
+struct APUSquareChannel {
+    bool enabled;
+    //! NRx1 bits 6-7.
+    u8 duty;
+    u8 dutyPosition;
+    //! 11 bits, NRx3 and NRx4 bits 0-2.
+    u16 frequency;
+    //! Clock cycles until the next duty step.
+    u32 timer;
+    APULength length;
+    APUEnvelope envelope;
+
+    //! NR10 and the sweep unit of channel 1.
+    u8 sweepReg;
+    u16 sweepShadow;
+    u8 sweepTimer;
+    bool sweepEnabled;
+    //! A subtraction was calculated since the trigger, clearing the negate bit then disables the channel.
+    bool sweepNegateUsed;
+
+    u32 Period() const { return (2048 - (u32)frequency) * 4; }
+    u8 Output() const;
+};
+
+//! Channel 3, plays the 32 4-bit samples of the wave RAM.
+struct APUWaveChannel {
+    bool enabled;
+    //! NR30 bit 7.
+    bool dacEnabled;
+    //! NR32 bits 5-6.
+    u8 volumeCode;
+    u16 frequency;
+    u32 timer;
+    //! The sample index (0-31) last read.
+    u8 position;
+    //! The wave RAM byte last read.
+    u8 sampleBuffer;
+    //! The APU cycle of the last wave RAM read, the CPU can only access the wave RAM in
+    //! that cycle while the channel is playing.
+    u64 lastReadCycle;
+    APULength length;
+
+    u32 Period() const { return (2048 - (u32)frequency) * 2; }
+};
+
+//! Channel 4, pseudo-random noise from a linear feedback shift register.
+struct APUNoiseChannel {
+    bool enabled;
+    //! NR43, clock shift, LFSR width and divisor code.
+    u8 polynomial;
+    u16 lfsr;
+    u32 timer;
+    APULength length;
+    APUEnvelope envelope;
+
+    u32 Period() const;
+};
+
+//! The audio processing unit, 0xFF10~0xFF3F.
+//! The APU is not ticked with the other components. It runs lazily: Sync() catches it up to the
+//! emulator clock, which the emulator does before every sound register access and DIV reset,
+//! and ReadSamples() does when the host requests the output. Between two syncs every channel is
+//! advanced in one loop over its own steps (the frame sequencer steps split the runs), and with
+//! the output disabled the square and wave channels skip whole runs arithmetically, so sound
+//! costs next to nothing in headless runs. The result is the same as clocking every cycle.
+//! With the output enabled, every channel's amplitude changes are added to two BlipBuffers
+//! (left and right) and the samples are generated in blocks of APU_BLOCK_CYCLES.
+class APU {
+public:
+    //! 0xFF26 bit 7, all sound on/off.
+    bool powered;
+    //! 0xFF24 master volume and VIN panning.
+    u8 nr50;
+    //! 0xFF25 channel panning, bits 0-3 right and 4-7 left.
+    u8 nr51;
+
+    //! The next frame sequencer step (0~7).
+    u8 frameSequencerStep;
+
+    APUSquareChannel square1;
+    APUSquareChannel square2;
+    APUWaveChannel wave;
+    APUNoiseChannel noise;
+
+    //! 0xFF30~0xFF3F
+    u8 waveRam[16];
+
+    //! The clock cycle the APU has run up to.
+    u64 syncCycles;
+
+    // clockCycles is the current emulator clock.
+    void Init(u64 clockCycles);
+
+    // runs the APU up to the current emulator clock.
+    void Sync(Emulator* emu);
+    // called on the falling edge of APU_FRAME_SEQUENCER_DIV_BIT, also when DIV is reset.
+    // The APU must be synced.
+    void StepFrameSequencer();
+
+    // the APU must be synced before accessing the registers.
+    u8 BusRead(u16 addr);
+    void BusWrite(u16 addr, u8 data);
+
+    // sets the output sample rate in Hz, 0 disables the output and all synthesis.
+    void SetOutputRate(u32 sampleRate);
+    u32 OutputRate() const { return outputRate; }
+    // syncs and returns the number of stereo sample frames ready to be read.
+    u32 SamplesAvailable(Emulator* emu);
+    // syncs and reads at most maxFrames stereo frames (interleaved left, right) into out,
+    // returns the number of frames read.
+    u32 ReadSamples(Emulator* emu, i16* out, u32 maxFrames);
+
+    // the output buffers are not part of the state.
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+
+private:
+    // run the channels for the clock cycles in (syncCycles, end].
+    void RunSquare(APUSquareChannel& channel, u8 index, u64 end);
+    void RunWave(u64 end);
+    void RunNoise(u64 end);
+
+    void PowerOff();
+    void WriteNRx4(u8 channel, u8 data);
+    void TriggerSquare(APUSquareChannel& channel);
+    void TriggerWave();
+    void TriggerNoise();
+    u16 SweepCalculate();
+    void ClockSweep();
+    void ClockLengths();
+    APULength& Length(u8 channel);
+    bool& Enabled(u8 channel);
+    u8 WaveOutput() const;
+    u8 NoiseOutput() const;
+
+    // adds the change of one channel's output at cycle to the output buffers.
+    void Emit(u8 channel, u8 output, u64 cycle) {
+        u8 enabled = nr51 >> channel;
+        i32 newLeft = (enabled & 0x10) ? output * leftGain : 0;
+        i32 newRight = (enabled & 0x01) ? output * rightGain : 0;
+        u32 time = (u32)(cycle - blockStart);
+        if(newLeft != outputLeft[channel]) {
+            left.AddDelta(time, newLeft - outputLeft[channel]);
+            outputLeft[channel] = newLeft;
+        }
+        if(newRight != outputRight[channel]) {
+            right.AddDelta(time, newRight - outputRight[channel]);
+            outputRight[channel] = newRight;
+        }
+    }
+    // emits the current output of all channels, after register writes and frame sequencer steps.
+    void UpdateOutput();
+    void EndBlock(u64 cycle);
+
+    u32 outputRate = 0;
+    //! The clock cycle the current output block started at.
+    u64 blockStart = 0;
+    //! The master volume times APU_OUTPUT_SCALE.
+    i32 leftGain = 0;
+    i32 rightGain = 0;
+    //! The amplitude of every channel in the output buffers.
+    i32 outputLeft[4] = {};
+    i32 outputRight[4] = {};
+    BlipBuffer left;
+    BlipBuffer right;
+};
+
+
+#endif //GAMEBOY_EMULATOR_APU_H
@@ -0,0 +1,256 @@
+/**
+  ******************************************************************************
+  * @file           : audio_output.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "audio_output.h"
+#include "emulator.h"
+#include "log-min.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+//! The frames moved from the APU to the ring at once.
+constexpr u32 AUDIO_PUSH_FRAMES = 2048;
+//! The ring holds this many times the target fill, the room absorbs a late sink.
+constexpr u32 AUDIO_RING_TARGETS = 4;
+constexpr u32 WAV_HEADER_SIZE = 44;
+
+void AudioRingBuffer::Init(u32 capacity) {
+    u32 size = 1;
+    while(size < capacity) size <<= 1;
+    data.assign((u64)size * 2, 0);
+    mask = size - 1;
+    writeIndex.store(0, std::memory_order_relaxed);
+    readIndex.store(0, std::memory_order_relaxed);
+}
+
+u32 AudioRingBuffer::Write(const i16 *frames, u32 count) {
+    u32 write = writeIndex.load(std::memory_order_relaxed);
+    u32 read = readIndex.load(std::memory_order_acquire);
+    count = std::min(count, Capacity() - (write - read));
+    // At most two runs, up to the end of the buffer and from its start.
+    u32 start = write & mask;
+    u32 first = std::min(count, Capacity() - start);
+    memcpy(data.data() + start * 2, frames, first * 2 * sizeof(i16));
+    memcpy(data.data(), frames + first * 2, (count - first) * 2 * sizeof(i16));
+    writeIndex.store(write + count, std::memory_order_release);
+    return count;
+}
+
+u32 AudioRingBuffer::Read(i16 *frames, u32 count) {
+    u32 read = readIndex.load(std::memory_order_relaxed);
+    u32 write = writeIndex.load(std::memory_order_acquire);
+    count = std::min(count, write - read);
+    u32 start = read & mask;
+    u32 first = std::min(count, Capacity() - start);
+    memcpy(frames, data.data() + start * 2, first * 2 * sizeof(i16));
+    memcpy(frames + first * 2, data.data(), (count - first) * 2 * sizeof(i16));
+    readIndex.store(read + count, std::memory_order_release);
+    return count;
+}
+
+NullAudioSink::~NullAudioSink() {
+    Stop();
+}
+
+bool NullAudioSink::Start(AudioRingBuffer *ring, u32 sampleRate) {
+    Stop();
+    this->ring = ring;
+    this->sampleRate = sampleRate;
+    // Room for four periods, a late wakeup consumes the missed periods in several runs.
+    periodBuffer.assign((u64)(sampleRate * PERIOD_MS / 1000 + 1) * 4 * 2, 0);
+    stopping = false;
+    underrunFrames.store(0, std::memory_order_relaxed);
+    worker = std::thread(&NullAudioSink::WorkerMain, this);
+    return true;
+}
+
+void NullAudioSink::Stop() {
+    if(!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void NullAudioSink::WorkerMain() {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    u64 consumed = 0;
+    u32 periodFrames = (u32)(periodBuffer.size() / 2);
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!cv.wait_for(lock, std::chrono::milliseconds(PERIOD_MS), [this] { return stopping; })) {
+        lock.unlock();
+        f64 elapsed = std::chrono::duration<f64>(clock::now() - start).count();
+        u64 due = (u64)(elapsed * sampleRate);
+        while(consumed < due) {
+            u32 count = (u32)std::min<u64>(due - consumed, periodFrames);
+            u32 read = ring->Read(periodBuffer.data(), count);
+            if(read < count) {
+                // The device plays silence when the ring runs dry.
+                memset(periodBuffer.data() + read * 2, 0, (count - read) * 2 * sizeof(i16));
+                underrunFrames.fetch_add(count - read, std::memory_order_relaxed);
+            }
+            Consume(periodBuffer.data(), count);
+            consumed += count;
+        }
+        lock.lock();
+    }
+}
+
+WavAudioSink::~WavAudioSink() {
+    Close();
+}
+
+bool WavAudioSink::Open(const char *path) {
+    Close();
+    file = fopen(path, "wb");
+    if(!file) {
+        ERROR("failed to open audio file: %s", path);
+        return false;
+    }
+    framesWritten.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+void WavAudioSink::Close() {
+    if(!file) return;
+    Stop();
+    // The sizes are known now, rewrite the header.
+    u64 dataSize = framesWritten.load(std::memory_order_relaxed) * 4;
+    fseek(file, 0, SEEK_SET);
+    WriteHeader((u32)std::min<u64>(dataSize, 0xFFFFFFFF - WAV_HEADER_SIZE));
+    fclose(file);
+    file = nullptr;
+}
+
+bool WavAudioSink::Start(AudioRingBuffer *ring, u32 sampleRate) {
+    if(!file) {
+        ERROR("the audio file is not open!");
+        return false;
+    }
+    this->sampleRate = sampleRate;
+    WriteHeader(0);
+    return NullAudioSink::Start(ring, sampleRate);
+}
+
+static void PutU16(u8* p, u16 v) {
+    p[0] = (u8)v;
+    p[1] = (u8)(v >> 8);
+}
+
+static void PutU32(u8* p, u32 v) {
+    PutU16(p, (u16)v);
+    PutU16(p + 2, (u16)(v >> 16));
+}
+
+void WavAudioSink::WriteHeader(u32 dataSize) {
+    u8 header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    PutU32(header + 4, WAV_HEADER_SIZE - 8 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    PutU32(header + 16, 16);                // fmt chunk size
+    PutU16(header + 20, 1);                 // PCM
+    PutU16(header + 22, 2);                 // channels
+    PutU32(header + 24, sampleRate);
+    PutU32(header + 28, sampleRate * 4);    // bytes per second
+    PutU16(header + 32, 4);                 // bytes per frame
+    PutU16(header + 34, 16);                // bits per sample
+    memcpy(header + 36, "data", 4);
+    PutU32(header + 40, dataSize);
+    fwrite(header, 1, WAV_HEADER_SIZE, file);
+}
+
+void WavAudioSink::Consume(const i16 *frames, u32 count) {
+    // The samples are written little endian.
+    u8 bytes[256 * 4];
+    while(count) {
+        u32 n = std::min<u32>(count, 256);
+        for(u32 i = 0; i < n * 2; ++i) {
+            PutU16(bytes + i * 2, (u16)frames[i]);
+        }
+        fwrite(bytes, 4, n, file);
+        framesWritten.fetch_add(n, std::memory_order_relaxed);
+        frames += n * 2;
+        count -= n;
+    }
+}
+
+void AudioRateController::Reset(u32 targetFill) {
+    target = (f64)std::max(targetFill, 1u);
+    smoothedFill = target;
+}
+
+f64 AudioRateController::Update(u32 fill) {
+    smoothedFill += ((f64)fill - smoothedFill) / AUDIO_FILL_SMOOTHING;
+    // Proportional to the distance from the target, the full adjustment at an empty ring or
+    // at twice the target.
+    f64 error = std::max(-1.0, std::min((target - smoothedFill) / target, 1.0));
+    return 1.0 + AUDIO_MAX_RATE_ADJUST * error;
+}
+
+AudioOutput::~AudioOutput() {
+    Stop(nullptr);
+}
+
+bool AudioOutput::Start(Emulator *emu, std::unique_ptr<AudioSink> sink, u32 sampleRate, u32 latencyMs) {
+    Stop(emu);
+    this->sampleRate = sampleRate;
+    targetFill = std::max(sampleRate * latencyMs / 1000, 1u);
+    ring.Init(targetFill * AUDIO_RING_TARGETS);
+    pushBuffer.assign(AUDIO_PUSH_FRAMES * 2, 0);
+    // Start at the target latency, the sink plays silence until the first samples arrive.
+    std::vector<i16> silence((u64)targetFill * 2, 0);
+    ring.Write(silence.data(), targetFill);
+    rateController.Reset(targetFill);
+    rateAdjust = 1.0;
+    overrunFrames = 0;
+    emu->apu.SetOutputRate(sampleRate);
+    if(!sink->Start(&ring, sampleRate)) {
+        emu->apu.SetOutputRate(0);
+        return false;
+    }
+    this->sink = std::move(sink);
+    return true;
+}
+
+void AudioOutput::Stop(Emulator *emu) {
+    if(!sink) return;
+    sink->Stop();
+    sink.reset();
+    if(emu) {
+        emu->apu.SetOutputRate(0);
+        emu->clockRateAdjust = 1.0;
+    }
+    if(overrunFrames) {
+        WARN("audio output dropped %llu frames.", (unsigned long long)overrunFrames);
+    }
+}
+
+void AudioOutput::Push(Emulator *emu) {
+    if(!sink) return;
+    if(emu->apu.OutputRate() != sampleRate) {
+        // The emulator was reinitialized.
+        emu->apu.SetOutputRate(sampleRate);
+    }
+    // The fill just before the new frame arrives, the margin left before an underrun.
+    u32 fill = ring.Fill();
+    u32 count;
+    do {
+        count = emu->apu.ReadSamples(emu, pushBuffer.data(), AUDIO_PUSH_FRAMES);
+        overrunFrames += count - ring.Write(pushBuffer.data(), count);
+    } while(count == AUDIO_PUSH_FRAMES);
+    rateAdjust = rateController.Update(fill);
+    emu->clockRateAdjust = rateAdjust;
+}
@@ -0,0 +1,197 @@
+/**
+  ******************************************************************************
+  * @file           : audio_output.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_AUDIO_OUTPUT_H
+#define GAMEBOY_EMULATOR_AUDIO_OUTPUT_H
+
+#include "type.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Emulator;
+
+//! The largest change of the emulated clock rate the rate control makes, 0.5% is not audible
+//! as pitch and not visible as frame rate.
+constexpr f64 AUDIO_MAX_RATE_ADJUST = 0.005;
+//! The fill is averaged over about this many updates, one update adds a whole frame of samples
+//! at once, the sink drains them continuously.
+constexpr f64 AUDIO_FILL_SMOOTHING = 16.0;
+
+//! A lock-free single producer, single consumer queue of interleaved stereo sample frames.
+//! The emulation thread writes, the sink reads on its own thread, neither ever blocks.
+//! The capacity is a power of two, the indices run freely and are masked on access.
+class AudioRingBuffer {
+public:
+    // capacity in frames is rounded up to a power of two, must not be called while in use.
+    void Init(u32 capacity);
+    u32 Capacity() const { return mask + 1; }
+
+    // the frames waiting to be read, exact from either side, a lower bound for the producer.
+    u32 Fill() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+
+    //! Producer side.
+    // copies at most count frames from frames, returns the number written, the rest does not fit.
+    u32 Write(const i16* frames, u32 count);
+
+    //! Consumer side.
+    // copies at most count frames into frames, returns the number read.
+    u32 Read(i16* frames, u32 count);
+
+private:
+    std::vector<i16> data;
+    u32 mask = 0;
+    //! The producer and the consumer index on their own cache lines. They are padded apart
+    //! instead of aligned, an over-aligned member would make App over-aligned, which new
+    //! does not honour before C++17.
+    std::atomic<u32> writeIndex{0};
+    c8 writeIndexPadding[64 - sizeof(std::atomic<u32>)];
+    std::atomic<u32> readIndex{0};
+    c8 readIndexPadding[64 - sizeof(std::atomic<u32>)];
+};
+
+//! Plays the samples of an AudioRingBuffer at its own clock.
+//! A platform audio backend implements this with its device callback reading the ring.
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+    // starts consuming ring at sampleRate stereo frames per second, returns false on failure.
+    virtual bool Start(AudioRingBuffer* ring, u32 sampleRate) = 0;
+    virtual void Stop() = 0;
+
+    // the frames the sink had to play as silence because the ring was empty.
+    u64 UnderrunFrames() const { return underrunFrames.load(std::memory_order_relaxed); }
+
+protected:
+    std::atomic<u64> underrunFrames{0};
+};
+
+//! Drains the ring on a background thread at exactly the sample rate of the steady clock, like
+//! an audio device would, and discards the samples. Headless runs use it to exercise the rate
+//! control without a device.
+class NullAudioSink : public AudioSink {
+public:
+    static constexpr u32 PERIOD_MS = 5;
+
+    NullAudioSink() = default;
+    ~NullAudioSink() override;
+    NullAudioSink(const NullAudioSink&) = delete;
+    NullAudioSink& operator=(const NullAudioSink&) = delete;
+
+    bool Start(AudioRingBuffer* ring, u32 sampleRate) override;
+    void Stop() override;
+
+protected:
+    // called on the worker thread with every period's frames, silence included.
+    virtual void Consume(const i16* frames, u32 count) { (void)frames; (void)count; }
+
+    u32 sampleRate = 0;
+
+private:
+    void WorkerMain();
+
+    AudioRingBuffer* ring = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::vector<i16> periodBuffer;
+};
+
+//! Records what a device would have played to a 16 bit stereo PCM .wav file, underruns
+//! included as silence.
+class WavAudioSink : public NullAudioSink {
+public:
+    ~WavAudioSink() override;
+
+    bool Open(const char* path);
+    bool IsOpen() const { return file != nullptr; }
+    // stops the sink, completes the header and closes the file.
+    void Close();
+
+    bool Start(AudioRingBuffer* ring, u32 sampleRate) override;
+
+    u64 FramesWritten() const { return framesWritten.load(std::memory_order_relaxed); }
+
+protected:
+    void Consume(const i16* frames, u32 count) override;
+
+private:
+    void WriteHeader(u32 dataSize);
+
+    FILE* file = nullptr;
+    std::atomic<u64> framesWritten{0};
+};
+
+//! Keeps the ring fill at its target by nudging the emulated clock rate.
+//! The emulator is paced by the steady clock and the device by its own crystal, the two
+//! always drift apart a little. Running the emulation up to AUDIO_MAX_RATE_ADJUST faster
+//! while the ring runs low and slower while it fills up keeps the latency stable without
+//! ever dropping or repeating samples.
+class AudioRateController {
+public:
+    void Reset(u32 targetFill);
+    // returns the clock rate adjustment for the next update, see Emulator::clockRateAdjust.
+    f64 Update(u32 fill);
+
+    f64 SmoothedFill() const { return smoothedFill; }
+
+private:
+    f64 target = 0.0;
+    f64 smoothedFill = 0.0;
+};
+
+//! The audio path from the APU to a sink: the APU output is moved into the ring after every
+//! emulator update, the sink plays it, and the fill drives the rate control.
+class AudioOutput {
+public:
+    ~AudioOutput();
+
+    // enables the APU output and starts the sink. latencyMs is the target fill of the ring,
+    // which starts out filled with that much silence.
+    bool Start(Emulator* emu, std::unique_ptr<AudioSink> sink, u32 sampleRate, u32 latencyMs);
+    // stops the sink and disables the APU output and the rate control.
+    void Stop(Emulator* emu);
+    bool IsRunning() const { return sink != nullptr; }
+    AudioSink* Sink() const { return sink.get(); }
+
+    // emulation thread, after every Emulator::Update(): moves the new samples into the ring and
+    // sets the clock rate adjustment of the next update.
+    void Push(Emulator* emu);
+
+    u32 SampleRate() const { return sampleRate; }
+    u32 Fill() const { return ring.Fill(); }
+    u32 TargetFill() const { return targetFill; }
+    f64 RateAdjust() const { return rateAdjust; }
+    // the frames dropped because the ring was full.
+    u64 OverrunFrames() const { return overrunFrames; }
+
+private:
+    AudioRingBuffer ring;
+    AudioRateController rateController;
+    std::unique_ptr<AudioSink> sink;
+    u32 sampleRate = 0;
+    u32 targetFill = 0;
+    f64 rateAdjust = 1.0;
+    u64 overrunFrames = 0;
+    std::vector<i16> pushBuffer;
+};
+
+
+#endif //GAMEBOY_EMULATOR_AUDIO_OUTPUT_H
@@ -0,0 +1,108 @@
+/**
+  ******************************************************************************
+  * @file           : blip_buffer.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "blip_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+i16 BlipBuffer::kernel[BLIP_PHASES][BLIP_WIDTH];
+
+void BlipBuffer::InitKernel() {
+    const f64 pi = 3.14159265358979323846;
+    // Pass up to 90% of the output Nyquist frequency.
+    const f64 cutoff = 0.9;
+    const f64 halfWidth = BLIP_WIDTH / 2;
+    for(u32 phase = 0; phase < BLIP_PHASES; ++phase) {
+        // The step starts phase / BLIP_PHASES samples after the first tap's sample, the kernel is
+        // centered between taps BLIP_WIDTH / 2 - 1 and BLIP_WIDTH / 2.
+        f64 fraction = (f64)phase / BLIP_PHASES;
+        f64 taps[BLIP_WIDTH];
+        f64 sum = 0.0;
+        for(u32 i = 0; i < BLIP_WIDTH; ++i) {
+            f64 t = (f64)i - (halfWidth - 1.0) - fraction;
+            f64 x = pi * cutoff * t;
+            f64 sinc = t == 0.0 ? 1.0 : std::sin(x) / x;
+            // Blackman window over [-halfWidth, halfWidth].
+            f64 w = (t + halfWidth) / (2.0 * halfWidth);
+            f64 window = 0.42 - 0.5 * std::cos(2.0 * pi * w) + 0.08 * std::cos(4.0 * pi * w);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+        // Normalize every phase to exactly 1 << BLIP_KERNEL_BITS, so that the integrated steps
+        // have exactly the height of their deltas.
+        i32 total = 0;
+        u32 largest = 0;
+        for(u32 i = 0; i < BLIP_WIDTH; ++i) {
+            kernel[phase][i] = (i16)std::lround(taps[i] / sum * (1 << BLIP_KERNEL_BITS));
+            total += kernel[phase][i];
+            if(kernel[phase][i] > kernel[phase][largest]) largest = i;
+        }
+        kernel[phase][largest] = (i16)(kernel[phase][largest] + ((1 << BLIP_KERNEL_BITS) - total));
+    }
+}
+
+void BlipBuffer::Init(u32 clockRate, u32 sampleRate, u32 capacity) {
+    static bool kernelInitialized = (InitKernel(), true);
+    (void)kernelInitialized;
+    assert(clockRate && sampleRate && capacity && "invalid blip buffer rates!");
+    factor = (u64)((f64)sampleRate / (f64)clockRate * 4294967296.0);
+    this->capacity = capacity;
+    buffer.assign(capacity + BLIP_WIDTH, 0);
+    Clear();
+}
+
+void BlipBuffer::Clear() {
+    offset = 0;
+    integrator = 0;
+    std::fill(buffer.begin(), buffer.end(), 0);
+}
+
+void BlipBuffer::EndBlock(u32 clocks) {
+    offset += (u64)clocks * factor;
+    assert(SamplesAvailable() <= capacity && "blip buffer block too long!");
+}
+
+u32 BlipBuffer::MaxBlockClocks() const {
+    if(!factor) return 0;
+    u64 room = ((u64)capacity << 32) - offset;
+    return (u32)std::min<u64>(room / factor, 0xFFFFFFFF);
+}
+
+u32 BlipBuffer::ReadSamples(i16 *out, u32 maxCount, u32 stride) {
+    u32 count = std::min(maxCount, SamplesAvailable());
+    i32 sum = integrator;
+    for(u32 i = 0; i < count; ++i) {
+        sum += buffer[i];
+        i32 sample = sum >> BLIP_KERNEL_BITS;
+        if(out) out[i * stride] = (i16)std::max(-32768, std::min(32767, sample));
+        sum -= sum >> BLIP_BASS_SHIFT;
+    }
+    integrator = sum;
+    Discard(count);
+    return count;
+}
+
+void BlipBuffer::RemoveSamples(u32 count) {
+    ReadSamples(nullptr, count, 0);
+}
+
+void BlipBuffer::Discard(u32 count) {
+    if(!count) return;
+    u32 available = SamplesAvailable();
+    u32 remaining = available - count + BLIP_WIDTH;
+    memmove(buffer.data(), buffer.data() + count, remaining * sizeof(i32));
+    std::fill(buffer.begin() + remaining, buffer.begin() + remaining + count, 0);
+    offset -= (u64)count << 32;
+}
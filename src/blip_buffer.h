@@ -0,0 +1,89 @@
+/**
+  ******************************************************************************
+  * @file           : blip_buffer.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_BLIP_BUFFER_H
+#define GAMEBOY_EMULATOR_BLIP_BUFFER_H
+
+#include "type.h"
+
+#include <vector>
+
+//! The number of sub-sample positions a step can start at.
+constexpr u32 BLIP_PHASE_BITS = 5;
+constexpr u32 BLIP_PHASES = 1 << BLIP_PHASE_BITS;
+//! The number of output samples one step is spread over.
+constexpr u32 BLIP_WIDTH = 16;
+//! The fixed point precision of the kernel, the taps of one phase sum to 1 << BLIP_KERNEL_BITS.
+constexpr u32 BLIP_KERNEL_BITS = 14;
+//! The output is high-pass filtered by subtracting 1 / (1 << BLIP_BASS_SHIFT) of it per sample,
+//! which removes the DC offset of the channels like the capacitor of the real hardware.
+constexpr u32 BLIP_BASS_SHIFT = 9;
+
+//! Band-limited step synthesis, in the style of blargg's Blip_Buffer.
+//! A signal is described by its amplitude changes (deltas) at clock cycle times. Each delta is
+//! added to the output as a step filtered by a windowed sinc kernel, so square waves of any
+//! frequency are resampled to the output rate without aliasing, and the cost only depends on
+//! the number of deltas, not on the number of clock cycles.
+//! Time is measured in blocks: deltas are added relative to the start of the current block,
+//! and EndBlock() makes the samples up to the end of the block readable.
+class BlipBuffer {
+public:
+    // capacity is the number of samples that can be waiting to be read, the oldest samples are
+    // dropped when more are generated.
+    void Init(u32 clockRate, u32 sampleRate, u32 capacity);
+    void Clear();
+
+    // adds an amplitude change at time clock cycles after the start of the current block.
+    void AddDelta(u32 time, i32 delta) {
+        u64 position = offset + (u64)time * factor;
+        u32 index = (u32)(position >> 32);
+        const i16* taps = kernel[(position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+        i32* out = &buffer[index];
+        for(u32 i = 0; i < BLIP_WIDTH; ++i) {
+            out[i] += delta * taps[i];
+        }
+    }
+
+    // ends the current block after clocks clock cycles, the next block starts there.
+    void EndBlock(u32 clocks);
+
+    // the largest block in clock cycles that fits after the samples waiting to be read.
+    u32 MaxBlockClocks() const;
+
+    u32 SamplesAvailable() const { return (u32)(offset >> 32); }
+
+    // reads at most maxCount samples, writing every stride-th element of out so that two
+    // buffers can fill an interleaved stereo buffer, returns the number of samples read.
+    // Only the samples of ended blocks are read, the current block must be empty.
+    u32 ReadSamples(i16* out, u32 maxCount, u32 stride);
+    // drops the oldest count samples.
+    void RemoveSamples(u32 count);
+
+private:
+    static i16 kernel[BLIP_PHASES][BLIP_WIDTH];
+    static void InitKernel();
+    // removes count read samples from the front of the buffer.
+    void Discard(u32 count);
+
+    //! Output samples per clock cycle, 32.32 fixed point.
+    u64 factor = 0;
+    //! The start of the current block in samples from the first unread one, 32.32 fixed point.
+    u64 offset = 0;
+    //! The running sum of the deltas, the integrator turning them back into amplitudes.
+    i32 integrator = 0;
+    u32 capacity = 0;
+    //! The filtered deltas, BLIP_WIDTH more than the capacity for the tails of the last steps.
+    std::vector<i32> buffer;
+};
+
+
+#endif //GAMEBOY_EMULATOR_BLIP_BUFFER_H
@@ -14,6 +14,8 @@
 #include "emulator.h"
 #include "log-min.h"
 
+#include <cassert>
+
 CartridgeHeader *GetCartridgeHeader(byte *romData) {
     return (CartridgeHeader*)(romData + 0x0100);
 }
@@ -135,7 +137,7 @@ u8 mbc1_read(Emulator* emu, u16 addr)
     }
     if(addr >= 0xA000 && addr <= 0xBFFF)
     {
-        if(emu->cRam)
+        if(emu->cRam_size)
         {
             if(!emu->cram_enable) return 0xFF;
             if(emu->num_rom_banks <= 32)
@@ -145,18 +147,18 @@ u8 mbc1_read(Emulator* emu, u16 addr)
                     // Advanced banking mode.
                     u32 bank_offset = emu->ram_bank_number * 8 * kb;
                     assert(bank_offset + (addr - 0xA000) <= emu->cRam_size);
-                    return emu->cRam[bank_offset + (addr - 0xA000)];
+                    return emu->cRam.Read(bank_offset + (addr - 0xA000));
                 }
                 else
                 {
                     // Simple banking mode.
-                    return emu->cRam[addr - 0xA000];
+                    return emu->cRam.Read(addr - 0xA000);
                 }
             }
             else
             {
                 // ram_bank_number is used for switching ROM banks, use 1 ram page.
-                return emu->cRam[addr - 0xA000];
+                return emu->cRam.Read(addr - 0xA000);
             }
         }
     }
@@ -169,7 +171,7 @@ void mbc1_write(Emulator* emu, u16 addr, u8 data)
     if(addr <= 0x1FFF)
     {
         // Enable/disable cartridge RAM.
-        if(emu->cRam)
+        if(emu->cRam_size)
         {
             if((data & 0x0F) == 0x0A)
             {
@@ -244,7 +246,7 @@ void mbc1_write(Emulator* emu, u16 addr, u8 data)
     }
     if(addr >= 0xA000 && addr <= 0xBFFF)
     {
-        if(emu->cRam)
+        if(emu->cRam_size)
         {
             if(!emu->cram_enable) return;
             if(emu->num_rom_banks <= 32)
@@ -254,18 +256,18 @@ void mbc1_write(Emulator* emu, u16 addr, u8 data)
                     // Advanced banking mode.
                     u32 bank_offset = emu->ram_bank_number * 8 * kb;
                     assert(bank_offset + (addr - 0xA000) <= emu->cRam_size);
-                    emu->cRam[bank_offset + (addr - 0xA000)] = data;
+                    emu->cRam.Write(bank_offset + (addr - 0xA000), data);
                 }
                 else
                 {
                     // Simple banking mode.
-                    emu->cRam[addr - 0xA000] = data;
+                    emu->cRam.Write(addr - 0xA000, data);
                 }
             }
             else
             {
                 // ram_bank_number is used for switching ROM banks, use 1 ram page.
-                emu->cRam[addr - 0xA000] = data;
+                emu->cRam.Write(addr - 0xA000, data);
             }
             return;
         }
@@ -291,7 +293,7 @@ u8 mbc2_read(Emulator* emu, u16 addr)
         if(!emu->cram_enable) return 0xFF;
         u16 data_offset = addr - 0xA000;
         data_offset %= 512;
-        return (emu->cRam[data_offset] & 0x0F) | 0xF0;
+        return (emu->cRam.Read(data_offset) & 0x0F) | 0xF0;
     }
     ERROR("Unsupported MBC2 cartridge read address: 0x%04X", (u32)addr);
     return 0xFF;
@@ -326,7 +328,7 @@ void mbc2_write(Emulator* emu, u16 addr, u8 data)
         else
         {
             // Enable/disable cartridge RAM.
-            if(emu->cRam)
+            if(emu->cRam_size)
             {
                 if(data == 0x0A)
                 {
@@ -345,7 +347,7 @@ void mbc2_write(Emulator* emu, u16 addr, u8 data)
         if(!emu->cram_enable) return;
         u16 data_offset = addr - 0xA000;
         data_offset %= 512;
-        emu->cRam[data_offset] = data & 0x0F;
+        emu->cRam.Write(data_offset, data & 0x0F);
         return;
     }
     ERROR("Unsupported MBC2 cartridge write address: 0x%04X", (u32)addr);
@@ -368,12 +370,12 @@ u8 mbc3_read(Emulator* emu, u16 addr)
     {
         if(emu->ram_bank_number <= 0x03)
         {
-            if(emu->cRam)
+            if(emu->cRam_size)
             {
                 if(!emu->cram_enable) return 0xFF;
                 u32 bank_offset = emu->ram_bank_number * 8 * kb;
                 assert(bank_offset + (addr - 0xA000) <= emu->cRam_size);
-                return emu->cRam[bank_offset + (addr - 0xA000)];
+                return emu->cRam.Read(bank_offset + (addr - 0xA000));
             }
         }
         if(is_cart_timer(GetCartridgeHeader(emu->romData)->cartridge_type) &&
@@ -440,12 +442,12 @@ void mbc3_write(Emulator* emu, u16 addr, u8 data)
     {
         if(emu->ram_bank_number <= 0x03)
         {
-            if(emu->cRam)
+            if(emu->cRam_size)
             {
                 if(!emu->cram_enable) return;
                 u32 bank_offset = emu->ram_bank_number * 8 * kb;
                 assert(bank_offset + (addr - 0xA000) <= emu->cRam_size);
-                emu->cRam[bank_offset + (addr - 0xA000)] = data;
+                emu->cRam.Write(bank_offset + (addr - 0xA000), data);
                 return;
             }
         }
@@ -477,8 +479,8 @@ u8 CartridgeRead(Emulator *emu, u16 addr) {
         if(addr <= 0x7FFF) {
             return emu->romData[addr];
         }
-        if(addr >= 0xA000 && addr <= 0xBFFF && emu->cRam) {
-            return emu->cRam[addr - 0xA000];
+        if(addr >= 0xA000 && addr <= 0xBFFF && emu->cRam_size) {
+            return emu->cRam.Read(addr - 0xA000);
         }
     }
 
@@ -487,6 +489,18 @@ u8 CartridgeRead(Emulator *emu, u16 addr) {
 }
 
 
+u32 CartridgeRomBank(Emulator *emu, u16 addr) {
+    u8 cartridge_type = GetCartridgeHeader(emu->romData)->cartridge_type;
+    bool mbc1_large = is_cart_mbc1(cartridge_type) && emu->banking_mode && emu->num_rom_banks > 32;
+    if(addr <= 0x3FFF) {
+        return mbc1_large ? (u32)emu->ram_bank_number * 32 : 0;
+    }
+    if(!is_cart_mbc1(cartridge_type) && !is_cart_mbc2(cartridge_type) && !is_cart_mbc3(cartridge_type)) {
+        return 1;
+    }
+    return mbc1_large ? emu->rom_bank_number + ((u32)emu->ram_bank_number << 5) : emu->rom_bank_number;
+}
+
 void CartridgeWrite(Emulator *emu, u16 addr, u8 data) {
     u8 cartridge_type = GetCartridgeHeader(emu->romData)->cartridge_type;
 
@@ -505,9 +519,9 @@ void CartridgeWrite(Emulator *emu, u16 addr, u8 data) {
         return;
     }
     else {
-        if(addr >= 0xA000 && addr <= 0xBFFF && emu->cRam)
+        if(addr >= 0xA000 && addr <= 0xBFFF && emu->cRam_size)
         {
-            emu->cRam[addr - 0xA000] = data;
+            emu->cRam.Write(addr - 0xA000, data);
             return;
         }
     }
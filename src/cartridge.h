@@ -108,6 +108,9 @@ u8 CartridgeRead(Emulator *emu, u16 addr);
 
 void CartridgeWrite(Emulator *emu, u16 addr, u8 data);
 
+// the ROM bank currently mapped at addr (0x0000~0x7FFF).
+u32 CartridgeRomBank(Emulator *emu, u16 addr);
+
 inline bool is_cart_mbc1(u8 cartridge_type)
 {
     return cartridge_type >= 1 && cartridge_type <= 3;
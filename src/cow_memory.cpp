@@ -0,0 +1,115 @@
+/**
+  ******************************************************************************
+  * @file           : cow_memory.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/30
+  ******************************************************************************
+  */
+
+
+
+#include "cow_memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+CowMemory::~CowMemory() {
+    Release();
+}
+
+void CowMemory::Init(u64 size) {
+    Release();
+    this->size = size;
+    u32 numPages = (u32)((size + COW_PAGE_SIZE - 1) >> COW_PAGE_SHIFT);
+    pages.resize(numPages);
+    for(u32 i = 0; i < numPages; ++i) {
+        Page* page = new Page;
+        page->refs.store(1, std::memory_order_relaxed);
+        memset(page->data, 0, COW_PAGE_SIZE);
+        pages[i] = page;
+    }
+    owned.assign((numPages + 63) / 64, ~(u64)0);
+}
+
+void CowMemory::Release() {
+    for(Page* page : pages) {
+        ReleasePage(page);
+    }
+    pages.clear();
+    owned.clear();
+    size = 0;
+}
+
+byte *CowMemory::WritePtr(u64 offset) {
+    u32 index = (u32)(offset >> COW_PAGE_SHIFT);
+    if(!((owned[index >> 6] >> (index & 63)) & 1)) {
+        MakePageOwned(index);
+    }
+    return pages[index]->data + (offset & (COW_PAGE_SIZE - 1));
+}
+
+void CowMemory::CopyTo(void *dst, u64 offset, u64 count) const {
+    byte* out = (byte*)dst;
+    while(count) {
+        u64 n = std::min<u64>(count, COW_PAGE_SIZE - (offset & (COW_PAGE_SIZE - 1)));
+        memcpy(out, ReadPtr(offset), n);
+        out += n;
+        offset += n;
+        count -= n;
+    }
+}
+
+void CowMemory::CopyFrom(u64 offset, const void *src, u64 count) {
+    const byte* in = (const byte*)src;
+    while(count) {
+        u64 n = std::min<u64>(count, COW_PAGE_SIZE - (offset & (COW_PAGE_SIZE - 1)));
+        memcpy(WritePtr(offset), in, n);
+        in += n;
+        offset += n;
+        count -= n;
+    }
+}
+
+void CowMemory::ShareFrom(CowMemory &src) {
+    if(&src == this) return;
+    for(Page* page : pages) {
+        ReleasePage(page);
+    }
+    pages = src.pages;
+    for(Page* page : pages) {
+        page->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    size = src.size;
+    // Neither side may write in place any more.
+    owned.assign(src.owned.size(), 0);
+    std::fill(src.owned.begin(), src.owned.end(), 0);
+}
+
+u32 CowMemory::SharedPageCount() const {
+    u32 count = 0;
+    for(u32 i = 0; i < (u32)pages.size(); ++i) {
+        if(!((owned[i >> 6] >> (i & 63)) & 1)) ++count;
+    }
+    return count;
+}
+
+void CowMemory::MakePageOwned(u32 index) {
+    Page* page = pages[index];
+    // The other references may have been released since the page was shared.
+    if(page->refs.load(std::memory_order_acquire) != 1) {
+        Page* copy = new Page;
+        copy->refs.store(1, std::memory_order_relaxed);
+        memcpy(copy->data, page->data, COW_PAGE_SIZE);
+        ReleasePage(page);
+        pages[index] = copy;
+    }
+    owned[index >> 6] |= (u64)1 << (index & 63);
+}
+
+void CowMemory::ReleasePage(CowMemory::Page *page) {
+    if(page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete page;
+    }
+}
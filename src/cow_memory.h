@@ -0,0 +1,86 @@
+/**
+  ******************************************************************************
+  * @file           : cow_memory.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/30
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_COW_MEMORY_H
+#define GAMEBOY_EMULATOR_COW_MEMORY_H
+
+#include "type.h"
+
+#include <atomic>
+#include <vector>
+
+constexpr u32 COW_PAGE_SHIFT = 8;
+constexpr u32 COW_PAGE_SIZE = 1 << COW_PAGE_SHIFT;
+
+//! A byte array split into reference counted pages that can be shared between emulators.
+//! Sharing only copies the page table, a shared page is copied on the first write to it.
+//! The owned bitmap records the pages this instance may write in place, so the fast path
+//! of a write is one bit test.
+//! Reference counts are atomic, so memories sharing pages may be used from different threads,
+//! but one CowMemory instance must not be shared or written concurrently.
+class CowMemory {
+public:
+    CowMemory() = default;
+    ~CowMemory();
+    CowMemory(const CowMemory&) = delete;
+    CowMemory& operator=(const CowMemory&) = delete;
+
+    // allocates size bytes of zeroed memory, releasing the old pages
+    void Init(u64 size);
+    void Release();
+
+    u64 Size() const { return size; }
+
+    u8 Read(u64 offset) const {
+        return pages[offset >> COW_PAGE_SHIFT]->data[offset & (COW_PAGE_SIZE - 1)];
+    }
+    void Write(u64 offset, u8 data) {
+        u32 index = (u32)(offset >> COW_PAGE_SHIFT);
+        if(!((owned[index >> 6] >> (index & 63)) & 1)) {
+            MakePageOwned(index);
+        }
+        pages[index]->data[offset & (COW_PAGE_SIZE - 1)] = data;
+    }
+
+    // the bytes from offset to the end of its page, valid until the memory is written or shared
+    const byte* ReadPtr(u64 offset) const {
+        return pages[offset >> COW_PAGE_SHIFT]->data + (offset & (COW_PAGE_SIZE - 1));
+    }
+    // like ReadPtr, but copies the page first if it is shared
+    byte* WritePtr(u64 offset);
+
+    void CopyTo(void* dst, u64 offset, u64 count) const;
+    void CopyFrom(u64 offset, const void* src, u64 count);
+
+    // drops the current pages and shares all pages of src, both become copy-on-write
+    void ShareFrom(CowMemory& src);
+
+    // the number of pages not written since they were last shared
+    u32 SharedPageCount() const;
+
+private:
+    struct Page {
+        std::atomic<u32> refs;
+        byte data[COW_PAGE_SIZE];
+    };
+
+    void MakePageOwned(u32 index);
+    static void ReleasePage(Page* page);
+
+    std::vector<Page*> pages;
+    //! One bit per page, set if the page is referenced by this instance only.
+    std::vector<u64> owned;
+    u64 size = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_COW_MEMORY_H
@@ -14,7 +14,7 @@
 #include "emulator.h"
 #include "instruction.h"
 #include "log-min.h"
-#include "app.h"
+#include "save_state.h"
 
 void CPU::Init() {
     af(0x01B0);
@@ -30,33 +30,46 @@ void CPU::Init() {
 }
 
 void CPU::Step(Emulator *emu) {
+    GB_PROFILE_SCOPE(emu, ProfileSection::CpuDispatch);
     if(!halted) {
 
         if(isInterruptMasterEnabled && (emu->intFlags & emu->intEnableFlags)) {
             ServiceInterrupt(emu);
         }
         else {
-            if(App::GetInstance()->_debugWindow.isCpuLogging) {
-                Log(emu);
+#if GB_ENABLE_CPU_TRACE
+            if(traceHook) {
+                traceHook->OnInstruction(emu);
             }
+#endif
 
-            // fetch opcode
-            u8 opcode = emu->BusRead(pc);
+            if(pc == emu->idleLoop.LoopStart() && emu->idleLoop.Enter(emu)) {
+                // A polling loop iteration was fast-forwarded.
+            }
+            else {
+                u16 instructionPc = pc;
+
+                // fetch opcode
+                u8 opcode = emu->BusRead(pc);
 
-            // increase counter
-            ++pc;
+                // increase counter
+                ++pc;
 
-            // execute counter
-            InstructionFunc* inst = instructionsMap[opcode];
-            if(!inst) {
-                ERROR("Instruction 0x%02X not present.", (u32)opcode);
-                emu->isPaused = true;
-            } else {
-                inst(emu);
+                // execute counter
+                InstructionFunc* inst = instructionsMap[opcode];
+                if(!inst) {
+                    ERROR("Instruction 0x%02X not present.", (u32)opcode);
+                    emu->isPaused = true;
+                } else {
+                    inst(emu);
+                }
+
+                emu->idleLoop.AfterInstruction(emu, instructionPc, pc);
             }
         }
 
     } else {
+        emu->idleLoop.SkipHalt(emu);
         emu->Tick(1);
 
         // wake up cpu if any interruption is pending
@@ -116,28 +129,34 @@ void CPU::ServiceInterrupt(Emulator *emu) {
     emu->Tick(1);
 }
 
-void CPU::Log(Emulator *emu) {
-    c8 buf[256];
-    c8 flags[16];
-    snprintf(flags, 16, "%c%c%c%c",
-             fz() ? 'Z' : '-',
-             fn() ? 'N' : '-',
-             fh() ? 'H' : '-',
-             fc() ? 'C' : '-'
-    );
-    snprintf(buf, 256, "%02X %02X %02X A: %02X F: %s BC: %04X DE: %04X HL: %04X PC: %04X SP: %04X\n",
-            //get_opcode_name(emu->bus_read(emu->cpu.pc)),
-             emu->BusRead(emu->cpu.pc),
-             emu->BusRead(emu->cpu.pc + 1),
-             emu->BusRead(emu->cpu.pc + 2),
-             (u32)emu->cpu.a,
-             flags,
-             (u32)emu->cpu.bc(),
-             (u32)emu->cpu.de(),
-             (u32)emu->cpu.hl(),
-             (u32)emu->cpu.pc,
-             (u32)emu->cpu.sp
-    );
-    App::GetInstance()->_debugWindow.cpuLog.append(buf);
+void CPU::SaveState(StateWriter &writer) const {
+    writer.WriteU8(a);
+    writer.WriteU8(f);
+    writer.WriteU8(b);
+    writer.WriteU8(c);
+    writer.WriteU8(d);
+    writer.WriteU8(e);
+    writer.WriteU8(h);
+    writer.WriteU8(l);
+    writer.WriteU16(sp);
+    writer.WriteU16(pc);
+    writer.WriteBool(halted);
+    writer.WriteBool(isInterruptMasterEnabled);
+    writer.WriteU8(interruptMasterEnablingCountdown);
+}
 
+void CPU::LoadState(StateReader &reader) {
+    a = reader.ReadU8();
+    f = reader.ReadU8();
+    b = reader.ReadU8();
+    c = reader.ReadU8();
+    d = reader.ReadU8();
+    e = reader.ReadU8();
+    h = reader.ReadU8();
+    l = reader.ReadU8();
+    sp = reader.ReadU16();
+    pc = reader.ReadU16();
+    halted = reader.ReadBool();
+    isInterruptMasterEnabled = reader.ReadBool();
+    interruptMasterEnablingCountdown = reader.ReadU8();
 }
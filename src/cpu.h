@@ -14,8 +14,11 @@
 #define GAMEBOY_EMULATOR_CPU_H
 
 #include "type.h"
+#include "cpu_trace.h"
 
 class Emulator;
+class StateWriter;
+class StateReader;
 
 class CPU {
 
@@ -36,6 +39,8 @@ public:
     bool isInterruptMasterEnabled;       // interrupt master enable flag
     u8 interruptMasterEnablingCountdown; // interrupt master enabling countdown
 
+    CPUTraceHook* traceHook = nullptr;   // instruction tracing subscriber, null when tracing is off
+
     u16 af() const { return (((u16)a) << 8) + (u16)f ; }
     u16 bc() const { return (((u16)b) << 8) + (u16)c ; }
     u16 de() const { return (((u16)d) << 8) + (u16)e ; }
@@ -71,7 +76,8 @@ public:
 
     void ServiceInterrupt(Emulator* emu);
 
-    void Log(Emulator* emu);
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 };
 
 
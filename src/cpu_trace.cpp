@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file           : cpu_trace.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/26
+  ******************************************************************************
+  */
+
+
+
+#include "cpu_trace.h"
+#include "emulator.h"
+
+#include <cstdio>
+
+void CaptureTraceEntry(Emulator *emu, CPUTraceEntry &entry) {
+    const CPU& cpu = emu->cpu;
+    entry.cycles = emu->clockCycles;
+    entry.pc = cpu.pc;
+    entry.sp = cpu.sp;
+    entry.a = cpu.a;
+    entry.f = cpu.f;
+    entry.b = cpu.b;
+    entry.c = cpu.c;
+    entry.d = cpu.d;
+    entry.e = cpu.e;
+    entry.h = cpu.h;
+    entry.l = cpu.l;
+    for(u16 i = 0; i < 4; ++i) {
+        entry.pcmem[i] = emu->Peek(cpu.pc + i);
+    }
+}
+
+u32 FormatTraceEntry(const CPUTraceEntry &entry, CPUTraceFormat format, c8 *buf, u32 bufSize) {
+    int n = 0;
+    switch (format) {
+        case CPUTraceFormat::Doctor:
+            n = snprintf(buf, bufSize, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+                         (u32)entry.a, (u32)entry.f, (u32)entry.b, (u32)entry.c,
+                         (u32)entry.d, (u32)entry.e, (u32)entry.h, (u32)entry.l,
+                         (u32)entry.sp, (u32)entry.pc,
+                         (u32)entry.pcmem[0], (u32)entry.pcmem[1], (u32)entry.pcmem[2], (u32)entry.pcmem[3]);
+            break;
+        case CPUTraceFormat::Registers:
+            n = snprintf(buf, bufSize, "%02X %02X %02X A: %02X F: %c%c%c%c BC: %04X DE: %04X HL: %04X PC: %04X SP: %04X\n",
+                         (u32)entry.pcmem[0], (u32)entry.pcmem[1], (u32)entry.pcmem[2],
+                         (u32)entry.a,
+                         (entry.f & 0x80) ? 'Z' : '-',
+                         (entry.f & 0x40) ? 'N' : '-',
+                         (entry.f & 0x20) ? 'H' : '-',
+                         (entry.f & 0x10) ? 'C' : '-',
+                         ((u32)entry.b << 8) | entry.c,
+                         ((u32)entry.d << 8) | entry.e,
+                         ((u32)entry.h << 8) | entry.l,
+                         (u32)entry.pc,
+                         (u32)entry.sp);
+            break;
+    }
+    if(n < 0) return 0;
+    return (u32)n < bufSize ? (u32)n : bufSize - 1;
+}
+
+CPUTraceBuffer::CPUTraceBuffer() {
+    entries = new CPUTraceEntry[CAPACITY];
+}
+
+CPUTraceBuffer::~CPUTraceBuffer() {
+    delete[] entries;
+}
+
+void CPUTraceBuffer::OnInstruction(Emulator *emu) {
+    CaptureTraceEntry(emu, entries[writeIndex & (CAPACITY - 1)]);
+    ++writeIndex;
+}
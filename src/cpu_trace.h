@@ -0,0 +1,95 @@
+/**
+  ******************************************************************************
+  * @file           : cpu_trace.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/26
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_CPU_TRACE_H
+#define GAMEBOY_EMULATOR_CPU_TRACE_H
+
+#include "type.h"
+
+//! Set to 0 to compile the tracing hook out of CPU::Step entirely.
+#ifndef GB_ENABLE_CPU_TRACE
+#define GB_ENABLE_CPU_TRACE 1
+#endif
+
+class Emulator;
+
+//! Receives a callback for every instruction the CPU is about to execute.
+//! The hook is owned by the subscriber, the CPU only keeps a pointer to it.
+class CPUTraceHook {
+public:
+    virtual ~CPUTraceHook() = default;
+
+    // called before the opcode at emu->cpu.pc is fetched
+    virtual void OnInstruction(Emulator* emu) = 0;
+};
+
+//! One traced instruction, the CPU state right before the opcode is fetched.
+struct CPUTraceEntry {
+    //! The emulator clock cycle counter.
+    u64 cycles;
+    u16 pc;
+    u16 sp;
+    u8 a;
+    u8 f;
+    u8 b;
+    u8 c;
+    u8 d;
+    u8 e;
+    u8 h;
+    u8 l;
+    //! The 4 bytes at PC, the opcode and its operands.
+    u8 pcmem[4];
+};
+
+enum class CPUTraceFormat : u8 {
+    //! A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02
+    Doctor,
+    //! 00 C3 13 A: 01 F: Z-HC BC: 0013 DE: 00D8 HL: 014D PC: 0100 SP: FFFE
+    Registers,
+};
+
+void CaptureTraceEntry(Emulator* emu, CPUTraceEntry& entry);
+
+// formats one entry as a text line terminated with '\n', returns the number of characters written
+u32 FormatTraceEntry(const CPUTraceEntry& entry, CPUTraceFormat format, c8* buf, u32 bufSize);
+
+//! Fixed-size ring buffer keeping the last CAPACITY traced instructions.
+//! Recording is a handful of plain stores, text is only produced on demand.
+class CPUTraceBuffer : public CPUTraceHook {
+public:
+    static constexpr u32 CAPACITY = 1 << 16;
+
+    CPUTraceBuffer();
+    ~CPUTraceBuffer() override;
+    CPUTraceBuffer(const CPUTraceBuffer&) = delete;
+    CPUTraceBuffer& operator=(const CPUTraceBuffer&) = delete;
+
+    void OnInstruction(Emulator* emu) override;
+
+    void Clear() { writeIndex = 0; }
+
+    // number of instructions recorded since the last clear
+    u64 TotalCount() const { return writeIndex; }
+    // number of instructions still held in the buffer
+    u32 Size() const { return writeIndex < CAPACITY ? (u32)writeIndex : CAPACITY; }
+    // the i-th oldest entry still held in the buffer
+    const CPUTraceEntry& At(u32 i) const {
+        return entries[(writeIndex - Size() + i) & (CAPACITY - 1)];
+    }
+
+private:
+    CPUTraceEntry* entries;
+    u64 writeIndex = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_CPU_TRACE_H
@@ -29,10 +29,27 @@ void DebugWindow::DrawGui(Emulator* emu) {
     DrawSerialGui(emu);
     DrawTilesGui(emu);
     DrawJoypadGui(emu);
+    DrawProfilerGui(emu);
+    DrawGuestProfilerGui(emu);
 
     ImGui::End();
 }
 
+inline void save_cpu_log(const CPUTraceBuffer& trace, CPUTraceFormat format, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if(!f) {
+        ERROR("failed to open %s", path);
+        return;
+    }
+    c8 line[128];
+    for(u32 i = 0; i < trace.Size(); ++i) {
+        u32 len = FormatTraceEntry(trace.At(i), format, line, sizeof(line));
+        fwrite(line, 1, len, f);
+    }
+    fclose(f);
+    INFO("CPU log saved to %s.", path);
+}
+
 void DebugWindow::DrawCpuGui(Emulator* emu) {
     if(emu)
     {
@@ -146,7 +163,7 @@ void DebugWindow::DrawCpuGui(Emulator* emu) {
             else{
                 ImGui::Text("CPU Stepping.");
             }
-            ImGui::DragFloat("CPU Speed Scale", &emu->clockSpeedScale, 0.001f);
+            ImGui::DragFloat("CPU Speed Scale", &emu->clockSpeedScale, 0.001f, 0.1f, 8.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
         }
 
         if(ImGui::CollapsingHeader("CPU Stepping"))
@@ -170,45 +187,76 @@ void DebugWindow::DrawCpuGui(Emulator* emu) {
         {
             if(ImGui::Button("Clear"))
             {
-                cpuLog.clear();
+                cpuTrace.Clear();
             }
             if(isCpuLogging)
             {
                 if(ImGui::Button("Stop logging"))
                 {
                     isCpuLogging = false;
+                    emu->cpu.traceHook = nullptr;
                 }
             }
             else
             {
                 if(ImGui::Button("Start logging"))
                 {
+                    cpuTraceFile.Close();
+                    isGuestProfiling = false;
                     isCpuLogging = true;
+                    emu->cpu.traceHook = &cpuTrace;
                 }
             }
+            ImGui::SameLine();
             if(ImGui::Button("Save"))
             {
-                WARN("TODO: log save");
-//                Window::FileDialogFilter filter;
-//                filter.name = "Text file";
-//                const c8* extension = "txt";
-//                filter.extensions = {&extension, 1};
-//                auto rpath = Window::save_file_dialog("Save", {&filter, 1});
-//                if (succeeded(rpath) && !rpath.get().empty())
-//                {
-//                    if(rpath.get().extension() == Name())
-//                    {
-//                        rpath.get().replace_extension("txt");
-//                    }
-//                    auto f = open_file(rpath.get().encode().c_str(), FileOpenFlag::write, FileCreationMode::create_always);
-//                    if(succeeded(f))
-//                    {
-//                        auto _ = f.get()->write(cpu_log.c_str(), cpu_log.size(), nullptr);
-//                    }
-//                }
+                save_cpu_log(cpuTrace, cpuTraceFormat, "cpu_log.txt");
+            }
+            ImGui::SameLine();
+            if(cpuTraceFile.IsOpen())
+            {
+                if(ImGui::Button("Stop streaming"))
+                {
+                    emu->cpu.traceHook = nullptr;
+                    cpuTraceFile.Close();
+                }
+                ImGui::Text("Streaming to cpu_trace.gbt: %llu instructions, %llu KB.",
+                            (unsigned long long)cpuTraceFile.RecordCount(),
+                            (unsigned long long)(cpuTraceFile.BytesWritten() / 1024));
+            }
+            else
+            {
+                // Long traces go to a compressed file, read them with gb_trace_reader.
+                if(ImGui::Button("Stream to file") && cpuTraceFile.Open("cpu_trace.gbt"))
+                {
+                    isCpuLogging = false;
+                    isGuestProfiling = false;
+                    emu->cpu.traceHook = &cpuTraceFile;
+                }
+            }
+            bool doctorFormat = cpuTraceFormat == CPUTraceFormat::Doctor;
+            if(ImGui::Checkbox("Gameboy Doctor format", &doctorFormat))
+            {
+                cpuTraceFormat = doctorFormat ? CPUTraceFormat::Doctor : CPUTraceFormat::Registers;
+            }
+            ImGui::Text("Logged instructions: %llu (last %u kept).", (unsigned long long)cpuTrace.TotalCount(), cpuTrace.Size());
+            if(ImGui::BeginChild("CPU Log", ImVec2(0.0f, 300.0f), ImGuiChildFlags_Border))
+            {
+                // Only the visible lines are formatted.
+                c8 line[128];
+                ImGuiListClipper clipper;
+                clipper.Begin((int)cpuTrace.Size());
+                while(clipper.Step())
+                {
+                    for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                    {
+                        u32 len = FormatTraceEntry(cpuTrace.At((u32)i), cpuTraceFormat, line, sizeof(line));
+                        ImGui::TextUnformatted(line, line + len);
+                    }
+                }
+                clipper.End();
             }
-            ImGui::Text("Log size: %llu bytes.", (u64)cpuLog.size());
-            ImGui::TextUnformatted(cpuLog.c_str());
+            ImGui::EndChild();
         }
     }
 }
@@ -309,7 +357,7 @@ void DebugWindow::DrawTilesGui(Emulator *emu) {
                     u32 tile_color_begin = y * row_pitch * 8 + x * 8 * 4;
                     for(u32 line = 0; line < 8; ++line)
                     {
-                        decode_tile_line(emu->vRam + tile_index * 16 + line * 2, tileTexData + tile_color_begin + line * row_pitch);
+                        decode_tile_line(emu->vRam.ReadPtr(tile_index * 16 + line * 2), tileTexData + tile_color_begin + line * row_pitch);
                     }
                 }
             }
@@ -380,3 +428,120 @@ void DebugWindow::DrawJoypadGui(Emulator *emu) {
         }
     }
 }
+
+void DebugWindow::DrawProfilerGui(Emulator *emu) {
+    if(ImGui::CollapsingHeader("Profiler"))
+    {
+        if(ImGui::Checkbox("Profile subsystems", &isProfiling))
+        {
+            profiler.Reset();
+            emu->profiler = isProfiling ? &profiler : nullptr;
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Reset"))
+        {
+            profiler.Reset();
+        }
+        u64 totalTicks = profiler.TotalTicks();
+        u64 coreTicks = totalTicks - profiler.Ticks(ProfileSection::Outside);
+        f64 nsPerTick = profiler.NsPerTick();
+        ImGui::Text("Core time: %.1f ms of %.1f ms.", coreTicks * nsPerTick / 1e6, totalTicks * nsPerTick / 1e6);
+        if(ImGui::BeginTable("Profile sections", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+        {
+            ImGui::TableSetupColumn("Section");
+            ImGui::TableSetupColumn("Time (ms)");
+            ImGui::TableSetupColumn("Core %");
+            ImGui::TableSetupColumn("Calls");
+            ImGui::TableSetupColumn("ns/call");
+            ImGui::TableHeadersRow();
+            for(u8 i = 0; i < (u8)ProfileSection::Outside; ++i)
+            {
+                ProfileSection section = (ProfileSection)i;
+                u64 ticks = profiler.Ticks(section);
+                u64 calls = profiler.Calls(section);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(GetProfileSectionName(section));
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", ticks * nsPerTick / 1e6);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", coreTicks ? ticks * 100.0 / coreTicks : 0.0);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)calls);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", calls ? ticks * nsPerTick / calls : 0.0);
+            }
+            ImGui::EndTable();
+        }
+    }
+}
+
+inline void draw_guest_hotspots(const char* id, const std::vector<GuestHotspot>& hotspots, u64 totalCycles) {
+    if(ImGui::BeginTable(id, 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Bank:PC");
+        ImGui::TableSetupColumn("Cycles");
+        ImGui::TableSetupColumn("%");
+        ImGui::TableSetupColumn("Instructions");
+        ImGui::TableHeadersRow();
+        c8 name[16];
+        for(const GuestHotspot& hotspot : hotspots)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            u32 len = FormatGuestLocation(hotspot.location, name, sizeof(name));
+            ImGui::TextUnformatted(name, name + len);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", (unsigned long long)hotspot.cycles);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", totalCycles ? hotspot.cycles * 100.0 / totalCycles : 0.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", (unsigned long long)hotspot.instructions);
+        }
+        ImGui::EndTable();
+    }
+}
+
+void DebugWindow::DrawGuestProfilerGui(Emulator *emu) {
+    if(ImGui::CollapsingHeader("Guest Profiler"))
+    {
+        if(isGuestProfiling)
+        {
+            if(ImGui::Button("Stop profiling"))
+            {
+                isGuestProfiling = false;
+                emu->cpu.traceHook = nullptr;
+            }
+        }
+        else
+        {
+            if(ImGui::Button("Start profiling"))
+            {
+                cpuTraceFile.Close();
+                isCpuLogging = false;
+                isGuestProfiling = true;
+                guestProfiler.Reset();
+                emu->cpu.traceHook = &guestProfiler;
+            }
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Reset"))
+        {
+            guestProfiler.Reset();
+        }
+        ImGui::SameLine();
+        // Render with flamegraph.pl or load into speedscope.
+        if(ImGui::Button("Save folded stacks"))
+        {
+            guestProfiler.WriteFoldedStacks("guest_profile.folded");
+        }
+        u64 totalCycles = guestProfiler.TotalCycles();
+        ImGui::Text("Profiled: %llu instructions, %llu cycles, call depth %u.",
+                    (unsigned long long)guestProfiler.TotalInstructions(), (unsigned long long)totalCycles,
+                    guestProfiler.CallDepth());
+        ImGui::TextUnformatted("Functions (self cycles)");
+        draw_guest_hotspots("Guest functions", guestProfiler.Functions(16), totalCycles);
+        ImGui::TextUnformatted("Instructions");
+        draw_guest_hotspots("Guest hotspots", guestProfiler.Hotspots(16), totalCycles);
+    }
+}
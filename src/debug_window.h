@@ -20,6 +20,10 @@
 
 #include "singleton_util.h"
 #include "type.h"
+#include "cpu_trace.h"
+#include "trace_file.h"
+#include "profiler.h"
+#include "guest_profiler.h"
 #include "imgui_pixel_renderer.h"
 
 
@@ -28,8 +32,18 @@ class Emulator;
 class DebugWindow {
 public:
     bool show = false;
-    std::string cpuLog;
+    // Instructions traced while logging is on, formatted only when drawn.
+    CPUTraceBuffer cpuTrace;
+    CPUTraceFormat cpuTraceFormat = CPUTraceFormat::Doctor;
     bool isCpuLogging = false;
+    // Unbounded traces streamed to disk.
+    TraceFileWriter cpuTraceFile;
+    // Subsystem host time, attached to the emulator while profiling is on.
+    Profiler profiler;
+    bool isProfiling = false;
+    // Guest code hotspots, uses the CPU trace hook so it excludes CPU logging.
+    GuestProfiler guestProfiler;
+    bool isGuestProfiling = false;
 
     static constexpr int WIDTH = 16 * 8;
     static constexpr int HEIGHT = 24 * 8;
@@ -50,6 +64,10 @@ public:
     void DrawTilesGui(Emulator* emu);
 
     void DrawJoypadGui(Emulator* emu);
+
+    void DrawProfilerGui(Emulator* emu);
+
+    void DrawGuestProfilerGui(Emulator* emu);
 };
 
 
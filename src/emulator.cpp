@@ -12,10 +12,15 @@
 
 #include "emulator.h"
 #include "log-min.h"
+#include "save_state.h"
 
 #include <iostream>
 #include <fstream>
 #include <ctime>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <vector>
 
 Emulator::~Emulator() {
     Close();
@@ -30,6 +35,8 @@ void Emulator::Init(std::string cartridgePath, const void *cartridgeData, u64 ca
     this->cartridge_path = cartridgePath;
     romData = (byte*) malloc(cartridgeDataSize);
     romDataSize = cartridgeDataSize;
+    romOwner.reset(romData, free);
+    isFork = false;
     memcpy(romData, cartridgeData, cartridgeDataSize);
 
     // check cartridge data
@@ -54,10 +61,11 @@ void Emulator::Init(std::string cartridgePath, const void *cartridgeData, u64 ca
 
     // init cpu
     cpu.Init();
+    idleLoop.Reset();
 
     // set the ram
-    memset(wRam, 0, 8 * kb);
-    memset(vRam, 0, 8 * kb);
+    wRam.Init(8 * kb);
+    vRam.Init(8 * kb);
     memset(oam, 0,  160);
     memset(hRam, 0, 128);
 
@@ -65,8 +73,10 @@ void Emulator::Init(std::string cartridgePath, const void *cartridgeData, u64 ca
     intEnableFlags = 0;
     timer.Init();
     serial.Init();
+    apu.Init(clockCycles);
     ppu.init();
     joypad.init();
+    input.Clear();
     rtc.init();
 
     // init the cartridge ram
@@ -85,30 +95,57 @@ void Emulator::Init(std::string cartridgePath, const void *cartridgeData, u64 ca
     }
     if(cRam_size)
     {
-        cRam = (byte *)malloc(cRam_size);
-        memset(cRam, 0, cRam_size);
-        if(is_cart_battery(header->cartridge_type)) {
+        cRam.Init(cRam_size);
+        if(is_cart_battery(header->cartridge_type) && useSaveFile) {
             load_cartridge_ram_data();
         }
     }
 }
 
 void Emulator::Update(f64 deltaTime) {
-    joypad.update(this);
     if(is_cart_timer(GetCartridgeHeader(romData)->cartridge_type))
     {
         rtc.update(deltaTime);
     }
-    u64 frameCycles = (u64)((f32)(GB_CLOCK_FREQUENCY * deltaTime) * clockSpeedScale );
-    u64 endCycles = clockCycles + frameCycles;
+    // The budget is fractional and the last instruction runs past it, both are carried over.
+    f64 budget = (f64)GB_CLOCK_FREQUENCY * deltaTime * clockSpeedScale * clockRateAdjust + updateCycleCarry;
+    u64 startCycles = clockCycles;
+    Run(clockCycles + (u64)std::max(budget, 0.0), true);
+    // A pause does not accumulate a debt to catch up on.
+    f64 limit = GB_CLOCK_CYCLES_PER_FRAME;
+    updateCycleCarry = isPaused ? 0.0 : std::max(-limit, std::min(budget - (f64)(clockCycles - startCycles), limit));
+}
+
+void Emulator::RunFrames(u32 frames) {
+    RunUntil(clockCycles + (u64)frames * GB_CLOCK_CYCLES_PER_FRAME);
+}
+
+void Emulator::RunUntil(u64 endCycles) {
+    Run(endCycles, false);
+}
+
+void Emulator::Run(u64 endCycles, bool pausable) {
+    input.Apply(this);
     while(clockCycles < endCycles) {
-        // step emulator and advance clockCycles
-        if(isPaused) break;
-        cpu.Step(this);
+        // Stop at the next scheduled input to apply it on its cycle.
+        u64 segmentEnd = std::min(endCycles, input.NextEventCycles());
+        idleLoop.BeginRun(segmentEnd);
+        while(clockCycles < segmentEnd) {
+            // step emulator and advance clockCycles
+            if(pausable && isPaused) return;
+            cpu.Step(this);
+        }
+        input.Apply(this);
     }
 }
 
 void Emulator::Tick(u32 machineCycles) {
+#if GB_ENABLE_PROFILER
+    if(profiler) {
+        TickProfiled(machineCycles);
+        return;
+    }
+#endif
     u32 tickCycles = machineCycles * GB_CLOCK_CYCLES_PER_MACHINE_CYCLE;
     for (u32 i = 0; i < tickCycles; ++i) {
         ++clockCycles;
@@ -123,7 +160,129 @@ void Emulator::Tick(u32 machineCycles) {
     }
 }
 
+u64 Emulator::QuietCycles() const {
+    u32 cycles = std::min(timer.QuietCycles(), serial.QuietCycles(clockCycles));
+    return std::min(cycles, ppu.quiet_cycles());
+}
+
+void Emulator::SkipQuietCycles(u64 cycles) {
+    assert(cycles <= QuietCycles() && "the skipped cycles are not quiet!");
+    clockCycles += cycles;
+    timer.SkipCycles((u32)cycles);
+    ppu.skip_cycles((u32)cycles);
+}
+
+static ProfileSection ProfilePPUSection(PPUMode mode) {
+    switch(mode) {
+        case PPUMode::OAM_SCAN: return ProfileSection::PpuOamScan;
+        case PPUMode::DRAWING: return ProfileSection::PpuDrawing;
+        case PPUMode::H_BLANK: return ProfileSection::PpuHBlank;
+        default: return ProfileSection::PpuVBlank;
+    }
+}
+
+void Emulator::TickProfiled(u32 machineCycles) {
+    u32 tickCycles = machineCycles * GB_CLOCK_CYCLES_PER_MACHINE_CYCLE;
+    for (u32 i = 0; i < tickCycles; ++i) {
+        ++clockCycles;
+        {
+            ProfileScope scope(profiler, ProfileSection::Timer);
+            timer.Tick(this);
+        }
+        if((clockCycles % 512) == 0)
+        {
+            ProfileScope scope(profiler, ProfileSection::Serial);
+            serial.Tick(this);
+        }
+        {
+            ProfileScope scope(profiler, ProfilePPUSection(ppu.get_mode()));
+            ppu.tick(this);
+        }
+    }
+}
+
+//! The I/O registers 0xFF00~0xFF7F, dispatched through a table indexed by the low 7 address bits.
+//! Unused register bits read as 1, unmapped registers read 0xFF and ignore writes.
+typedef u8 (*IOReadHandler)(Emulator* emu, u16 addr);
+typedef void (*IOWriteHandler)(Emulator* emu, u16 addr, u8 data);
+
+struct IORegister {
+    IOReadHandler read;
+    IOWriteHandler write;
+    //! ORed into every read.
+    u8 unusedBits;
+};
+
+static u8 ReadUnmapped(Emulator*, u16) { return 0xFF; }
+static void WriteUnmapped(Emulator*, u16, u8) {}
+
+static u8 ReadJoypad(Emulator* emu, u16) { return emu->joypad.bus_read(); }
+static void WriteJoypad(Emulator* emu, u16, u8 data) { emu->joypad.bus_write(emu, data); }
+
+static u8 ReadSerial(Emulator* emu, u16 addr) { return emu->serial.BusRead(addr); }
+static void WriteSerial(Emulator* emu, u16 addr, u8 data) { emu->serial.BusWrite(addr, data); }
+
+static u8 ReadTimer(Emulator* emu, u16 addr) { return emu->timer.BusRead(addr); }
+static void WriteTimer(Emulator* emu, u16 addr, u8 data) { emu->timer.BusWrite(addr, data); }
+
+static void WriteDiv(Emulator* emu, u16 addr, u8 data) {
+    // The APU derives the frame sequencer steps from DIV, it must run up to the reset.
+    emu->apu.Sync(emu);
+    if(emu->timer.div & APU_FRAME_SEQUENCER_DIV_BIT)
+    {
+        // Resetting DIV is a falling edge of the frame sequencer bit.
+        emu->apu.StepFrameSequencer();
+    }
+    emu->timer.BusWrite(addr, data);
+}
+
+static u8 ReadIF(Emulator* emu, u16) { return emu->intFlags; }
+static void WriteIF(Emulator* emu, u16, u8 data) { emu->intFlags = data & 0x1F; }
+
+static u8 ReadAPU(Emulator* emu, u16 addr) {
+    emu->apu.Sync(emu);
+    return emu->apu.BusRead(addr);
+}
+static void WriteAPU(Emulator* emu, u16 addr, u8 data) {
+    emu->apu.Sync(emu);
+    emu->apu.BusWrite(addr, data);
+}
+
+static u8 ReadPPU(Emulator* emu, u16 addr) { return emu->ppu.bus_read(addr); }
+static void WritePPU(Emulator* emu, u16 addr, u8 data) { emu->ppu.bus_write(addr, data); }
+
+struct IORegisterTable {
+    IORegister registers[128];
+
+    IORegisterTable() {
+        for(IORegister& reg : registers) {
+            reg = { ReadUnmapped, WriteUnmapped, 0x00 };
+        }
+        Map(0xFF00, 0xFF00, ReadJoypad, WriteJoypad, 0xC0);
+        Map(0xFF01, 0xFF01, ReadSerial, WriteSerial, 0x00);
+        Map(0xFF02, 0xFF02, ReadSerial, WriteSerial, 0x7E);
+        Map(0xFF04, 0xFF04, ReadTimer, WriteDiv, 0x00);
+        Map(0xFF05, 0xFF06, ReadTimer, WriteTimer, 0x00);
+        Map(0xFF07, 0xFF07, ReadTimer, WriteTimer, 0xF8);
+        Map(0xFF0F, 0xFF0F, ReadIF, WriteIF, 0xE0);
+        // The APU applies the masks of its registers itself.
+        Map(0xFF10, 0xFF3F, ReadAPU, WriteAPU, 0x00);
+        Map(0xFF40, 0xFF40, ReadPPU, WritePPU, 0x00);
+        Map(0xFF41, 0xFF41, ReadPPU, WritePPU, 0x80);
+        Map(0xFF42, 0xFF4B, ReadPPU, WritePPU, 0x00);
+    }
+
+    void Map(u16 first, u16 last, IOReadHandler read, IOWriteHandler write, u8 unusedBits) {
+        for(u16 addr = first; addr <= last; ++addr) {
+            registers[addr & 0x7F] = { read, write, unusedBits };
+        }
+    }
+};
+
+static const IORegisterTable IO_REGISTERS;
+
 u8 Emulator::BusRead(u16 addr) {
+    GB_PROFILE_SCOPE(this, ProfileBusSection(addr));
     if(addr <= 0x7FFF)
     {
         // Cartridge ROM.
@@ -132,7 +291,7 @@ u8 Emulator::BusRead(u16 addr) {
     if(addr <= 0x9FFF)
     {
         // VRAM.
-        return vRam[addr - 0x8000];
+        return vRam.Read(addr - 0x8000);
     }
     if(addr <= 0xBFFF)
     {
@@ -142,48 +301,51 @@ u8 Emulator::BusRead(u16 addr) {
     if(addr <= 0xDFFF)
     {
         // Working RAM.
-        return wRam[addr - 0xC000];
-    }
-    if(addr >= 0xFE00 && addr <= 0xFE9F)
-    {
-        return oam[addr - 0xFE00];
+        return wRam.Read(addr - 0xC000);
     }
-    if(addr == 0xFF00)
+    if(addr <= 0xFDFF)
     {
-        return joypad.bus_read();
+        // Echo RAM, mirrors 0xC000~0xDDFF.
+        return wRam.Read(addr - 0xE000);
     }
-    if(addr >= 0xFF01 && addr <= 0xFF02)
+    if(addr <= 0xFE9F)
     {
-        return serial.BusRead(addr);
-    }
-    if(addr >= 0xFF04 && addr <= 0xFF07)
-    {
-        return timer.BusRead(addr);
+        return oam[addr - 0xFE00];
     }
-    if(addr == 0xFF0F)
+    if(addr <= 0xFEFF)
     {
-        // IF
-        return intFlags | 0xE0;
+        // Not usable, reads 0 on DMG.
+        return 0x00;
     }
-    if(addr >= 0xFF40 && addr <= 0xFF4B)
+    if(addr <= 0xFF7F)
     {
-        return ppu.bus_read(addr);
+        const IORegister& reg = IO_REGISTERS.registers[addr & 0x7F];
+        return reg.read(this, addr) | reg.unusedBits;
     }
-    if(addr >= 0xFF80 && addr <= 0xFFFE)
+    if(addr <= 0xFFFE)
     {
         return hRam[addr - 0xFF80];
     }
-    if(addr == 0xFFFF)
-    {
-        // IE
-        return intEnableFlags | 0xE0;
-    }
+    // IE
+    return intEnableFlags | 0xE0;
+}
 
-    ERROR("Unsupported bus read address: 0x%04X", (u32)addr);
+u8 Emulator::Peek(u16 addr) {
+    if(addr <= 0x7FFF)
+    {
+        u64 offset = (u64)(CartridgeRomBank(this, addr) % num_rom_banks) * 0x4000 + (addr & 0x3FFF);
+        return offset < romDataSize ? romData[offset] : 0xFF;
+    }
+    if(addr <= 0x9FFF) return vRam.Read(addr - 0x8000);
+    if(addr >= 0xC000 && addr <= 0xDFFF) return wRam.Read(addr - 0xC000);
+    if(addr >= 0xE000 && addr <= 0xFDFF) return wRam.Read(addr - 0xE000);
+    if(addr >= 0xFE00 && addr <= 0xFE9F) return oam[addr - 0xFE00];
+    if(addr >= 0xFF80 && addr <= 0xFFFE) return hRam[addr - 0xFF80];
     return 0xFF;
 }
 
 void Emulator::BusWrite(u16 addr, u8 data) {
+    GB_PROFILE_SCOPE(this, ProfileBusSection(addr));
     if(addr <= 0x7FFF)
     {
         // Cartridge ROM.
@@ -193,7 +355,7 @@ void Emulator::BusWrite(u16 addr, u8 data) {
     if(addr <= 0x9FFF)
     {
         // VRAM.
-        vRam[addr - 0x8000] = data;
+        vRam.Write(addr - 0x8000, data);
         return;
     }
     if(addr <= 0xBFFF)
@@ -205,70 +367,53 @@ void Emulator::BusWrite(u16 addr, u8 data) {
     if(addr <= 0xDFFF)
     {
         // Working RAM.
-        wRam[addr - 0xC000] = data;
+        wRam.Write(addr - 0xC000, data);
         return;
     }
-    if(addr >= 0xFE00 && addr <= 0xFE9F)
+    if(addr <= 0xFDFF)
     {
-        oam[addr - 0xFE00] = data;
+        // Echo RAM, mirrors 0xC000~0xDDFF.
+        wRam.Write(addr - 0xE000, data);
         return;
     }
-    if(addr == 0xFF00)
+    if(addr <= 0xFE9F)
     {
-        joypad.bus_write(data);
-        return;
-    }
-    if(addr >= 0xFF01 && addr <= 0xFF02)
-    {
-        serial.BusWrite(addr, data);
-        return;
-    }
-    if(addr >= 0xFF04 && addr <= 0xFF07)
-    {
-        timer.BusWrite(addr, data);
+        oam[addr - 0xFE00] = data;
         return;
     }
-    if(addr == 0xFF0F)
+    if(addr <= 0xFEFF)
     {
-        // IF
-        intFlags = data & 0x1F;
+        // Not usable, writes are ignored.
         return;
     }
-    if(addr >= 0xFF40 && addr <= 0xFF4B)
+    if(addr <= 0xFF7F)
     {
-        ppu.bus_write(addr, data);
+        IO_REGISTERS.registers[addr & 0x7F].write(this, addr, data);
         return;
     }
-    if(addr >= 0xFF80 && addr <= 0xFFFE)
+    if(addr <= 0xFFFE)
     {
         // High RAM.
         hRam[addr - 0xFF80] = data;
         return;
     }
-    if(addr == 0xFFFF)
-    {
-        // IE
-        intEnableFlags = data & 0x1F;
-        return;
-    }
-
-    ERROR("Unsupported bus write address: 0x%04X", (u32)addr);
+    // IE
+    intEnableFlags = data & 0x1F;
 }
 
 void Emulator::Close() {
-    if(cRam)
+    if(cRam_size)
     {
         CartridgeHeader* header = GetCartridgeHeader(romData);
-        if(is_cart_battery(header->cartridge_type))
+        if(is_cart_battery(header->cartridge_type) && useSaveFile && !isFork)
         {
             save_cartridge_ram_data();
         }
-        free(cRam);
-        cRam = nullptr;
+        cRam.Release();
         cRam_size = 0;
     }
     if(romData) {
-        free(romData);
+        romOwner.reset();
         romData = nullptr;
         romDataSize = 0;
         isCartLoaded = false;
@@ -293,7 +438,9 @@ void Emulator::load_cartridge_ram_data() {
     }
     fseek(f, 0, SEEK_SET);
 
-    fread(cRam, 1, cRam_size, f);
+    std::vector<byte> data(cRam_size);
+    fread(data.data(), 1, cRam_size, f);
+    cRam.CopyFrom(0, data.data(), cRam_size);
 
     if(is_cart_timer(GetCartridgeHeader(romData)->cartridge_type)) {
         // Restore RTC.
@@ -319,7 +466,9 @@ void Emulator::save_cartridge_ram_data() {
     auto save_path = cartridge_path.substr(0, cartridge_path.length() - 2) + "sav";
 
     std::ofstream saveFile(save_path, std::ios::out | std::ios::binary);
-    saveFile.write((const char *)cRam, cRam_size);
+    std::vector<byte> data(cRam_size);
+    cRam.CopyTo(data.data(), 0, cRam_size);
+    saveFile.write((const char *)data.data(), (std::streamsize)cRam_size);
 
     if(is_cart_timer(GetCartridgeHeader(romData)->cartridge_type))
     {
@@ -337,3 +486,180 @@ void Emulator::save_cartridge_ram_data() {
     INFO("Save cartridge RAM data to %s.", save_path.c_str());
 }
 
+// Identifies the cartridge a state belongs to.
+static u32 GetStateCartridgeId(byte* romData) {
+    CartridgeHeader* header = GetCartridgeHeader(romData);
+    return ((u32)header->checksum << 16) | ((u32)header->global_checksum[0] << 8) | (u32)header->global_checksum[1];
+}
+
+static void WriteMemory(const CowMemory& memory, StateWriter& writer) {
+    for(u64 offset = 0; offset < memory.Size(); offset += COW_PAGE_SIZE) {
+        writer.WriteBytes(memory.ReadPtr(offset), std::min<u64>(COW_PAGE_SIZE, memory.Size() - offset));
+    }
+}
+
+static void ReadMemory(CowMemory& memory, StateReader& reader) {
+    for(u64 offset = 0; offset < memory.Size(); offset += COW_PAGE_SIZE) {
+        reader.ReadBytes(memory.WritePtr(offset), std::min<u64>(COW_PAGE_SIZE, memory.Size() - offset));
+    }
+}
+
+// Everything but the memory, this is also what a fork copies.
+static void WriteComponentState(const Emulator* emu, StateWriter& writer) {
+    writer.WriteU64(emu->clockCycles);
+    emu->cpu.SaveState(writer);
+    writer.WriteU8(emu->intFlags);
+    writer.WriteU8(emu->intEnableFlags);
+
+    // MBC registers.
+    writer.WriteBool(emu->cram_enable);
+    writer.WriteU8(emu->rom_bank_number);
+    writer.WriteU8(emu->ram_bank_number);
+    writer.WriteU8(emu->banking_mode);
+
+    emu->timer.SaveState(writer);
+    emu->serial.SaveState(writer);
+    emu->ppu.save_state(writer);
+    emu->joypad.save_state(writer);
+    emu->rtc.save_state(writer);
+    emu->apu.SaveState(writer);
+}
+
+// version is the save state version the data was written with.
+static void ReadComponentState(Emulator* emu, StateReader& reader, u32 version) {
+    emu->clockCycles = reader.ReadU64();
+    emu->cpu.LoadState(reader);
+    emu->intFlags = reader.ReadU8();
+    emu->intEnableFlags = reader.ReadU8();
+
+    emu->cram_enable = reader.ReadBool();
+    emu->rom_bank_number = reader.ReadU8();
+    emu->ram_bank_number = reader.ReadU8();
+    emu->banking_mode = reader.ReadU8();
+
+    emu->timer.LoadState(reader);
+    emu->serial.LoadState(reader);
+    emu->ppu.load_state(reader);
+    emu->joypad.load_state(reader);
+    emu->rtc.load_state(reader);
+    if(version >= 2) {
+        emu->apu.LoadState(reader);
+    }
+    else {
+        // Version 1 states have no sound, start with the APU as after the boot ROM.
+        emu->apu.Init(emu->clockCycles);
+    }
+}
+
+static void WriteState(const Emulator* emu, StateWriter& writer) {
+    writer.WriteU32(SAVE_STATE_MAGIC);
+    writer.WriteU32(SAVE_STATE_VERSION);
+    writer.WriteU32(GetStateCartridgeId(emu->romData));
+    writer.WriteU32((u32)emu->cRam_size);
+
+    WriteComponentState(emu, writer);
+
+    WriteMemory(emu->vRam, writer);
+    WriteMemory(emu->wRam, writer);
+    writer.WriteBytes(emu->hRam, sizeof(emu->hRam));
+    writer.WriteBytes(emu->oam, sizeof(emu->oam));
+    WriteMemory(emu->cRam, writer);
+}
+
+u64 Emulator::GetStateSize() const {
+    StateWriter writer(nullptr, 0);
+    WriteState(this, writer);
+    return writer.Size();
+}
+
+u64 Emulator::SaveState(void *buffer, u64 bufferSize) const {
+    assert(isCartLoaded && "no cartridge loaded!");
+    StateWriter writer(buffer, bufferSize);
+    WriteState(this, writer);
+    if(writer.Overflow()) {
+        return 0;
+    }
+    return writer.Size();
+}
+
+bool Emulator::LoadState(const void *data, u64 dataSize) {
+    assert(isCartLoaded && "no cartridge loaded!");
+    StateReader reader(data, dataSize);
+    if(reader.ReadU32() != SAVE_STATE_MAGIC) {
+        ERROR("invalid save state.");
+        return false;
+    }
+    u32 version = reader.ReadU32();
+    if(version > SAVE_STATE_VERSION) {
+        ERROR("unsupported save state version: %u", version);
+        return false;
+    }
+    if(reader.ReadU32() != GetStateCartridgeId(romData) || reader.ReadU32() != (u32)cRam_size) {
+        ERROR("the save state belongs to another cartridge.");
+        return false;
+    }
+    // Check the size up front so that a truncated state never leaves the emulator half loaded.
+    u64 stateSize = GetStateSize();
+    if(version < 2) {
+        StateWriter apuWriter(nullptr, 0);
+        apu.SaveState(apuWriter);
+        stateSize -= apuWriter.Size();
+    }
+    if(dataSize < stateSize) {
+        ERROR("the save state is truncated.");
+        return false;
+    }
+
+    ReadComponentState(this, reader, version);
+    idleLoop.Reset();
+
+    ReadMemory(vRam, reader);
+    ReadMemory(wRam, reader);
+    reader.ReadBytes(hRam, sizeof(hRam));
+    reader.ReadBytes(oam, sizeof(oam));
+    ReadMemory(cRam, reader);
+    assert(!reader.Failed());
+    return true;
+}
+
+void Emulator::Fork(Emulator &child) {
+    assert(isCartLoaded && "no cartridge loaded!");
+    if(&child == this) return;
+    if(child.isCartLoaded && !child.isFork) {
+        child.Close();
+    }
+
+    child.cartridge_path = cartridge_path;
+    child.romOwner = romOwner;
+    child.romData = romData;
+    child.romDataSize = romDataSize;
+    child.num_rom_banks = num_rom_banks;
+    child.cRam_size = cRam_size;
+    child.isPaused = isPaused;
+    child.clockSpeedScale = clockSpeedScale;
+    child.isCartLoaded = true;
+    child.isFork = true;
+
+    child.vRam.ShareFrom(vRam);
+    child.wRam.ShareFrom(wRam);
+    child.cRam.ShareFrom(cRam);
+    memcpy(child.hRam, hRam, sizeof(hRam));
+    memcpy(child.oam, oam, sizeof(oam));
+
+    // The component state is a few hundred bytes, reuse the save state code for it so
+    // that forks never miss a field. A dry run sizes the buffer, which is kept for the next fork.
+    StateWriter sizer(nullptr, 0);
+    WriteComponentState(this, sizer);
+    forkStateBuffer.resize(sizer.Size());
+    StateWriter writer(forkStateBuffer.data(), forkStateBuffer.size());
+    WriteComponentState(this, writer);
+    StateReader reader(forkStateBuffer.data(), writer.Size());
+    ReadComponentState(&child, reader, SAVE_STATE_VERSION);
+    child.ppu.frame_count = ppu.frame_count;
+    // A child that never ran has no frame buffers yet, they keep its own frame format.
+    if(child.ppu.frames.FrameSize() != get_frame_size(child.ppu.frame_format)) {
+        child.ppu.set_frame_format(child.ppu.frame_format);
+    }
+    child.skipIdleLoops = skipIdleLoops;
+    child.idleLoop = idleLoop;
+}
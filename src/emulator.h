@@ -18,11 +18,17 @@
 #include "cpu.h"
 #include "timer.h"
 #include "serial.h"
+#include "apu.h"
 #include "ppu.h"
 #include "joypad.h"
 #include "RTC.h"
+#include "cow_memory.h"
+#include "profiler.h"
+#include "idle_loop.h"
+#include "input_queue.h"
 
 #include <string>
+#include <vector>
 
 class Emulator {
 public:
@@ -30,9 +36,11 @@ public:
 
     byte* romData = nullptr;
     u64 romDataSize = 0;
+    //! Owns romData, shared with the emulators forked from this one.
+    std::shared_ptr<byte> romOwner;
 
     //! The cartridge RAM.
-    byte* cRam = nullptr;
+    CowMemory cRam;
     //! The cartridge RAM size.
     u64 cRam_size = 0;
 
@@ -57,14 +65,22 @@ public:
 
     bool isPaused = false;         // is the emulation paused
     f32 clockSpeedScale = 1.0f;    // clock speed scale value
+    //! The fine adjustment of the clock rate set by the audio output to keep its buffer fill stable
+    //! (see AudioRateController), within +-0.5%. 1 runs at the wall clock.
+    f64 clockRateAdjust = 1.0;
+    //! The clock cycles the last Update() ran less (positive) or more (negative) than its budget,
+    //! carried over to the next one so that the emulation does not drift from the wall clock.
+    f64 updateCycleCarry = 0.0;
     u64 clockCycles = 0;           // the cycle counter
     constexpr static const f32 GB_CLOCK_FREQUENCY = 4194304.f;
     constexpr static const u32 GB_CLOCK_CYCLES_PER_MACHINE_CYCLE = 4;
+    //! One LCD frame, 154 lines of 456 cycles (59.73 frames per second).
+    constexpr static const u32 GB_CLOCK_CYCLES_PER_FRAME = 70224;
 
     CPU cpu;
 
-    byte vRam[8 * kb];  // visual ram
-    byte wRam[8 * kb];  // working ram
+    CowMemory vRam;     // visual ram, 8KB
+    CowMemory wRam;     // working ram, 8KB
     byte hRam[128];     // high ram
     byte oam[160];
 
@@ -75,11 +91,31 @@ public:
 
     Timer timer;
     Serial serial;
+    APU apu;
     PPU ppu;
     Joypad joypad;
     RTC rtc;
 
     bool isCartLoaded = false;
+    //! Forked emulators share the cartridge with their source and never write the battery save file.
+    bool isFork = false;
+    //! Load and save battery backed cartridge RAM from/to <rom>.sav, turn off for reproducible headless runs.
+    bool useSaveFile = true;
+
+    //! Fast-forward polling loops that wait for a register to change, see IdleLoopSkipper.
+    //! The emulation is the same with and without skipping.
+    bool skipIdleLoops = true;
+    IdleLoopSkipper idleLoop;
+
+    //! The joypad input, may be fed from any thread. Applied at the start of every run and at the
+    //! exact cycles of scheduled events.
+    InputQueue input;
+
+    //! The attached subsystem profiler, null when profiling is off. Owned by the subscriber.
+    Profiler* profiler = nullptr;
+
+    //! The component state passed to the children of Fork().
+    std::vector<byte> forkStateBuffer;
 
 public:
     ~Emulator();
@@ -88,16 +124,54 @@ public:
     void Close();
 
     void Update(f64 deltaTime);
+    // runs frames * GB_CLOCK_CYCLES_PER_FRAME clock cycles as fast as possible, for headless runs.
+    // isPaused and the real time clock are not taken into account.
+    void RunFrames(u32 frames);
+    // runs until clockCycles reaches endCycles, at the first instruction boundary at or after it.
+    void RunUntil(u64 endCycles);
+    // runs up to endCycles in segments split at the scheduled input events, stops early if
+    // pausable and isPaused is set.
+    void Run(u64 endCycles, bool pausable);
 
     // advances clock and updates all hardware states (except CPU)
     // This is called from the CPU instructions
     void Tick(u32 machineCycles);
+    // Tick() with every hardware component profiled, used while a profiler is attached.
+    void TickProfiled(u32 machineCycles);
+    // the clock cycles Tick() would only count for: no interrupt, no PPU mode or line change,
+    // no PPU output, no DMA and no serial transfer. Of what the CPU can read only DIV and TIMA
+    // change in them.
+    u64 QuietCycles() const;
+    // advances the clock and the counters by cycles, at most QuietCycles(), in one go.
+    void SkipQuietCycles(u64 cycles);
 
     u8 BusRead(u16 addr);
     void BusWrite(u16 addr, u8 data);
+    // reads the ROM, VRAM, WRAM, OAM and HRAM like BusRead() but without any side effect, not
+    // profiled, for tools watching the CPU. Cartridge RAM and registers read 0xFF.
+    u8 Peek(u16 addr);
     void load_cartridge_ram_data();
     void save_cartridge_ram_data();
 
+    //! Save states. The layout is versioned and little endian (see save_state.h).
+    //! The state size is fixed for one cartridge, query it with GetStateSize().
+    u64 GetStateSize() const;
+    // serializes the whole machine into buffer without allocating, returns the number of
+    // bytes written, or 0 if bufferSize is too small.
+    u64 SaveState(void* buffer, u64 bufferSize) const;
+    // restores a state saved from the same cartridge, returns false and leaves the
+    // emulator untouched if the state is invalid.
+    bool LoadState(const void* data, u64 dataSize);
+
+    //! Forking, for searching many futures of one state.
+    //! The ROM is shared and VRAM, WRAM and cartridge RAM are shared copy-on-write in
+    //! COW_PAGE_SIZE pages, so a fork costs the page tables plus the small component state
+    //! until pages are written. Both emulators must not be running while forking.
+    //! child may be any emulator, a new one included. Reuse it between forks to avoid
+    //! reallocating it, the frame buffers are allocated once in its frame format but not copied.
+    void Fork(Emulator& child);
+
+
 };
 
 constexpr u8 INT_VBLANK = 1;
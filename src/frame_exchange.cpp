@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file           : frame_exchange.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/31
+  ******************************************************************************
+  */
+
+
+
+#include "frame_exchange.h"
+
+#include <algorithm>
+#include <cstring>
+
+void FrameExchange::Init(u32 frameSize) {
+    this->frameSize = frameSize;
+    buffers.assign((u64)frameSize * FRAME_EXCHANGE_BUFFERS, 0);
+    std::fill(frameIds, frameIds + FRAME_EXCHANGE_BUFFERS, 0);
+    for(u32 i = 0; i < FRAME_EXCHANGE_BUFFERS; ++i) {
+        sequences[i].store(0, std::memory_order_relaxed);
+    }
+    latest.store(FRAME_EXCHANGE_BUFFERS - 1, std::memory_order_relaxed);
+    // The back buffer is always being written.
+    back = 0;
+    sequences[back].store(1, std::memory_order_release);
+}
+
+void FrameExchange::Publish(u64 frameId) {
+    frameIds[back] = frameId;
+    std::atomic<u64>& sequence = sequences[back];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    latest.store((frameId << 2) | back, std::memory_order_release);
+
+    // Write the buffer published the longest time ago next.
+    back = (back + 1) % FRAME_EXCHANGE_BUFFERS;
+    std::atomic<u64>& next = sequences[back];
+    next.store(next.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+u64 FrameExchange::CopyLatest(u8 *dst) const {
+    for(;;) {
+        u32 index = (u32)(latest.load(std::memory_order_acquire) & 3);
+        u64 begin = sequences[index].load(std::memory_order_acquire);
+        if(begin & 1) {
+            // The producer wrapped around onto this buffer, pick up the newer frame.
+            continue;
+        }
+        memcpy(dst, buffers.data() + (u64)index * frameSize, frameSize);
+        u64 frameId = frameIds[index];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(sequences[index].load(std::memory_order_relaxed) == begin) {
+            return frameId;
+        }
+    }
+}
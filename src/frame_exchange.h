@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file           : frame_exchange.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/31
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_FRAME_EXCHANGE_H
+#define GAMEBOY_EMULATOR_FRAME_EXCHANGE_H
+
+#include "type.h"
+
+#include <atomic>
+#include <vector>
+
+constexpr u32 FRAME_EXCHANGE_BUFFERS = 3;
+
+//! Publishes complete frames from the PPU to any number of consumers on other threads
+//! (display, recorder, hashing) without ever blocking the PPU.
+//! The producer draws into one of three buffers while the latest complete frame sits in
+//! another, publishing is one atomic store of the latest index.
+//! Every buffer is guarded by a sequence lock: the counter is odd while the producer writes
+//! the buffer, consumers copy the frame out and retry if the counter changed meanwhile.
+//! A consumer only retries if its copy takes longer than a whole frame.
+class FrameExchange {
+public:
+    // allocates three zeroed frames of frameSize bytes
+    void Init(u32 frameSize);
+
+    u32 FrameSize() const { return frameSize; }
+
+    //! Producer side.
+    u8* BackBuffer() { return buffers.data() + (u64)back * frameSize; }
+    // publishes the back buffer as the latest frame and starts writing the next one
+    void Publish(u64 frameId);
+
+    //! Consumer side, may be called from any number of threads.
+    // the id of the latest published frame, 0 before the first one.
+    // Polling it is cheap, use it to skip copies of frames already seen.
+    u64 LatestFrameId() const { return latest.load(std::memory_order_acquire) >> 2; }
+    // copies the latest published frame into dst (FrameSize() bytes), returns its id
+    u64 CopyLatest(u8* dst) const;
+
+private:
+    std::vector<u8> buffers;
+    u32 frameSize = 0;
+    //! Written by the producer only.
+    u32 back = 0;
+    //! The frame id of every buffer, guarded by the sequence lock of the buffer.
+    u64 frameIds[FRAME_EXCHANGE_BUFFERS] = {};
+    std::atomic<u64> sequences[FRAME_EXCHANGE_BUFFERS];
+    //! The latest published frame, frame id << 2 | buffer index.
+    std::atomic<u64> latest{0};
+};
+
+
+#endif //GAMEBOY_EMULATOR_FRAME_EXCHANGE_H
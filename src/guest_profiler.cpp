@@ -0,0 +1,243 @@
+/**
+  ******************************************************************************
+  * @file           : guest_profiler.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/3
+  ******************************************************************************
+  */
+
+
+
+#include "guest_profiler.h"
+#include "emulator.h"
+#include "cartridge.h"
+#include "log-min.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+u32 FormatGuestLocation(u32 location, c8* buf, u32 bufSize) {
+    int len = location == GUEST_ROOT_LOCATION ?
+            snprintf(buf, bufSize, "main") :
+            snprintf(buf, bufSize, "%02X:%04X", GuestLocationBank(location), (u32)GuestLocationPc(location));
+    return len < 0 ? 0 : std::min((u32)len, bufSize ? bufSize - 1 : 0);
+}
+
+// The number of bytes of an instruction, including the operands.
+static u8 InstructionLength(u8 opcode) {
+    switch(opcode) {
+        case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+        case 0xC2: case 0xC3: case 0xC4: case 0xCA: case 0xCC: case 0xCD:
+        case 0xD2: case 0xD4: case 0xDA: case 0xDC: case 0xEA: case 0xFA:
+            return 3;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        case 0xE0: case 0xF0: case 0xE8: case 0xF8: case 0xCB:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// CALL and RST.
+static bool IsCall(u8 opcode) {
+    return opcode == 0xCD || opcode == 0xC4 || opcode == 0xCC || opcode == 0xD4 || opcode == 0xDC ||
+           (opcode & 0xC7) == 0xC7;
+}
+
+// RET and RETI.
+static bool IsRet(u8 opcode) {
+    return opcode == 0xC9 || opcode == 0xD9 || opcode == 0xC0 || opcode == 0xC8 || opcode == 0xD0 || opcode == 0xD8;
+}
+
+static bool IsJump(u8 opcode) {
+    return opcode == 0xC3 || opcode == 0xC2 || opcode == 0xCA || opcode == 0xD2 || opcode == 0xDA ||
+           opcode == 0xE9 || opcode == 0x18 || (opcode <= 0x38 && (opcode & 0xE7) == 0x20);
+}
+
+static u32 GuestLocationOf(Emulator* emu, u16 pc) {
+    return MakeGuestLocation(pc <= 0x7FFF ? CartridgeRomBank(emu, pc) : 0, pc);
+}
+
+void GuestProfiler::Reset() {
+    locations.clear();
+    nodes.clear();
+    children.clear();
+    stack.clear();
+    StackNode root;
+    root.function = GUEST_ROOT_LOCATION;
+    root.parent = 0;
+    nodes.push_back(root);
+    currentNode = 0;
+    totalInstructions = 0;
+    totalCycles = 0;
+    hasPrevious = false;
+}
+
+void GuestProfiler::OnInstruction(Emulator *emu) {
+    u16 pc = emu->cpu.pc;
+    if(hasPrevious) {
+        u64 cycles = emu->clockCycles - previousCycles;
+        Counter& location = locations[previousLocation];
+        ++location.instructions;
+        location.cycles += cycles;
+        Counter& self = nodes[currentNode].self;
+        ++self.instructions;
+        self.cycles += cycles;
+        ++totalInstructions;
+        totalCycles += cycles;
+        UpdateCallStack(emu, pc);
+    }
+    hasPrevious = true;
+    previousLocation = GuestLocationOf(emu, pc);
+    previousPc = pc;
+    previousSp = emu->cpu.sp;
+    previousOpcode = emu->Peek(pc);
+    previousCycles = emu->clockCycles;
+}
+
+void GuestProfiler::UpdateCallStack(Emulator *emu, u16 pc) {
+    u16 fallthrough = (u16)(previousPc + InstructionLength(previousOpcode));
+    if(pc == fallthrough) {
+        return;
+    }
+    if(IsCall(previousOpcode)) {
+        // A taken call, or an interrupt dispatched right after a call that was not taken,
+        // both return to the next instruction.
+        Push(emu, pc, fallthrough);
+        return;
+    }
+    bool isVector = pc >= 0x40 && pc <= 0x60 && (pc & 0x07) == 0;
+    if(isVector && !IsJump(previousOpcode)) {
+        // Interrupt dispatch, the return address is on the stack.
+        u16 returnPc = (u16)(emu->Peek(emu->cpu.sp) | (emu->Peek((u16)(emu->cpu.sp + 1)) << 8));
+        if(IsRet(previousOpcode)) {
+            // The return completed before the interrupt was dispatched.
+            Pop(returnPc);
+        }
+        Push(emu, pc, returnPc);
+        return;
+    }
+    if(IsRet(previousOpcode)) {
+        Pop(pc);
+    }
+}
+
+void GuestProfiler::Push(Emulator *emu, u16 pc, u16 returnPc) {
+    if(stack.size() >= MAX_CALL_DEPTH) {
+        return;
+    }
+    u32 function = GuestLocationOf(emu, pc);
+    u64 key = ((u64)currentNode << 32) | function;
+    auto iter = children.find(key);
+    u32 node;
+    if(iter == children.end()) {
+        node = (u32)nodes.size();
+        StackNode child;
+        child.function = function;
+        child.parent = currentNode;
+        nodes.push_back(child);
+        children.emplace(key, node);
+    }
+    else {
+        node = iter->second;
+    }
+    Frame frame;
+    frame.node = node;
+    frame.returnPc = returnPc;
+    stack.push_back(frame);
+    currentNode = node;
+}
+
+void GuestProfiler::Pop(u16 pc) {
+    // Games may drop return addresses or return to another caller, so unwind to the frame
+    // returning to pc, and ignore returns that do not match any tracked frame.
+    for(size_t i = stack.size(); i > 0; --i) {
+        if(stack[i - 1].returnPc == pc) {
+            stack.resize(i - 1);
+            currentNode = stack.empty() ? 0 : stack.back().node;
+            return;
+        }
+    }
+}
+
+template<typename Less>
+static std::vector<GuestHotspot> TopHotspots(std::vector<GuestHotspot>& all, u32 maxCount, Less less) {
+    u32 count = std::min(maxCount, (u32)all.size());
+    std::partial_sort(all.begin(), all.begin() + count, all.end(), less);
+    all.resize(count);
+    return all;
+}
+
+static bool MoreCycles(const GuestHotspot& a, const GuestHotspot& b) {
+    return a.cycles > b.cycles;
+}
+
+std::vector<GuestHotspot> GuestProfiler::Hotspots(u32 maxCount) const {
+    std::vector<GuestHotspot> all;
+    all.reserve(locations.size());
+    for(const auto& location : locations) {
+        GuestHotspot hotspot;
+        hotspot.location = location.first;
+        hotspot.instructions = location.second.instructions;
+        hotspot.cycles = location.second.cycles;
+        all.push_back(hotspot);
+    }
+    return TopHotspots(all, maxCount, MoreCycles);
+}
+
+std::vector<GuestHotspot> GuestProfiler::Functions(u32 maxCount) const {
+    std::unordered_map<u32, Counter> functions;
+    for(const StackNode& node : nodes) {
+        Counter& function = functions[node.function];
+        function.instructions += node.self.instructions;
+        function.cycles += node.self.cycles;
+    }
+    std::vector<GuestHotspot> all;
+    all.reserve(functions.size());
+    for(const auto& function : functions) {
+        GuestHotspot hotspot;
+        hotspot.location = function.first;
+        hotspot.instructions = function.second.instructions;
+        hotspot.cycles = function.second.cycles;
+        all.push_back(hotspot);
+    }
+    return TopHotspots(all, maxCount, MoreCycles);
+}
+
+bool GuestProfiler::WriteFoldedStacks(const c8 *path) const {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        ERROR("failed to open folded stack file: %s", path);
+        return false;
+    }
+    std::vector<u32> pathNodes;
+    std::string line;
+    c8 name[16];
+    for(u32 i = 0; i < (u32)nodes.size(); ++i) {
+        if(!nodes[i].self.cycles) {
+            continue;
+        }
+        pathNodes.clear();
+        for(u32 node = i; node != 0; node = nodes[node].parent) {
+            pathNodes.push_back(node);
+        }
+        pathNodes.push_back(0);
+        line.clear();
+        for(size_t j = pathNodes.size(); j > 0; --j) {
+            if(j != pathNodes.size()) {
+                line += ';';
+            }
+            u32 len = FormatGuestLocation(nodes[pathNodes[j - 1]].function, name, sizeof(name));
+            line.append(name, len);
+        }
+        fprintf(file, "%s %llu\n", line.c_str(), (unsigned long long)nodes[i].self.cycles);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
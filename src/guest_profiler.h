@@ -0,0 +1,110 @@
+/**
+  ******************************************************************************
+  * @file           : guest_profiler.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/3
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_GUEST_PROFILER_H
+#define GAMEBOY_EMULATOR_GUEST_PROFILER_H
+
+#include "type.h"
+#include "cpu_trace.h"
+
+#include <unordered_map>
+#include <vector>
+
+//! A guest code location, the ROM bank mapped at the PC in the high 16 bits and the PC in the low 16 bits.
+//! Code running outside the cartridge ROM (WRAM, HRAM) uses bank 0.
+inline constexpr u32 MakeGuestLocation(u32 bank, u16 pc) { return (bank << 16) | pc; }
+inline constexpr u16 GuestLocationPc(u32 location) { return (u16)(location & 0xFFFF); }
+inline constexpr u32 GuestLocationBank(u32 location) { return location >> 16; }
+
+//! The location of the code that is not inside any tracked call, shown as "main".
+constexpr u32 GUEST_ROOT_LOCATION = 0xFFFFFFFF;
+
+// formats a location as "bank:pc" ("01:4A3F"), returns the number of characters written
+u32 FormatGuestLocation(u32 location, c8* buf, u32 bufSize);
+
+struct GuestHotspot {
+    u32 location;
+    u64 instructions;
+    u64 cycles;
+};
+
+//! Exact guest code profiler, counts the executed instructions and cycles per (ROM bank, PC).
+//! CALL, RST and interrupt dispatch push a function and RET/RETI pop it, so the counts are also
+//! aggregated per function and per call stack, the stacks export as folded stacks for flame graphs.
+//! The cycles of an instruction are the clock cycles until the next instruction starts, including
+//! an interrupt dispatch or HALT in between.
+//! Attach it with emu->cpu.traceHook.
+class GuestProfiler : public CPUTraceHook {
+public:
+    //! Deeper calls are not tracked, their time goes to the deepest tracked function.
+    static constexpr u32 MAX_CALL_DEPTH = 256;
+
+    GuestProfiler() { Reset(); }
+
+    void Reset();
+
+    void OnInstruction(Emulator* emu) override;
+
+    u64 TotalInstructions() const { return totalInstructions; }
+    u64 TotalCycles() const { return totalCycles; }
+    u32 CallDepth() const { return (u32)stack.size(); }
+
+    // the locations with the most cycles, sorted by cycles
+    std::vector<GuestHotspot> Hotspots(u32 maxCount) const;
+    // the functions with the most self cycles (excluding callees), sorted by cycles
+    std::vector<GuestHotspot> Functions(u32 maxCount) const;
+
+    // writes one "main;func;func cycles" line per call stack, the input format of flamegraph.pl
+    // and speedscope, returns false if the file could not be written.
+    bool WriteFoldedStacks(const c8* path) const;
+
+private:
+    struct Counter {
+        u64 instructions = 0;
+        u64 cycles = 0;
+    };
+    //! One node per distinct call stack, node 0 is the root.
+    struct StackNode {
+        u32 function;
+        u32 parent;
+        Counter self;
+    };
+    struct Frame {
+        u32 node;
+        u16 returnPc;
+    };
+
+    void UpdateCallStack(Emulator* emu, u16 pc);
+    void Push(Emulator* emu, u16 pc, u16 returnPc);
+    void Pop(u16 pc);
+
+    std::unordered_map<u32, Counter> locations;
+    std::vector<StackNode> nodes;
+    //! (parent node << 32 | function location) -> node
+    std::unordered_map<u64, u32> children;
+    std::vector<Frame> stack;
+    u32 currentNode;
+
+    u64 totalInstructions;
+    u64 totalCycles;
+
+    //! The instruction seen by the last OnInstruction, its cycles are known at the next one.
+    bool hasPrevious;
+    u32 previousLocation;
+    u16 previousPc;
+    u16 previousSp;
+    u8 previousOpcode;
+    u64 previousCycles;
+};
+
+
+#endif //GAMEBOY_EMULATOR_GUEST_PROFILER_H
@@ -0,0 +1,318 @@
+/**
+  ******************************************************************************
+  * @file           : idle_loop.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/4
+  ******************************************************************************
+  */
+
+
+
+#include "idle_loop.h"
+#include "emulator.h"
+#include "cartridge.h"
+
+#include <algorithm>
+
+//! Loops whose iterations changed the registers this many times are rejected.
+constexpr u32 IDLE_LOOP_MAX_FAILURES = 4;
+
+// Decodes the read instructions a polling loop may start with.
+// offset is the clock cycle of the memory read inside the instruction, reg uses the
+// register encoding of the opcodes (0: B, 1: C, 2: D, 3: E, 4: H, 5: L, 7: A).
+static bool DecodeRead(u8 opcode, u8& length, u8& cycles, u8& offset, u8& reg) {
+    reg = 7;
+    offset = 0;
+    length = 1;
+    cycles = 8;
+    switch(opcode) {
+        case 0xF0: length = 2; cycles = 12; offset = 4; return true;   // LDH A, (a8)
+        case 0xFA: length = 3; cycles = 16; offset = 8; return true;   // LD A, (a16)
+        case 0xF2:                                                      // LD A, (C)
+        case 0x0A:                                                      // LD A, (BC)
+        case 0x1A:                                                      // LD A, (DE)
+            return true;
+        default:
+            break;
+    }
+    // LD r, (HL)
+    if(opcode >= 0x40 && opcode <= 0x7F && (opcode & 0x07) == 6 && opcode != 0x76) {
+        reg = (opcode >> 3) & 0x07;
+        return true;
+    }
+    return false;
+}
+
+static u16 ReadAddress(Emulator* emu, u16 loopStart, u8 opcode) {
+    switch(opcode) {
+        case 0xF0: return (u16)(0xFF00 + emu->BusRead(loopStart + 1));
+        case 0xFA: return (u16)(emu->BusRead(loopStart + 1) | (emu->BusRead(loopStart + 2) << 8));
+        case 0xF2: return (u16)(0xFF00 + emu->cpu.c);
+        case 0x0A: return emu->cpu.bc();
+        case 0x1A: return emu->cpu.de();
+        default: return emu->cpu.hl();
+    }
+}
+
+static u8* Register(CPU& cpu, u8 reg) {
+    switch(reg) {
+        case 0: return &cpu.b;
+        case 1: return &cpu.c;
+        case 2: return &cpu.d;
+        case 3: return &cpu.e;
+        case 4: return &cpu.h;
+        case 5: return &cpu.l;
+        default: return &cpu.a;
+    }
+}
+
+// Whether the value at addr can only change by CPU writes or at hardware events.
+static bool IsQuietAddress(u16 addr) {
+    return (addr >= 0xC000 && addr <= 0xFDFF) ||      // WRAM and echo RAM
+           (addr >= 0xFF80 && addr <= 0xFFFE) ||      // HRAM
+           addr == 0xFF0F || addr == 0xFF41 || addr == 0xFF44;    // IF, STAT, LY
+}
+
+// Decodes instructions that only use registers and immediate data, returns their length or 0.
+static u8 DecodeRegisterOnly(u8 opcode, u8 cbOpcode) {
+    if(opcode >= 0x40 && opcode <= 0xBF) {
+        // LD r, r and ALU A, r, without the (HL) forms and HALT.
+        bool usesHl = (opcode & 0x07) == 6 || (opcode >= 0x70 && opcode <= 0x77);
+        return usesHl ? 0 : 1;
+    }
+    switch(opcode) {
+        case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+        case 0x03: case 0x0B: case 0x13: case 0x1B: case 0x23: case 0x2B: case 0x33: case 0x3B:
+        case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15: case 0x1C: case 0x1D:
+        case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x3C: case 0x3D:
+        case 0x09: case 0x19: case 0x29: case 0x39:
+            return 1;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            return 2;
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            return 3;
+        case 0xCB:
+            // The (HL) forms access memory.
+            return (cbOpcode & 0x07) == 6 ? 0 : 2;
+        default:
+            return 0;
+    }
+}
+
+// Decodes JR and JP, returns their length or 0.
+static u8 DecodeBranch(Emulator* emu, u16 addr, u8 opcode, u16& target) {
+    switch(opcode) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            target = (u16)(addr + 2 + (i8)emu->BusRead(addr + 1));
+            return 2;
+        case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+            target = (u16)(emu->BusRead(addr + 1) | (emu->BusRead(addr + 2) << 8));
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+void IdleLoopSkipper::Boundary::Capture(const CPU& cpu) {
+    a = cpu.a; f = cpu.f; b = cpu.b; c = cpu.c; d = cpu.d; e = cpu.e; h = cpu.h; l = cpu.l;
+    sp = cpu.sp;
+    pc = cpu.pc;
+}
+
+void IdleLoopSkipper::Boundary::Restore(CPU& cpu) const {
+    cpu.a = a; cpu.f = f; cpu.b = b; cpu.c = c; cpu.d = d; cpu.e = e; cpu.h = h; cpu.l = l;
+    cpu.sp = sp;
+    cpu.pc = pc;
+}
+
+bool IdleLoopSkipper::Boundary::SameRegisters(const CPU& cpu) const {
+    return cpu.a == a && cpu.f == f && cpu.b == b && cpu.c == c && cpu.d == d && cpu.e == e &&
+           cpu.h == h && cpu.l == l && cpu.sp == sp;
+}
+
+void IdleLoopSkipper::Reset() {
+    loopStart = NO_LOOP;
+    armed = false;
+    recording = false;
+    skipping = false;
+    numBoundaries = 0;
+    numRecorded = 0;
+    failures = 0;
+}
+
+void IdleLoopSkipper::Reject() {
+    rejected[nextRejected] = (loopBank << 16) | (loopStart & 0xFFFF);
+    nextRejected = (nextRejected + 1) % NUM_REJECTED;
+    Reset();
+}
+
+void IdleLoopSkipper::OnBackwardBranch(Emulator *emu, u16 branchPc) {
+    u16 start = emu->cpu.pc;
+    if(!emu->skipIdleLoops || emu->cpu.traceHook || branchPc > 0x7FFF || start == loopStart) {
+        return;
+    }
+    u32 bank = CartridgeRomBank(emu, start);
+    u32 key = (bank << 16) | start;
+    for(u32 r : rejected) {
+        if(r == key) return;
+    }
+
+    // Check the loop statically: one read, then register instructions and branches up to the
+    // branch back to the start.
+    u8 length, cycles, offset, reg;
+    if(!DecodeRead(emu->BusRead(start), length, cycles, offset, reg)) {
+        return;
+    }
+    u16 addr = (u16)(start + length);
+    u32 numInstructions = 1;
+    while(addr < branchPc) {
+        u8 opcode = emu->BusRead(addr);
+        u16 target;
+        u8 instructionLength = DecodeRegisterOnly(opcode, emu->BusRead(addr + 1));
+        if(!instructionLength) {
+            instructionLength = DecodeBranch(emu, addr, opcode, target);
+        }
+        if(!instructionLength || ++numInstructions >= IDLE_LOOP_MAX_INSTRUCTIONS) {
+            return;
+        }
+        addr += instructionLength;
+    }
+    u16 target;
+    if(addr != branchPc || !DecodeBranch(emu, branchPc, emu->BusRead(branchPc), target) || target != start) {
+        return;
+    }
+
+    Reset();
+    loopStart = start;
+    loopEnd = branchPc;
+    loopBank = bank;
+    readLength = length;
+    readCycles = cycles;
+    readOffset = offset;
+    readRegister = reg;
+}
+
+void IdleLoopSkipper::FinishRead(Emulator *emu, u16 addr, u8 value) {
+    CPU& cpu = emu->cpu;
+    *Register(cpu, readRegister) = value;
+    cpu.pc = (u16)(loopStart + readLength);
+    emu->Tick((readCycles - readOffset) / Emulator::GB_CLOCK_CYCLES_PER_MACHINE_CYCLE);
+
+    recording = true;
+    recordingAddr = addr;
+    recordingValue = value;
+    recordingCycles = emu->clockCycles;
+    recorded[1].Capture(cpu);
+    numRecorded = 2;
+}
+
+void IdleLoopSkipper::Record(Emulator *emu, u16 instructionPc) {
+    CPU& cpu = emu->cpu;
+    Boundary& last = recorded[numRecorded - 1];
+    if(instructionPc != last.pc) {
+        // An interrupt was dispatched, the iteration is not repeatable.
+        recording = false;
+        return;
+    }
+    last.cycles = (u32)(emu->clockCycles - recordingCycles);
+    recordingCycles = emu->clockCycles;
+
+    if(instructionPc == loopEnd && cpu.pc == loopStart) {
+        // The iteration is complete, it repeats exactly if it left the registers unchanged.
+        recording = false;
+        if(recorded[0].SameRegisters(cpu)) {
+            for(u32 i = 0; i < numRecorded; ++i) {
+                boundaries[i] = recorded[i];
+            }
+            numBoundaries = numRecorded;
+            iterationCycles = 0;
+            for(u32 i = 0; i < numRecorded; ++i) {
+                iterationCycles += recorded[i].cycles;
+            }
+            readAddr = recordingAddr;
+            readValue = recordingValue;
+            armed = true;
+        }
+        else if(++failures >= IDLE_LOOP_MAX_FAILURES) {
+            Reject();
+        }
+        return;
+    }
+    if(cpu.pc < loopStart || cpu.pc > loopEnd || numRecorded >= IDLE_LOOP_MAX_INSTRUCTIONS) {
+        // The loop exited.
+        recording = false;
+        return;
+    }
+    recorded[numRecorded++].Capture(cpu);
+}
+
+bool IdleLoopSkipper::Enter(Emulator *emu) {
+    CPU& cpu = emu->cpu;
+    recording = false;
+    if(!emu->skipIdleLoops || cpu.traceHook || cpu.interruptMasterEnablingCountdown ||
+       CartridgeRomBank(emu, cpu.pc) != loopBank) {
+        return false;
+    }
+    bool repeats = armed && boundaries[0].SameRegisters(cpu);
+    if(repeats && skipping) {
+        SkipIterations(emu);
+    }
+    skipping = false;
+    // The same accesses and ticks as the read instruction up to the read.
+    u16 addr = repeats ? readAddr : ReadAddress(emu, cpu.pc, emu->BusRead(cpu.pc));
+    emu->Tick(readOffset / Emulator::GB_CLOCK_CYCLES_PER_MACHINE_CYCLE);
+    u8 value = emu->BusRead(addr);
+    if(!repeats || value != readValue) {
+        // Execute this iteration and record it.
+        recorded[0].Capture(cpu);
+        recorded[0].cycles = readCycles;
+        FinishRead(emu, addr, value);
+        return true;
+    }
+
+    emu->Tick((readCycles - readOffset) / Emulator::GB_CLOCK_CYCLES_PER_MACHINE_CYCLE);
+    for(u32 i = 1; i < numBoundaries; ++i) {
+        if((cpu.isInterruptMasterEnabled && (emu->intFlags & emu->intEnableFlags)) ||
+           emu->clockCycles >= runEndCycles) {
+            // Stop where the interrupt is taken or the run ends without skipping.
+            boundaries[i].Restore(cpu);
+            return true;
+        }
+        emu->Tick(boundaries[i].cycles / Emulator::GB_CLOCK_CYCLES_PER_MACHINE_CYCLE);
+    }
+    ++skippedIterations;
+    skipping = true;
+    return true;
+}
+
+void IdleLoopSkipper::SkipIterations(Emulator *emu) {
+    CPU& cpu = emu->cpu;
+    if(emu->profiler || !IsQuietAddress(readAddr) || emu->clockCycles + 1 >= runEndCycles ||
+       (cpu.isInterruptMasterEnabled && (emu->intFlags & emu->intEnableFlags))) {
+        return;
+    }
+    // Stay short of the run end, the iterations there are executed as usual.
+    u64 cycles = std::min(emu->QuietCycles(), runEndCycles - emu->clockCycles - 1);
+    u64 iterations = cycles / iterationCycles;
+    if(iterations) {
+        emu->SkipQuietCycles(iterations * iterationCycles);
+        skippedIterations += iterations;
+    }
+}
+
+void IdleLoopSkipper::SkipHalt(Emulator *emu) {
+    // A pending interrupt wakes the CPU after this machine cycle.
+    if(!emu->skipIdleLoops || emu->profiler || (emu->intFlags & emu->intEnableFlags) ||
+       emu->clockCycles + 1 >= runEndCycles) {
+        return;
+    }
+    u64 cycles = std::min(emu->QuietCycles(), runEndCycles - emu->clockCycles - 1);
+    // Whole machine cycles, the CPU checks for interrupts after every one.
+    cycles -= cycles % Emulator::GB_CLOCK_CYCLES_PER_MACHINE_CYCLE;
+    if(cycles) {
+        emu->SkipQuietCycles(cycles);
+    }
+}
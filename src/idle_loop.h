@@ -0,0 +1,153 @@
+/**
+  ******************************************************************************
+  * @file           : idle_loop.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/4
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_IDLE_LOOP_H
+#define GAMEBOY_EMULATOR_IDLE_LOOP_H
+
+#include "type.h"
+
+class Emulator;
+class CPU;
+
+//! The longest polling loop detected, in bytes and in instructions.
+constexpr u16 IDLE_LOOP_MAX_BYTES = 16;
+constexpr u32 IDLE_LOOP_MAX_INSTRUCTIONS = 8;
+
+//! Detects polling loops like
+//!     wait: LDH A, (0x44)
+//!           CP 0x90
+//!           JR NZ, wait
+//! which start with one memory read followed only by register instructions and branches, and
+//! fast-forwards the clock through their iterations instead of executing them.
+//!
+//! An iteration is only skipped after the same iteration, starting from the same registers and
+//! reading the same value, was executed once and ended with unchanged registers. Such an
+//! iteration repeats exactly until the polled value changes, so skipping it only needs to tick
+//! the hardware and re-read the polled address at the cycle the read instruction would.
+//! If an interrupt is pending at an instruction boundary in the middle of a skipped iteration,
+//! the registers recorded at that boundary are restored, so interrupts are taken at the same
+//! cycle and the same PC as without skipping.
+//! While the hardware is quiet (see Emulator::QuietCycles()) and the loop polls memory that
+//! only the CPU writes or a register that only changes at a hardware event (IF, STAT, LY),
+//! every iteration up to the next event reads the same value, and all of them are skipped at
+//! once by advancing the clock and the counters in one go. A halted CPU is fast-forwarded the
+//! same way, nothing can wake it before the next event.
+//! Only loops in the cartridge ROM are detected, and nothing is skipped while a CPU trace hook
+//! is attached, so traces still see every instruction. Nothing is skipped in bulk while a
+//! profiler is attached, so it still sees every tick.
+class IdleLoopSkipper {
+public:
+    void Reset();
+
+    // called by CPU::Step before fetching an instruction at LoopStart(), returns true if the
+    // instruction was skipped or executed here, false if the CPU should execute it.
+    bool Enter(Emulator* emu);
+
+    // called by CPU::Step after executing the instruction at instructionPc, pc is the new PC.
+    void AfterInstruction(Emulator* emu, u16 instructionPc, u16 pc) {
+        skipping = false;
+        if(recording) {
+            Record(emu, instructionPc);
+        }
+        else if(pc < instructionPc && instructionPc - pc <= IDLE_LOOP_MAX_BYTES) {
+            OnBackwardBranch(emu, instructionPc);
+        }
+    }
+
+    // called by CPU::Step before every machine cycle the CPU is halted for, fast-forwards
+    // through the quiet cycles before it.
+    void SkipHalt(Emulator* emu);
+
+    // the start address of the detected loop, an invalid address if there is none.
+    u32 LoopStart() const { return loopStart; }
+
+    // called before the emulator runs up to endCycles. The memory may have been changed from
+    // outside since the last run, the next iteration is not skipped in bulk.
+    void BeginRun(u64 endCycles) {
+        runEndCycles = endCycles;
+        skipping = false;
+    }
+
+    //! The clock cycle the current run stops at. A skipped iteration stops at the first
+    //! instruction boundary past it, where executing the loop would have stopped.
+    u64 runEndCycles = 0;
+
+    //! The number of loop iterations skipped, for statistics.
+    u64 skippedIterations = 0;
+
+private:
+    //! The CPU state at an instruction boundary of the recorded iteration.
+    struct Boundary {
+        u8 a, f, b, c, d, e, h, l;
+        u16 sp;
+        u16 pc;
+        //! The clock cycles of the instruction starting at this boundary.
+        u32 cycles;
+
+        void Capture(const CPU& cpu);
+        void Restore(CPU& cpu) const;
+        // true if the registers other than PC match
+        bool SameRegisters(const CPU& cpu) const;
+    };
+
+    void OnBackwardBranch(Emulator* emu, u16 branchPc);
+    // skips the iterations that read the same value for sure in one go.
+    void SkipIterations(Emulator* emu);
+    void Record(Emulator* emu, u16 instructionPc);
+    void Reject();
+    // finishes the read instruction at the loop start with the value read, and starts
+    // recording the iteration.
+    void FinishRead(Emulator* emu, u16 addr, u8 value);
+
+    static constexpr u32 NO_LOOP = 0xFFFFFFFF;
+
+    //! The detected loop, statically checked.
+    u32 loopStart = NO_LOOP;
+    u16 loopEnd = 0;
+    u32 loopBank = 0;
+    //! The read instruction at the loop start.
+    u8 readLength = 0;
+    u8 readCycles = 0;
+    //! The clock cycle offset of the memory read inside the read instruction.
+    u8 readOffset = 0;
+    u8 readRegister = 0;
+
+    //! The recorded iteration, valid when armed.
+    bool armed = false;
+    u16 readAddr = 0;
+    u8 readValue = 0;
+    Boundary boundaries[IDLE_LOOP_MAX_INSTRUCTIONS];
+    u32 numBoundaries = 0;
+    //! The clock cycles of one iteration.
+    u32 iterationCycles = 0;
+    //! The last iteration was skipped and no instruction ran since, so the polled value was
+    //! read as readValue.
+    bool skipping = false;
+
+    //! The iteration being recorded, started by FinishRead().
+    bool recording = false;
+    u16 recordingAddr = 0;
+    u8 recordingValue = 0;
+    u64 recordingCycles = 0;
+    Boundary recorded[IDLE_LOOP_MAX_INSTRUCTIONS];
+    u32 numRecorded = 0;
+    //! The number of recorded iterations that changed the registers.
+    u32 failures = 0;
+
+    //! Recently rejected loops, not detected again.
+    static constexpr u32 NUM_REJECTED = 8;
+    u32 rejected[NUM_REJECTED] = {NO_LOOP, NO_LOOP, NO_LOOP, NO_LOOP, NO_LOOP, NO_LOOP, NO_LOOP, NO_LOOP};
+    u32 nextRejected = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_IDLE_LOOP_H
@@ -14,95 +14,134 @@
 #include "stbi/stb_image.h"
 #include "file_helper.h"
 
+#include <cassert>
+#include <cstring>
+
 ImGuiPixelRenderer::ImGuiPixelRenderer() {
     _tex    = 0;
     _width  = 0;
     _height = 0;
+    _mode   = ColorMode::NONE;
+    _pbos[0] = 0;
+    _pbos[1] = 0;
+    _pboIndex = 0;
+    _usePbo = false;
 }
 
-bool LoadTextureFromMemory(const void* data, size_t data_size, GLuint* out_texture, int* out_width, int* out_height)
-{
-    // Load from file
-    int image_width = 0;
-    int image_height = 0;
-    unsigned char* image_data = stbi_load_from_memory((const unsigned char*)data, (int)data_size, &image_width, &image_height, NULL, 4);
-    if (image_data == NULL)
-        return false;
+ImGuiPixelRenderer::~ImGuiPixelRenderer() {
+    Release();
+}
+
+inline int GetPixelSize(ColorMode mode) {
+    switch (mode) {
+        case ColorMode::RGB:
+            return 3;
+        case ColorMode::RGBA:
+            return 4;
+        default:
+            return 0;
+    }
+}
 
-    // Create a OpenGL texture identifier
-    GLuint image_texture;
-    glGenTextures(1, &image_texture);
-    glBindTexture(GL_TEXTURE_2D, image_texture);
+inline GLenum GetPixelFormat(ColorMode mode) {
+    return mode == ColorMode::RGB ? GL_RGB : GL_RGBA;
+}
+
+void ImGuiPixelRenderer::CreateTex(int width, int height, ColorMode mode) {
+    Release();
+
+    _width = width;
+    _height = height;
+    _mode = mode;
+
+    glGenTextures(1, &_tex);
+    glBindTexture(GL_TEXTURE_2D, _tex);
 
     // Setup filtering parameters for display
-//    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-//    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    // Upload pixels into texture
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
-    stbi_image_free(image_data);
+    // Allocate the storage only, the pixels are streamed in with glTexSubImage2D.
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GetPixelFormat(mode), GL_UNSIGNED_BYTE, nullptr);
 
-    *out_texture = image_texture;
-    *out_width = image_width;
-    *out_height = image_height;
-
-    return true;
+    if(_usePbo) {
+        glGenBuffers(2, _pbos);
+        for (unsigned int pbo : _pbos) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, width * height * GetPixelSize(mode), nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
 }
 
 void ImGuiPixelRenderer::GeneTex(const unsigned char *data, int width, int height, ColorMode mode) {
     assert(mode != ColorMode::NONE && "color mode is none!");
 
-    _width = width;
-    _height = height;
-
-    char ppmHeader[100] = {0};
-    snprintf(ppmHeader, 100, "P6 %d %d 255 ", width, height);
-    int headerSize = (int) strlen(ppmHeader);
-    int texDataSize = headerSize + width * height * 3;
-
-    unsigned char *texData;
-    texData = (unsigned char *) malloc(texDataSize);
-
-    // 1. write in the ppm header
-    memcpy(texData, ppmHeader, strlen(ppmHeader));
-
-    int pixelSize = 0;
-    switch (mode) {
-        case ColorMode::RGB:
-            pixelSize = 3;
-            break;
-        case ColorMode::RGBA:
-            pixelSize = 4;
-            break;
-        default:
-            return;
+    if(!_tex || width != _width || height != _height || mode != _mode) {
+        CreateTex(width, height, mode);
     }
 
-    // 2. write in the ppm pixel colors
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            int idx = i * width + j;
-            memcpy(texData + headerSize + idx * 3, data + idx * pixelSize, 3);
+    int dataSize = width * height * GetPixelSize(mode);
+
+    glBindTexture(GL_TEXTURE_2D, _tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if(_usePbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pbos[_pboIndex]);
+        _pboIndex ^= 1;
+        // Invalidating lets the driver hand out fresh memory instead of waiting for the last transfer.
+        void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, dataSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if(dst) {
+            memcpy(dst, data, dataSize);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GetPixelFormat(mode), GL_UNSIGNED_BYTE, nullptr);
         }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GetPixelFormat(mode), GL_UNSIGNED_BYTE, data);
     }
 
-    LoadTextureFromMemory((const void*)texData, texDataSize, &_tex, &_width, &_height);
-
-    free(texData);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 void ImGuiPixelRenderer::GeneTex(const char *fileName) {
     void *data = nullptr;
     size_t fileSize = LoadFile(fileName, data);
 
-    LoadTextureFromMemory(data, fileSize, &_tex, &_width, &_height);
+    int image_width = 0;
+    int image_height = 0;
+    unsigned char* image_data = stbi_load_from_memory((const unsigned char*)data, (int)fileSize, &image_width, &image_height, NULL, 4);
+    if(image_data) {
+        GeneTex(image_data, image_width, image_height, ColorMode::RGBA);
+        stbi_image_free(image_data);
+    }
 
     free(data);
 }
 
+void ImGuiPixelRenderer::SetUsePbo(bool usePbo) {
+    if(usePbo != _usePbo) {
+        _usePbo = usePbo;
+        // Recreated on the next upload.
+        Release();
+    }
+}
+
+void ImGuiPixelRenderer::Release() {
+    if(_tex) {
+        glDeleteTextures(1, &_tex);
+        _tex = 0;
+    }
+    if(_pbos[0]) {
+        glDeleteBuffers(2, _pbos);
+        _pbos[0] = 0;
+        _pbos[1] = 0;
+    }
+    _pboIndex = 0;
+}
+
 void ImGuiPixelRenderer::Render() {
     ImGui::Image((void*)(intptr_t)_tex, ImVec2(_width * 3, _height * 3));
 }
@@ -25,14 +25,36 @@ class ImGuiPixelRenderer {
 private:
     unsigned int    _tex;
     int             _width, _height;
+    ColorMode       _mode;
+
+    //! Two pixel unpack buffers used in turn, so filling one never waits for the
+    //! transfer from the other.
+    unsigned int    _pbos[2];
+    unsigned int    _pboIndex;
+    bool            _usePbo;
+
+    void CreateTex(int width, int height, ColorMode mode);
 
 public:
     ImGuiPixelRenderer();
+    ~ImGuiPixelRenderer();
+    ImGuiPixelRenderer(const ImGuiPixelRenderer&) = delete;
+    ImGuiPixelRenderer& operator=(const ImGuiPixelRenderer&) = delete;
 
+    // uploads the pixels into the texture. The texture is created on the first call and only
+    // recreated when the size or the color mode changes, later calls stream into it.
     void GeneTex(const unsigned char *data, int width, int height, ColorMode mode);
 
     void GeneTex(const char* fileName);
 
+    // streams the uploads through pixel unpack buffers instead of passing the pixels to GL directly
+    void SetUsePbo(bool usePbo);
+
+    // deletes the GL objects, the GL context must still be current
+    void Release();
+    // false before the first upload and after Release()
+    bool HasTex() const { return _tex != 0; }
+
     void Render();
 
     void Render(float pixelWidth);
@@ -0,0 +1,45 @@
+/**
+  ******************************************************************************
+  * @file           : input_queue.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "input_queue.h"
+#include "emulator.h"
+
+#include <algorithm>
+
+void InputQueue::Schedule(u64 cycles, u8 press, u8 release) {
+    std::lock_guard<std::mutex> lock(mutex);
+    InputEvent event = {cycles, press, release};
+    auto position = std::upper_bound(events.begin(), events.end(), event,
+                                     [](const InputEvent& a, const InputEvent& b) { return a.cycles < b.cycles; });
+    events.insert(position, event);
+    nextEventCycles.store(events.front().cycles, std::memory_order_release);
+}
+
+void InputQueue::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    nextEventCycles.store(UINT64_MAX, std::memory_order_release);
+}
+
+void InputQueue::Apply(Emulator *emu) {
+    if(NextEventCycles() > emu->clockCycles) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    u8 buttons = emu->joypad.get_buttons();
+    u32 due = 0;
+    while(due < events.size() && events[due].cycles <= emu->clockCycles) {
+        buttons = (u8)((buttons & ~events[due].release) | events[due].press);
+        ++due;
+    }
+    events.erase(events.begin(), events.begin() + due);
+    nextEventCycles.store(events.empty() ? UINT64_MAX : events.front().cycles, std::memory_order_release);
+    emu->joypad.set_buttons(emu, buttons);
+}
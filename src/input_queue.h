@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file           : input_queue.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_INPUT_QUEUE_H
+#define GAMEBOY_EMULATOR_INPUT_QUEUE_H
+
+#include "type.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class Emulator;
+
+//! A change of the pressed buttons (see Joypad::get_buttons()): the buttons in release are
+//! released and the buttons in press pressed, at the given clock cycle.
+struct InputEvent {
+    u64 cycles;
+    u8 press;
+    u8 release;
+};
+
+//! The input of one emulator, safe to feed from any thread: the GUI, a batch runner or an
+//! agent driving the emulator from outside.
+//! Every run of the emulator (Update, RunFrames, RunUntil) applies the events that are due at
+//! its start and stops at the instruction boundary at or after the cycle of every scheduled
+//! event to apply it there, so input lands on the exact cycle, independent of how the runs
+//! are split. Checking for events costs one atomic load per run segment.
+class InputQueue {
+public:
+    //! Any thread.
+    // holds buttons from the start of the next run on, e.g. once per frame.
+    void SetButtons(u8 buttons) { Schedule(0, buttons, 0xFF); }
+    // presses or releases buttons at a clock cycle of the emulator, events in the past apply at
+    // the start of the next run. Events at the same cycle apply in the order they were scheduled.
+    void Press(u64 cycles, u8 buttons) { Schedule(cycles, buttons, 0); }
+    void Release(u64 cycles, u8 buttons) { Schedule(cycles, 0, buttons); }
+    void Schedule(u64 cycles, u8 press, u8 release);
+    // drops all pending events.
+    void Clear();
+
+    //! Emulation thread.
+    // the clock cycle of the earliest pending event, UINT64_MAX if there is none.
+    u64 NextEventCycles() const { return nextEventCycles.load(std::memory_order_acquire); }
+    // applies the events due at the current clock to the joypad.
+    void Apply(Emulator* emu);
+
+private:
+    std::mutex mutex;
+    //! Sorted by cycles, stable for equal cycles.
+    std::vector<InputEvent> events;
+    std::atomic<u64> nextEventCycles{UINT64_MAX};
+};
+
+
+#endif //GAMEBOY_EMULATOR_INPUT_QUEUE_H
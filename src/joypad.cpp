@@ -13,6 +13,9 @@
 #include "joypad.h"
 #include "emulator.h"
 #include "bit_oper.h"
+#include "save_state.h"
+
+#include <cstring>
 
 void Joypad::init()
 {
@@ -40,10 +43,35 @@ u8 Joypad::get_key_state() const
     }
     return v;
 }
+u8 Joypad::get_buttons() const
+{
+    u8 buttons = 0;
+    if(a) buttons |= JOYPAD_BUTTON_A;
+    if(b) buttons |= JOYPAD_BUTTON_B;
+    if(select) buttons |= JOYPAD_BUTTON_SELECT;
+    if(start) buttons |= JOYPAD_BUTTON_START;
+    if(right) buttons |= JOYPAD_BUTTON_RIGHT;
+    if(left) buttons |= JOYPAD_BUTTON_LEFT;
+    if(up) buttons |= JOYPAD_BUTTON_UP;
+    if(down) buttons |= JOYPAD_BUTTON_DOWN;
+    return buttons;
+}
+void Joypad::set_buttons(Emulator* emu, u8 buttons)
+{
+    a = (buttons & JOYPAD_BUTTON_A) != 0;
+    b = (buttons & JOYPAD_BUTTON_B) != 0;
+    select = (buttons & JOYPAD_BUTTON_SELECT) != 0;
+    start = (buttons & JOYPAD_BUTTON_START) != 0;
+    right = (buttons & JOYPAD_BUTTON_RIGHT) != 0;
+    left = (buttons & JOYPAD_BUTTON_LEFT) != 0;
+    up = (buttons & JOYPAD_BUTTON_UP) != 0;
+    down = (buttons & JOYPAD_BUTTON_DOWN) != 0;
+    update(emu);
+}
 void Joypad::update(Emulator* emu)
 {
     u8 v = get_key_state();
-    // Any button is pressed in this update.
+    // A selected line went low, by a button press or by selecting the row of a held button.
     if((bitTest(&p1, 0) && !bitTest(&v, 0)) ||
        (bitTest(&p1, 1) && !bitTest(&v, 1)) ||
        (bitTest(&p1, 2) && !bitTest(&v, 2)) ||
@@ -57,10 +85,36 @@ u8 Joypad::bus_read()
 {
     return p1;
 }
-void Joypad::bus_write(u8 v)
+void Joypad::bus_write(Emulator* emu, u8 v)
 {
     // Only update bit 4 and bit 5.
     p1 = (v & 0x30) | (p1 & 0xCF);
     // Refresh key states.
-    p1 = get_key_state();
-}
\ No newline at end of file
+    update(emu);
+}
+
+void Joypad::save_state(StateWriter& writer) const
+{
+    writer.WriteBool(a);
+    writer.WriteBool(b);
+    writer.WriteBool(select);
+    writer.WriteBool(start);
+    writer.WriteBool(right);
+    writer.WriteBool(left);
+    writer.WriteBool(up);
+    writer.WriteBool(down);
+    writer.WriteU8(p1);
+}
+
+void Joypad::load_state(StateReader& reader)
+{
+    a = reader.ReadBool();
+    b = reader.ReadBool();
+    select = reader.ReadBool();
+    start = reader.ReadBool();
+    right = reader.ReadBool();
+    left = reader.ReadBool();
+    up = reader.ReadBool();
+    down = reader.ReadBool();
+    p1 = reader.ReadU8();
+}
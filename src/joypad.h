@@ -17,6 +17,18 @@
 
 class Emulator;
 
+//! Button bits of the packed key state, see Joypad::get_buttons().
+constexpr u8 JOYPAD_BUTTON_A = 0x01;
+constexpr u8 JOYPAD_BUTTON_B = 0x02;
+constexpr u8 JOYPAD_BUTTON_SELECT = 0x04;
+constexpr u8 JOYPAD_BUTTON_START = 0x08;
+constexpr u8 JOYPAD_BUTTON_RIGHT = 0x10;
+constexpr u8 JOYPAD_BUTTON_LEFT = 0x20;
+constexpr u8 JOYPAD_BUTTON_UP = 0x40;
+constexpr u8 JOYPAD_BUTTON_DOWN = 0x80;
+class StateWriter;
+class StateReader;
+
 class Joypad {
 public:
     bool a;
@@ -32,9 +44,17 @@ public:
 
     void init();
     u8 get_key_state() const;
+    // the pressed buttons packed into one byte, so that they can be passed between threads atomically
+    u8 get_buttons() const;
+    // presses exactly the given buttons now, the emulator sets them through Emulator::input.
+    void set_buttons(Emulator* emu, u8 buttons);
+    // refreshes P1 from the buttons, raises the joypad interrupt when a selected line goes low.
     void update(Emulator* emu);
     u8 bus_read();
-    void bus_write(u8 v);
+    void bus_write(Emulator* emu, u8 v);
+
+    void save_state(StateWriter& writer) const;
+    void load_state(StateReader& reader);
 };
 
 
@@ -11,57 +11,281 @@
 
 
 #include <cstdio>
-#include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "log-min.h"
 
+//! The capacity of the queue to the writer thread, a power of two.
+constexpr unsigned int LOG_QUEUE_SIZE = 1024;
+constexpr unsigned int LOG_TEXT_SIZE = 232;
+//! The writer wakes up at least this often, a message never waits longer to be written.
+constexpr unsigned int LOG_WRITER_PERIOD_MS = 20;
+
+//! One queued message. The sequence is the bounded MPSC queue protocol: a slot at queue
+//! position p is free for the producer claiming p while sequence == p, and written while
+//! sequence == p + 1. The writer releases it for position p + LOG_QUEUE_SIZE.
+struct LogRecord {
+    std::atomic<unsigned int> sequence;
+    LogLevel level;
+    int line;
+    const char* fileName;
+    long long time;
+    char text[LOG_TEXT_SIZE];
+};
+
+static std::atomic<unsigned int> maxLogLevel((unsigned int)LogLevel::Debug);
+static const std::chrono::steady_clock::time_point logEpoch = std::chrono::steady_clock::now();
+
+static LogRecord logQueue[LOG_QUEUE_SIZE];
+static std::atomic<unsigned int> logTail{0};
+//! The position of the next record the writer reads.
+static std::atomic<unsigned int> logHead{0};
+static std::atomic<unsigned int> logDropped{0};
+//! The sites with suppressed messages, a lock-free stack the writer only walks.
+static std::atomic<LogSite*> suppressedSites{nullptr};
+
+//! 0: not started, 1: running, 2: stopped at exit, messages are written synchronously then.
+static std::atomic<int> writerState{0};
+static std::once_flag writerOnce;
+static std::thread* writerThread = nullptr;
+static std::mutex writerMutex;
+static std::condition_variable writerCv;
+static std::condition_variable flushCv;
+static std::atomic<bool> writerSleeping{false};
+static bool writerStopping = false;
+//! Serializes the synchronous writes after the writer stopped.
+static std::mutex syncWriteMutex;
+
+void setLogLevel(LogLevel maxLevel) {
+    maxLogLevel.store((unsigned int)maxLevel, std::memory_order_relaxed);
+}
 
-void log(LogLevel logLevel, const char *fileName, int line, const char *format, va_list args) {
-
-    char desc[128];
-    vsnprintf(desc, sizeof(desc), format, args);
-
-    char logContent[512];
-    snprintf(logContent, sizeof(logContent), "[%s] - %s:line %d - [%s] %s\n",
-             getCurrentTimeStamp().c_str(), fileName, line, convertLogLevelToStr(logLevel), desc);
+bool isLogLevelEnabled(LogLevel logLevel) {
+    return (unsigned int)logLevel <= maxLogLevel.load(std::memory_order_relaxed);
+}
 
-    va_end(args);
+// nanoseconds of the steady clock since the start of the program, cheap unlike the calendar time.
+static long long logClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - logEpoch).count();
+}
 
-    std::cout << logContent;
+static const char* levelColor(LogLevel logLevel) {
+    switch (logLevel) {
+        case LogLevel::Fatal:
+        case LogLevel::Critical:
+        case LogLevel::Error:
+            return RED.c_str();
+        case LogLevel::Warn:
+            return YELLOW.c_str();
+        case LogLevel::Info:
+            return BLUE.c_str();
+        default:
+            return GREEN.c_str();
+    }
 }
 
-void logError(LogLevel logLevel, const char *fileName, int line, const char *format, va_list args) {
-    char desc[128];
-    vsnprintf(desc, sizeof(desc), format, args);
+// Colors only on a terminal, redirected output stays plain text.
+static bool stdoutIsTerminal() {
+#ifdef _WIN32
+    static const bool isTerminal = _isatty(_fileno(stdout)) != 0;
+#else
+    static const bool isTerminal = isatty(fileno(stdout)) != 0;
+#endif
+    return isTerminal;
+}
 
+static void writeLine(LogLevel logLevel, const char *fileName, int line, long long time, const char *text) {
     char logContent[512];
-    snprintf(logContent, sizeof(logContent), "[%s] - %s:line %d -  [%s]  %s\n",
-             getCurrentTimeStamp().c_str(), fileName, line, convertLogLevelToStr(logLevel), desc);
+    bool color = stdoutIsTerminal();
+    snprintf(logContent, sizeof(logContent), "%s[%10.3f] - %s:line %d - [%s] %s%s\n",
+             color ? levelColor(logLevel) : "", (double)time / 1e9, fileName, line, convertLogLevelToStr(logLevel),
+             text, color ? RESET.c_str() : "");
+    fputs(logContent, stdout);
+}
 
-    va_end(args);
+// reports the suppressed messages of every site, on the writer thread.
+static void reportSuppressed() {
+    long long now = logClock();
+    for(LogSite* site = suppressedSites.load(std::memory_order_acquire); site; site = site->next) {
+        unsigned int count = site->suppressed.exchange(0, std::memory_order_relaxed);
+        if(count) {
+            char text[64];
+            snprintf(text, sizeof(text), "(suppressed %u more messages)", count);
+            writeLine(site->level, site->fileName, site->line, now, text);
+        }
+    }
+    unsigned int dropped = logDropped.exchange(0, std::memory_order_relaxed);
+    if(dropped) {
+        char text[64];
+        snprintf(text, sizeof(text), "(the log queue was full, dropped %u messages)", dropped);
+        writeLine(LogLevel::Warn, __FILE_NAME__, __LINE__, now, text);
+    }
+}
 
-//    throw std::runtime_error(logContent);
-    std::cout << logContent;
+static void writerMain() {
+    unsigned int head = logHead.load(std::memory_order_relaxed);
+    long long nextReport = 0;
+    while(true) {
+        bool wrote = false;
+        while(true) {
+            LogRecord& record = logQueue[head & (LOG_QUEUE_SIZE - 1)];
+            if(record.sequence.load(std::memory_order_acquire) != head + 1) break;
+            writeLine(record.level, record.fileName, record.line, record.time, record.text);
+            record.sequence.store(head + LOG_QUEUE_SIZE, std::memory_order_release);
+            ++head;
+            wrote = true;
+        }
+        long long now = logClock();
+        if(now >= nextReport) {
+            reportSuppressed();
+            nextReport = now + 1000000000LL;
+        }
+        if(wrote) {
+            fflush(stdout);
+        }
+
+        std::unique_lock<std::mutex> lock(writerMutex);
+        logHead.store(head, std::memory_order_release);
+        flushCv.notify_all();
+        if(writerStopping && logTail.load(std::memory_order_acquire) == head) {
+            break;
+        }
+        writerSleeping.store(true, std::memory_order_relaxed);
+        writerCv.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_PERIOD_MS));
+        writerSleeping.store(false, std::memory_order_relaxed);
+    }
+    reportSuppressed();
+    fflush(stdout);
 }
 
+static void stopWriter() {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writerStopping = true;
+    }
+    writerCv.notify_all();
+    writerThread->join();
+    writerState.store(2, std::memory_order_release);
+}
 
-std::string getCurrentTimeStamp(){
+static void startWriter() {
+    for(unsigned int i = 0; i < LOG_QUEUE_SIZE; ++i) {
+        logQueue[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    writerThread = new std::thread(writerMain);
+    writerState.store(1, std::memory_order_release);
+    // Write the remaining messages when the program exits.
+    atexit(stopWriter);
+}
 
-    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+static void enqueue(LogLevel logLevel, const char *fileName, int line, long long time, const char *text) {
+    if(writerState.load(std::memory_order_acquire) == 0) {
+        std::call_once(writerOnce, startWriter);
+    }
+    if(writerState.load(std::memory_order_acquire) == 2) {
+        std::lock_guard<std::mutex> lock(syncWriteMutex);
+        writeLine(logLevel, fileName, line, time, text);
+        fflush(stdout);
+        return;
+    }
+    unsigned int position = logTail.load(std::memory_order_relaxed);
+    LogRecord* record;
+    while(true) {
+        record = &logQueue[position & (LOG_QUEUE_SIZE - 1)];
+        int diff = (int)(record->sequence.load(std::memory_order_acquire) - position);
+        if(diff == 0) {
+            if(logTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        else if(diff < 0) {
+            // The writer is a whole queue behind.
+            logDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else {
+            position = logTail.load(std::memory_order_relaxed);
+        }
+    }
+    record->level = logLevel;
+    record->fileName = fileName;
+    record->line = line;
+    record->time = time;
+    snprintf(record->text, LOG_TEXT_SIZE, "%s", text);
+    record->sequence.store(position + 1, std::memory_order_release);
+    if(writerSleeping.load(std::memory_order_relaxed) && logLevel <= LogLevel::Error) {
+        // Errors are written right away, everything else within LOG_WRITER_PERIOD_MS.
+        writerCv.notify_one();
+    }
+}
 
-    std::time_t now_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm* now_tm = std::localtime(&now_time_t);
+void flushLog() {
+    if(writerState.load(std::memory_order_acquire) != 1) return;
+    unsigned int target = logTail.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(writerMutex);
+    writerCv.notify_one();
+    flushCv.wait(lock, [target] { return (int)(logHead.load(std::memory_order_acquire) - target) >= 0; });
+}
 
-    char buffer[128] = {0};
-    strftime(buffer, sizeof(buffer), "%F %T:", now_tm);
+// counts a suppressed message, the writer thread reports the count.
+static void suppress(LogSite *site, LogLevel logLevel, const char *fileName, int line) {
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    if(!site->registered.load(std::memory_order_relaxed) && !site->registered.exchange(true)) {
+        site->fileName = fileName;
+        site->line = line;
+        site->level = logLevel;
+        LogSite* head = suppressedSites.load(std::memory_order_relaxed);
+        do {
+            site->next = head;
+        } while(!suppressedSites.compare_exchange_weak(head, site, std::memory_order_release, std::memory_order_relaxed));
+    }
+}
 
-    const auto duration_in_millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    const int milliseconds = duration_in_millis.count();
+static unsigned long long hashText(const char *text) {
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for(; *text; ++text) {
+        hash = (hash ^ (unsigned char)*text) * 1099511628211ULL;
+    }
+    return hash;
+}
 
-    std::string msStr = std::to_string(milliseconds);
-    strcpy(buffer + strlen(buffer), msStr.c_str());
+static void log(LogSite *site, LogLevel logLevel, const char *fileName, int line, const char *format, va_list args) {
+    // Rate limit before formatting, a flood of messages costs a few atomics per message.
+    long long time = logClock();
+    unsigned long long second = (unsigned long long)(time / 1000000000LL);
+    unsigned long long window = site->window.load(std::memory_order_relaxed);
+    bool newWindow = window != second && site->window.compare_exchange_strong(window, second, std::memory_order_relaxed);
+    if(newWindow) {
+        site->emitted.store(0, std::memory_order_relaxed);
+    }
+    if(site->emitted.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_MESSAGES_PER_SECOND) {
+        suppress(site, logLevel, fileName, line);
+        return;
+    }
 
-    return buffer;
+    char desc[LOG_TEXT_SIZE];
+    vsnprintf(desc, sizeof(desc), format, args);
+    // The same message repeated within a second is written once.
+    unsigned long long hash = hashText(desc);
+    if(site->lastHash.exchange(hash, std::memory_order_relaxed) == hash && !newWindow) {
+        suppress(site, logLevel, fileName, line);
+        return;
+    }
+    enqueue(logLevel, fileName, line, time, desc);
+    if(logLevel <= LogLevel::Critical) {
+        flushLog();
+    }
 }
 
 const char* convertLogLevelToStr(const LogLevel &logLevel){
@@ -85,70 +309,47 @@ const char* convertLogLevelToStr(const LogLevel &logLevel){
             return "Debug";
             break;
     }
+    return "";
 }
 
-void Fatal(const char *fileName, int line, const char *format, ...) {
+void Fatal(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << RED;
-    logError(LogLevel::Fatal, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Fatal, fileName, line, format, args);
     va_end(args);
 }
 
-void Critical(const char *fileName, int line, const char *format, ...) {
+void Critical(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << RED;
-    logError(LogLevel::Critical, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Critical, fileName, line, format, args);
     va_end(args);
 }
 
-void Error(const char *fileName, int line, const char *format, ...) {
+void Error(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << RED;
-    logError(LogLevel::Error, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Error, fileName, line, format, args);
     va_end(args);
 }
 
-void Warn(const char *fileName, int line, const char *format, ...) {
+void Warn(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << YELLOW;
-    log(LogLevel::Warn, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Warn, fileName, line, format, args);
     va_end(args);
 }
 
-void Info(const char *fileName, int line, const char *format, ...) {
+void Info(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << BLUE;
-    log(LogLevel::Info, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Info, fileName, line, format, args);
     va_end(args);
 }
 
-void Debug(const char *fileName, int line, const char *format, ...) {
+void Debug(LogSite *site, const char *fileName, int line, const char *format, ...) {
     va_list args;
     va_start(args, format);
-
-    std::cout << GREEN;
-    log(LogLevel::Debug, fileName, line, format, args);
-    std::cout << RESET;
-
+    log(site, LogLevel::Debug, fileName, line, format, args);
     va_end(args);
 }
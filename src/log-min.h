@@ -13,6 +13,7 @@
 #ifndef GAMEBOY_EMULATOR_LOG_MIN_H
 #define GAMEBOY_EMULATOR_LOG_MIN_H
 
+#include <atomic>
 #include <cstdarg>
 #include <string>
 
@@ -26,31 +27,71 @@ enum class LogLevel : unsigned int {
     Debug       = 500,
 };
 
+//! Messages above this level are compiled out, their arguments are never evaluated.
+//! Define it to 300 (Warn) to remove the info and debug messages from a build.
+#ifndef GB_LOG_MAX_LEVEL
+#define GB_LOG_MAX_LEVEL 500
+#endif
+
+//! Every call site writes at most this many messages per second, the rest are counted and
+//! reported by the writer thread as one line.
+constexpr unsigned int LOG_SITE_MESSAGES_PER_SECOND = 8;
+
 const std::string RED = "\033[31m";
 const std::string GREEN = "\033[32m";
 const std::string YELLOW = "\033[33m";
 const std::string BLUE = "\033[34m";
 const std::string RESET = "\033[0m";
 
-void log(LogLevel logLevel, const char* fileName, int line, const char *format, va_list args);
-void logError(LogLevel logLevel, const char* fileName, int line, const char *format, va_list args);
+//! The rate limiting state of one log call site, a static in every macro expansion.
+//! Constant initialized, so the statics cost no guard.
+struct LogSite {
+    //! The second (of the log clock) the emitted count belongs to.
+    std::atomic<unsigned long long> window{0};
+    std::atomic<unsigned int> emitted{0};
+    //! The messages dropped by the rate limit or as repeats since the last report.
+    std::atomic<unsigned int> suppressed{0};
+    //! The hash of the last written message, an identical one is dropped as a repeat.
+    std::atomic<unsigned long long> lastHash{0};
+    //! Sites with suppressed messages are put on a list the writer thread reports from.
+    std::atomic<bool> registered{false};
+    LogSite* next = nullptr;
+    const char* fileName = nullptr;
+    int line = 0;
+    LogLevel level = LogLevel::Debug;
+};
 
-void Fatal(const char *fileName, int line, const char *format, ...);
-void Critical(const char *fileName, int line, const char *format, ...);
-void Error(const char *fileName, int line, const char *format, ...);
-void Warn(const char *fileName, int line, const char *format, ...);
-void Info(const char *fileName, int line, const char *format, ...);
-void Debug(const char *fileName, int line, const char *format, ...);
+// Messages are formatted on the calling thread and handed to a background writer thread
+// through a lock-free queue, logging never waits for the console. If the queue is full the
+// message is dropped and counted. Fatal and critical messages wait until they are written.
+void Fatal(LogSite* site, const char *fileName, int line, const char *format, ...);
+void Critical(LogSite* site, const char *fileName, int line, const char *format, ...);
+void Error(LogSite* site, const char *fileName, int line, const char *format, ...);
+void Warn(LogSite* site, const char *fileName, int line, const char *format, ...);
+void Info(LogSite* site, const char *fileName, int line, const char *format, ...);
+void Debug(LogSite* site, const char *fileName, int line, const char *format, ...);
 
-std::string getCurrentTimeStamp();
+// messages above this level are discarded, the default is LogLevel::Debug (log everything)
+void setLogLevel(LogLevel maxLevel);
+bool isLogLevelEnabled(LogLevel logLevel);
+// waits until every message logged so far is written.
+void flushLog();
 
 const char* convertLogLevelToStr(const LogLevel &logLevel);
 
-#define FATAL(format, ...)      Fatal(__FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
-#define CRITICAL(format, ...)   Critical(__FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
-#define ERROR(format, ...)      Error( __FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
-#define WARN(format, ...)       Warn(__FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
-#define INFO(format, ...)       Info(__FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
-#define DEBUG(format, ...)      Debug(__FILE_NAME__, __LINE__, format, ##__VA_ARGS__)
+#define GB_LOG(level, func, format, ...)                                                    \
+    do {                                                                                    \
+        if((unsigned int)(level) <= GB_LOG_MAX_LEVEL && isLogLevelEnabled(level)) {         \
+            static LogSite gbLogSite;                                                       \
+            func(&gbLogSite, __FILE_NAME__, __LINE__, format, ##__VA_ARGS__);               \
+        }                                                                                   \
+    } while(0)
+
+#define FATAL(format, ...)      GB_LOG(LogLevel::Fatal, Fatal, format, ##__VA_ARGS__)
+#define CRITICAL(format, ...)   GB_LOG(LogLevel::Critical, Critical, format, ##__VA_ARGS__)
+#define ERROR(format, ...)      GB_LOG(LogLevel::Error, Error, format, ##__VA_ARGS__)
+#define WARN(format, ...)       GB_LOG(LogLevel::Warn, Warn, format, ##__VA_ARGS__)
+#define INFO(format, ...)       GB_LOG(LogLevel::Info, Info, format, ##__VA_ARGS__)
+#define DEBUG(format, ...)      GB_LOG(LogLevel::Debug, Debug, format, ##__VA_ARGS__)
 
 #endif //GAMEBOY_EMULATOR_LOG_MIN_H
@@ -0,0 +1,140 @@
+/**
+  ******************************************************************************
+  * @file           : lz_codec.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/27
+  ******************************************************************************
+  */
+
+
+
+#include "lz_codec.h"
+
+#include <cstring>
+
+constexpr u32 LZ_MIN_MATCH = 4;
+constexpr u32 LZ_HASH_BITS = 12;
+// The last bytes of a block are always emitted as literals.
+constexpr u32 LZ_LAST_LITERALS = 5;
+constexpr u32 LZ_MAX_OFFSET = 0xFFFF;
+
+inline u32 Read32(const u8* p) {
+    u32 v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline u32 HashSequence(u32 seq) {
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the remaining part of a length whose nibble was saturated (15).
+inline bool WriteLengthExtension(u32 len, u8*& op, const u8* opEnd) {
+    while(len >= 255) {
+        if(op >= opEnd) return false;
+        *op++ = 255;
+        len -= 255;
+    }
+    if(op >= opEnd) return false;
+    *op++ = (u8)len;
+    return true;
+}
+
+inline bool ReadLengthExtension(u32& len, const u8*& ip, const u8* ipEnd) {
+    u8 b;
+    do {
+        if(ip >= ipEnd) return false;
+        b = *ip++;
+        len += b;
+    } while(b == 255);
+    return true;
+}
+
+// emits literals [lit, lit + litLen) followed by a match, or the final literals if matchLen is 0.
+static bool EmitSequence(const u8* lit, u32 litLen, u32 offset, u32 matchLen, u8*& op, const u8* opEnd) {
+    if(op >= opEnd) return false;
+    u8* token = op++;
+    u32 matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    *token = (u8)(((litLen >= 15 ? 15 : litLen) << 4) | (matchCode >= 15 ? 15 : matchCode));
+    if(litLen >= 15 && !WriteLengthExtension(litLen - 15, op, opEnd)) return false;
+    if((u32)(opEnd - op) < litLen) return false;
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if(!matchLen) return true;
+    if(opEnd - op < 2) return false;
+    *op++ = (u8)(offset & 0xFF);
+    *op++ = (u8)(offset >> 8);
+    if(matchCode >= 15 && !WriteLengthExtension(matchCode - 15, op, opEnd)) return false;
+    return true;
+}
+
+u32 LZCompress(const u8 *src, u32 srcSize, u8 *dst, u32 dstCapacity) {
+    // Positions are stored plus one, so 0 means empty.
+    u32 table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    u8* op = dst;
+    const u8* opEnd = dst + dstCapacity;
+    u32 ip = 0;
+    u32 anchor = 0;
+    if(srcSize > LZ_LAST_LITERALS + LZ_MIN_MATCH) {
+        u32 limit = srcSize - LZ_LAST_LITERALS;
+        while(ip + LZ_MIN_MATCH <= limit) {
+            u32 seq = Read32(src + ip);
+            u32 h = HashSequence(seq);
+            u32 ref = table[h];
+            table[h] = ip + 1;
+            if(ref && ip - (ref - 1) <= LZ_MAX_OFFSET && Read32(src + ref - 1) == seq) {
+                u32 match = ref - 1;
+                u32 len = LZ_MIN_MATCH;
+                while(ip + len < limit && src[match + len] == src[ip + len]) {
+                    ++len;
+                }
+                if(!EmitSequence(src + anchor, ip - anchor, ip - match, len, op, opEnd)) return 0;
+                ip += len;
+                anchor = ip;
+            }
+            else {
+                ++ip;
+            }
+        }
+    }
+    if(!EmitSequence(src + anchor, srcSize - anchor, 0, 0, op, opEnd)) return 0;
+    return (u32)(op - dst);
+}
+
+u32 LZDecompress(const u8 *src, u32 srcSize, u8 *dst, u32 dstCapacity) {
+    const u8* ip = src;
+    const u8* ipEnd = src + srcSize;
+    u8* op = dst;
+    u8* opEnd = dst + dstCapacity;
+    while(ip < ipEnd) {
+        u8 token = *ip++;
+        u32 litLen = token >> 4;
+        if(litLen == 15 && !ReadLengthExtension(litLen, ip, ipEnd)) return 0;
+        if((u32)(ipEnd - ip) < litLen || (u32)(opEnd - op) < litLen) return 0;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if(ip == ipEnd) {
+            // The final sequence has no match.
+            break;
+        }
+        if(ipEnd - ip < 2) return 0;
+        u32 offset = (u32)ip[0] | ((u32)ip[1] << 8);
+        ip += 2;
+        u32 matchLen = token & 0x0F;
+        if(matchLen == 15 && !ReadLengthExtension(matchLen, ip, ipEnd)) return 0;
+        matchLen += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (u32)(op - dst) || (u32)(opEnd - op) < matchLen) return 0;
+        // The match may overlap the output, copy byte by byte.
+        const u8* match = op - offset;
+        for(u32 i = 0; i < matchLen; ++i) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+    return (u32)(op - dst);
+}
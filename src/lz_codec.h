@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file           : lz_codec.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/27
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_LZ_CODEC_H
+#define GAMEBOY_EMULATOR_LZ_CODEC_H
+
+#include "type.h"
+
+// A small LZ77 block codec in the spirit of LZ4: byte-aligned sequences of
+// (token, literals, 16-bit offset, match length), no entropy coding.
+// Every block is independent.
+
+// the worst-case compressed size of srcSize bytes
+inline u32 LZCompressBound(u32 srcSize) {
+    return srcSize + srcSize / 255 + 16;
+}
+
+// compresses src into dst, returns the compressed size, or 0 if dstCapacity is too small
+u32 LZCompress(const u8* src, u32 srcSize, u8* dst, u32 dstCapacity);
+
+// decompresses src into dst, returns the decompressed size, or 0 if the data is malformed
+// or does not fit in dstCapacity
+u32 LZDecompress(const u8* src, u32 srcSize, u8* dst, u32 dstCapacity);
+
+
+#endif //GAMEBOY_EMULATOR_LZ_CODEC_H
@@ -0,0 +1,188 @@
+/**
+  ******************************************************************************
+  * @file           : movie.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "movie.h"
+#include "emulator.h"
+#include "log-min.h"
+#include "save_state.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static const c8 MOVIE_MAGIC[8] = {'G', 'B', 'M', 'O', 'V', 'I', 'E', '\0'};
+constexpr u64 MOVIE_HEADER_SIZE = 8 + 4 + 4 + 8 + 8 + 8;
+constexpr u64 MOVIE_EVENT_SIZE = 9;
+
+u64 MovieRomHash(const Emulator *emu) {
+    u64 hash = 14695981039346656037ULL;
+    for(u64 i = 0; i < emu->romDataSize; ++i) {
+        hash = (hash ^ emu->romData[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool Movie::Save(const char *path) const {
+    u64 size = MOVIE_HEADER_SIZE + initialState.size() + 4 + events.size() * MOVIE_EVENT_SIZE;
+    std::vector<u8> data(size);
+    StateWriter writer(data.data(), data.size());
+    writer.WriteBytes(MOVIE_MAGIC, sizeof(MOVIE_MAGIC));
+    writer.WriteU32(MOVIE_VERSION);
+    writer.WriteU32(0);
+    writer.WriteU64(romHash);
+    writer.WriteU64(length);
+    writer.WriteU64(initialState.size());
+    writer.WriteBytes(initialState.data(), initialState.size());
+    writer.WriteU32((u32)events.size());
+    for(const MovieEvent& event : events) {
+        writer.WriteU64(event.cycles);
+        writer.WriteU8(event.buttons);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        ERROR("failed to open movie file: %s", path);
+        return false;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    if(!written) {
+        ERROR("failed to write movie file: %s", path);
+    }
+    return written;
+}
+
+bool Movie::Load(const char *path) {
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        ERROR("failed to open movie file: %s", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<u8> data(fileSize > 0 ? (u64)fileSize : 0);
+    bool read = fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+
+    StateReader reader(data.data(), read ? data.size() : 0);
+    c8 magic[8];
+    reader.ReadBytes(magic, sizeof(magic));
+    if(reader.Failed() || memcmp(magic, MOVIE_MAGIC, sizeof(magic)) != 0) {
+        ERROR("invalid movie file: %s", path);
+        return false;
+    }
+    u32 version = reader.ReadU32();
+    if(version > MOVIE_VERSION) {
+        ERROR("unsupported movie version: %u", version);
+        return false;
+    }
+    reader.ReadU32();
+    romHash = reader.ReadU64();
+    length = reader.ReadU64();
+    u64 stateSize = reader.ReadU64();
+    if(stateSize > data.size()) {
+        ERROR("the movie is truncated: %s", path);
+        return false;
+    }
+    initialState.resize(stateSize);
+    reader.ReadBytes(initialState.data(), stateSize);
+    u32 count = reader.ReadU32();
+    if(count > data.size() / MOVIE_EVENT_SIZE) {
+        ERROR("the movie is truncated: %s", path);
+        return false;
+    }
+    events.resize(count);
+    for(MovieEvent& event : events) {
+        event.cycles = reader.ReadU64();
+        event.buttons = reader.ReadU8();
+    }
+    if(reader.Failed()) {
+        ERROR("the movie is truncated: %s", path);
+        return false;
+    }
+    return true;
+}
+
+u32 Movie::Frames() const {
+    return (u32)(length / Emulator::GB_CLOCK_CYCLES_PER_FRAME);
+}
+
+void MovieRecorder::Start(Emulator *emu) {
+    movie.romHash = MovieRomHash(emu);
+    movie.length = 0;
+    movie.initialState.resize(emu->GetStateSize());
+    emu->SaveState(movie.initialState.data(), movie.initialState.size());
+    // The first event holds the buttons of the initial state, the changes are recorded against it.
+    movie.events.clear();
+    movie.events.push_back({0, emu->joypad.get_buttons()});
+    startCycles = emu->clockCycles;
+    isRecording = true;
+}
+
+void MovieRecorder::SetButtons(Emulator *emu, u8 buttons) {
+    if(!isRecording) return;
+    if(emu->clockCycles < startCycles) {
+        // Rewound past the start, the movie starts over from here.
+        Start(emu);
+    }
+    u64 now = emu->clockCycles - startCycles;
+    while(movie.events.size() > 1 && movie.events.back().cycles > now) {
+        movie.events.pop_back();
+    }
+    if(movie.events.back().buttons != buttons) {
+        movie.events.push_back({now, buttons});
+    }
+}
+
+const Movie& MovieRecorder::Stop(Emulator *emu) {
+    movie.length = emu->clockCycles >= startCycles ? emu->clockCycles - startCycles : 0;
+    isRecording = false;
+    return movie;
+}
+
+bool MoviePlayer::Start(Emulator *emu, const Movie *movie) {
+    this->movie = nullptr;
+    if(movie->romHash != MovieRomHash(emu)) {
+        ERROR("the movie belongs to another ROM.");
+        return false;
+    }
+    if(!emu->LoadState(movie->initialState.data(), movie->initialState.size())) {
+        return false;
+    }
+    this->movie = movie;
+    startCycles = emu->clockCycles;
+    position = 0;
+    nextEvent = 0;
+    return true;
+}
+
+bool MoviePlayer::Run(Emulator *emu, u64 cycles) {
+    if(IsFinished()) return false;
+    u64 end = std::min(position + cycles, movie->length);
+    while(true) {
+        position = emu->clockCycles - startCycles;
+        // The recording applied the input at an instruction boundary, which playback stops at
+        // exactly since it executes the same instructions.
+        while(nextEvent < movie->events.size() && movie->events[nextEvent].cycles <= position) {
+            emu->joypad.set_buttons(emu, movie->events[nextEvent].buttons);
+            ++nextEvent;
+        }
+        u64 target = end;
+        if(nextEvent < movie->events.size()) {
+            target = std::min(target, movie->events[nextEvent].cycles);
+        }
+        if(position >= target) break;
+        emu->RunUntil(startCycles + target);
+    }
+    return !IsFinished();
+}
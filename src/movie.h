@@ -0,0 +1,99 @@
+/**
+  ******************************************************************************
+  * @file           : movie.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_MOVIE_H
+#define GAMEBOY_EMULATOR_MOVIE_H
+
+#include "type.h"
+
+#include <vector>
+
+class Emulator;
+
+// Movie file layout (all integers little endian):
+//   header : "GBMOVIE\0", u32 version, u32 reserved, u64 ROM hash, u64 length in clock cycles,
+//            u64 state size, the save state the movie starts from
+//   events : u32 event count, per event u64 clock cycles since the start and u8 buttons
+
+constexpr u32 MOVIE_VERSION = 1;
+
+//! The buttons (see Joypad::get_buttons()) pressed from the clock cycle on.
+struct MovieEvent {
+    //! The clock cycles since the start of the movie.
+    u64 cycles;
+    u8 buttons;
+};
+
+//! A recorded play session: the state it starts from and every change of the joypad input,
+//! stamped with the clock cycle the emulator applied it at.
+//! The emulation is deterministic, so replaying the input at the same cycles reproduces the
+//! session exactly, no matter how the recording host split it into updates. Only the real time
+//! clock of MBC3 cartridges follows the host clock and is not reproduced.
+class Movie {
+public:
+    u64 romHash = 0;
+    u64 length = 0;
+    std::vector<u8> initialState;
+    std::vector<MovieEvent> events;
+
+    bool Save(const char* path) const;
+    bool Load(const char* path);
+
+    u32 Frames() const;
+};
+
+// the hash identifying the ROM a movie belongs to (FNV-1a over the whole ROM).
+u64 MovieRomHash(const Emulator* emu);
+
+//! Records the input of the emulator into a Movie.
+class MovieRecorder {
+public:
+    // saves the current state as the start of the movie.
+    void Start(Emulator* emu);
+    bool IsRecording() const { return isRecording; }
+
+    // called with the buttons set before every emulator update, records changes.
+    // If the emulator was rewound, the events after the current clock are discarded, the
+    // recording continues from there.
+    void SetButtons(Emulator* emu, u8 buttons);
+
+    // ends the movie at the current clock and returns it.
+    const Movie& Stop(Emulator* emu);
+
+private:
+    Movie movie;
+    u64 startCycles = 0;
+    bool isRecording = false;
+};
+
+//! Replays a Movie as fast as possible.
+class MoviePlayer {
+public:
+    // loads the initial state of movie (which must outlive the playback), returns false if
+    // the movie belongs to another ROM or its state does not load.
+    bool Start(Emulator* emu, const Movie* movie);
+
+    // runs the emulator for the given clock cycles or up to the end of the movie, applying the
+    // input at the recorded cycles. Returns false once the movie has ended.
+    bool Run(Emulator* emu, u64 cycles);
+    bool IsFinished() const { return !movie || position >= movie->length; }
+
+private:
+    const Movie* movie = nullptr;
+    u64 startCycles = 0;
+    //! The clock cycles played since the start.
+    u64 position = 0;
+    u32 nextEvent = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_MOVIE_H
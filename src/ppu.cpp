@@ -12,8 +12,11 @@
 
 #include "ppu.h"
 #include "emulator.h"
+#include "save_state.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 inline u8 apply_palette(u8 color, u8 palette)
 {
@@ -51,6 +54,67 @@ void PPU::increase_ly(Emulator* emu)
     }
 }
 
+u32 get_frame_size(PPUFrameFormat format)
+{
+    switch(format)
+    {
+        case PPUFrameFormat::RGBA: return PPU_XRES * PPU_YRES * 4;
+        case PPUFrameFormat::SHADE_INDEX: return PPU_XRES * PPU_YRES;
+        case PPUFrameFormat::SHADE_PACKED: return PPU_XRES * PPU_YRES / 4;
+    }
+    return 0;
+}
+
+//! The RGBA colors of the 4 pixels of every packed byte.
+struct PackedShadeTable
+{
+    u8 colors[256][16];
+
+    PackedShadeTable()
+    {
+        for(u32 v = 0; v < 256; ++v)
+        {
+            for(u32 p = 0; p < 4; ++p)
+            {
+                memcpy(colors[v] + p * 4, PPU_SHADE_COLORS[(v >> (p * 2)) & 3], 4);
+            }
+        }
+    }
+};
+
+void expand_frame_to_rgba(const u8* src, PPUFrameFormat format, u8* dst)
+{
+    constexpr u32 num_pixels = PPU_XRES * PPU_YRES;
+    switch(format)
+    {
+        case PPUFrameFormat::RGBA:
+            memcpy(dst, src, num_pixels * 4);
+            break;
+        case PPUFrameFormat::SHADE_INDEX:
+            for(u32 i = 0; i < num_pixels; ++i)
+            {
+                memcpy(dst + i * 4, PPU_SHADE_COLORS[src[i] & 3], 4);
+            }
+            break;
+        case PPUFrameFormat::SHADE_PACKED:
+        {
+            // One table lookup expands 4 pixels at once.
+            static const PackedShadeTable table;
+            for(u32 i = 0; i < num_pixels / 4; ++i)
+            {
+                memcpy(dst + i * 16, table.colors[src[i]], 16);
+            }
+            break;
+        }
+    }
+}
+
+void PPU::set_frame_format(PPUFrameFormat format)
+{
+    frame_format = format;
+    frames.Init(get_frame_size(format));
+}
+
 void PPU::init()
 {
     lcdc = 0x91;
@@ -71,8 +135,22 @@ void PPU::init()
     dma_offset = 0;
     dma_start_delay = 0;
     line_cycles = 0;
-    memset(pixels, 0, sizeof(pixels));
-    current_back_buffer = 0;
+
+    // The fetcher state is set up before it is used, but is part of the save state.
+    fetch_window = false;
+    window_line = 0;
+    fetch_state = PPUFetchState::TILE;
+    fetch_x = 0;
+    bgw_data_addr_offset = 0;
+    tile_x_begin = 0;
+    memset(bgw_fetched_data, 0, sizeof(bgw_fetched_data));
+    push_x = 0;
+    draw_x = 0;
+    memset(fetched_sprites, 0, sizeof(fetched_sprites));
+    num_fetched_sprites = 0;
+    memset(sprite_fetched_data, 0, sizeof(sprite_fetched_data));
+    frames.Init(get_frame_size(frame_format));
+    frame_count = 0;
 }
 
 void PPU::tick(Emulator* emu)
@@ -132,9 +210,35 @@ void PPU::bus_write(u16 addr, u8 data)
     ((u8*)(&lcdc))[addr - 0xFF40] = data;
 }
 
+u32 PPU::quiet_cycles() const
+{
+    if(dma_active) return 0;
+    if(!enabled()) return UINT32_MAX;
+    switch(get_mode())
+    {
+        case PPUMode::OAM_SCAN:
+            // The scan runs at line cycle 1, drawing starts at line cycle 80.
+            return line_cycles == 0 ? 0 : 79 - std::min<u32>(line_cycles, 79);
+        case PPUMode::H_BLANK:
+        case PPUMode::V_BLANK:
+            return PPU_CYCLES_PER_LINE - 1 - std::min<u32>(line_cycles, PPU_CYCLES_PER_LINE - 1);
+        default:
+            return 0;
+    }
+}
+
+void PPU::skip_cycles(u32 cycles)
+{
+    if(enabled())
+    {
+        line_cycles += cycles;
+    }
+}
+
 void PPU::tick_dma(Emulator* emu)
 {
     if(!dma_active) return;
+    GB_PROFILE_SCOPE(emu, ProfileSection::Dma);
     if(dma_start_delay)
     {
         --dma_start_delay;
@@ -161,12 +265,12 @@ void PPU::tick_oam_scan(Emulator* emu)
     if(line_cycles == 1)
     {
         sprites.clear();
-        sprites.reserve(10);
+        sprites.reserve(PPU_MAX_SPRITES_PER_LINE);
         u8 sprite_height = obj_height();
         // Scan all 40 entries.
         for(u8 i = 0; i < 40; ++i)
         {
-            if(sprites.size() >= 10)
+            if(sprites.size() >= PPU_MAX_SPRITES_PER_LINE)
             {
                 // We can hold at most 10 sprites per line.
                 break;
@@ -239,7 +343,12 @@ void PPU::tick_hblank(Emulator* emu)
             {
                 emu->intFlags |= INT_LCD_STAT;
             }
-            current_back_buffer = (current_back_buffer + 1) % 2;
+            ++frame_count;
+            if(frame_hook)
+            {
+                frame_hook->OnFrame(frames.BackBuffer(), frame_format, frame_count);
+            }
+            frames.Publish(frame_count);
         }
         else
         {
@@ -349,12 +458,14 @@ void PPU::lcd_draw_pixel()
         // Selects the final color.
         u8 color = draw_obj ? obj_color : bg_color;
         // Output pixel.
-        switch(color)
+        if(frame_format == PPUFrameFormat::RGBA)
+        {
+            const u8* rgba = PPU_SHADE_COLORS[color];
+            set_pixel(draw_x, ly, rgba[0], rgba[1], rgba[2], rgba[3]);
+        }
+        else
         {
-            case 0: set_pixel(draw_x, ly, 153, 161, 120, 255); break;
-            case 1: set_pixel(draw_x, ly, 87, 93, 67, 255); break;
-            case 2: set_pixel(draw_x, ly, 42, 46, 32, 255); break;
-            case 3: set_pixel(draw_x, ly, 10, 10, 2, 255); break;
+            set_shade(draw_x, ly, color);
         }
         ++draw_x;
     }
@@ -539,4 +650,144 @@ void PPU::fetcher_push_sprite_pixels(u8 push_begin, u8 push_end)
         }
         obj_queue.push(pixel);
     }
-}
\ No newline at end of file
+}
+
+// std::queue hides its container, this gives read access to it without copying the queue.
+template<typename Q>
+inline const typename Q::container_type& queue_container(const Q& q)
+{
+    struct access : Q
+    {
+        static const typename Q::container_type& get(const Q& q) { return q.*(&access::c); }
+    };
+    return access::get(q);
+}
+
+inline void write_oam_entry(StateWriter& writer, const OAMEntry& entry)
+{
+    writer.WriteU8(entry.y);
+    writer.WriteU8(entry.x);
+    writer.WriteU8(entry.tile);
+    writer.WriteU8(entry.flags);
+}
+
+inline OAMEntry read_oam_entry(StateReader& reader)
+{
+    OAMEntry entry;
+    entry.y = reader.ReadU8();
+    entry.x = reader.ReadU8();
+    entry.tile = reader.ReadU8();
+    entry.flags = reader.ReadU8();
+    return entry;
+}
+
+void PPU::save_state(StateWriter& writer) const
+{
+    // 0xFF40 ~ 0xFF4B.
+    writer.WriteBytes(&lcdc, 12);
+
+    writer.WriteBool(dma_active);
+    writer.WriteU8(dma_offset);
+    writer.WriteU8(dma_start_delay);
+    writer.WriteU32(line_cycles);
+
+    const auto& bgw_pixels = queue_container(bgw_queue);
+    assert(bgw_pixels.size() <= PPU_FIFO_STATE_SLOTS);
+    writer.WriteU8((u8)bgw_pixels.size());
+    for(u32 i = 0; i < PPU_FIFO_STATE_SLOTS; ++i)
+    {
+        bool used = i < bgw_pixels.size();
+        writer.WriteU8(used ? bgw_pixels[i].color : 0);
+        writer.WriteU8(used ? bgw_pixels[i].palette : 0);
+    }
+    writer.WriteBool(fetch_window);
+    writer.WriteU8(window_line);
+    writer.WriteU8((u8)fetch_state);
+    writer.WriteU8(fetch_x);
+    writer.WriteU16(bgw_data_addr_offset);
+    writer.WriteU16((u16)tile_x_begin);
+    writer.WriteU8(bgw_fetched_data[0]);
+    writer.WriteU8(bgw_fetched_data[1]);
+    writer.WriteU8(push_x);
+    writer.WriteU8(draw_x);
+
+    const auto& obj_pixels = queue_container(obj_queue);
+    assert(obj_pixels.size() <= PPU_FIFO_STATE_SLOTS);
+    writer.WriteU8((u8)obj_pixels.size());
+    for(u32 i = 0; i < PPU_FIFO_STATE_SLOTS; ++i)
+    {
+        bool used = i < obj_pixels.size();
+        writer.WriteU8(used ? obj_pixels[i].color : 0);
+        writer.WriteU8(used ? obj_pixels[i].palette : 0);
+        writer.WriteBool(used ? obj_pixels[i].bg_priority : false);
+    }
+    writer.WriteU8((u8)sprites.size());
+    OAMEntry empty = {0, 0, 0, 0};
+    for(u32 i = 0; i < PPU_MAX_SPRITES_PER_LINE; ++i)
+    {
+        write_oam_entry(writer, i < sprites.size() ? sprites[i] : empty);
+    }
+    for(u32 i = 0; i < 3; ++i)
+    {
+        write_oam_entry(writer, fetched_sprites[i]);
+    }
+    writer.WriteU8(num_fetched_sprites);
+    writer.WriteBytes(sprite_fetched_data, sizeof(sprite_fetched_data));
+    // Reserved, this was the index of the back frame buffer.
+    writer.WriteU8(0);
+}
+
+void PPU::load_state(StateReader& reader)
+{
+    reader.ReadBytes(&lcdc, 12);
+
+    dma_active = reader.ReadBool();
+    dma_offset = reader.ReadU8();
+    dma_start_delay = reader.ReadU8();
+    line_cycles = reader.ReadU32();
+
+    while(!bgw_queue.empty()) bgw_queue.pop();
+    u8 num_bgw_pixels = reader.ReadU8();
+    for(u32 i = 0; i < PPU_FIFO_STATE_SLOTS; ++i)
+    {
+        BGWPixel pixel;
+        pixel.color = reader.ReadU8();
+        pixel.palette = reader.ReadU8();
+        if(i < num_bgw_pixels) bgw_queue.push(pixel);
+    }
+    fetch_window = reader.ReadBool();
+    window_line = reader.ReadU8();
+    fetch_state = (PPUFetchState)reader.ReadU8();
+    fetch_x = reader.ReadU8();
+    bgw_data_addr_offset = reader.ReadU16();
+    tile_x_begin = (i16)reader.ReadU16();
+    bgw_fetched_data[0] = reader.ReadU8();
+    bgw_fetched_data[1] = reader.ReadU8();
+    push_x = reader.ReadU8();
+    draw_x = reader.ReadU8();
+
+    while(!obj_queue.empty()) obj_queue.pop();
+    u8 num_obj_pixels = reader.ReadU8();
+    for(u32 i = 0; i < PPU_FIFO_STATE_SLOTS; ++i)
+    {
+        ObjectPixel pixel;
+        pixel.color = reader.ReadU8();
+        pixel.palette = reader.ReadU8();
+        pixel.bg_priority = reader.ReadBool();
+        if(i < num_obj_pixels) obj_queue.push(pixel);
+    }
+    sprites.clear();
+    u8 num_sprites = reader.ReadU8();
+    for(u32 i = 0; i < PPU_MAX_SPRITES_PER_LINE; ++i)
+    {
+        OAMEntry entry = read_oam_entry(reader);
+        if(i < num_sprites) sprites.push_back(entry);
+    }
+    for(u32 i = 0; i < 3; ++i)
+    {
+        fetched_sprites[i] = read_oam_entry(reader);
+    }
+    num_fetched_sprites = reader.ReadU8();
+    reader.ReadBytes(sprite_fetched_data, sizeof(sprite_fetched_data));
+    reader.ReadU8();
+}
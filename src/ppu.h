@@ -15,8 +15,10 @@
 
 #include "type.h"
 #include "bit_oper.h"
+#include "frame_exchange.h"
 
 #include <queue>
+#include <cassert>
 #include <vector>
 
 enum class PPUMode : u8 {
@@ -26,6 +28,16 @@ enum class PPUMode : u8 {
     DRAWING = 3
 };
 
+//! The layout of the output frames.
+enum class PPUFrameFormat : u8 {
+    //! 4 bytes per pixel, ready to display.
+    RGBA = 0,
+    //! 1 byte per pixel holding the shade index 0~3.
+    SHADE_INDEX = 1,
+    //! 2 bits per pixel, 4 pixels per byte with the leftmost pixel in the lowest bits.
+    SHADE_PACKED = 2
+};
+
 enum class PPUFetchState : u8
 {
     TILE,
@@ -75,8 +87,37 @@ constexpr u32 PPU_LINES_PER_FRAME = 154;
 constexpr u32 PPU_CYCLES_PER_LINE = 456;
 constexpr u32 PPU_YRES = 144;
 constexpr u32 PPU_XRES = 160;
+//! The FIFOs never hold more than 16 pixels, states store them in fixed-size slots
+//! so that the state size does not depend on the FIFO fill level.
+constexpr u32 PPU_FIFO_STATE_SLOTS = 16;
+constexpr u32 PPU_MAX_SPRITES_PER_LINE = 10;
+
+//! The RGBA colors of the 4 shades.
+constexpr u8 PPU_SHADE_COLORS[4][4] = {
+    {153, 161, 120, 255},
+    {87, 93, 67, 255},
+    {42, 46, 32, 255},
+    {10, 10, 2, 255}
+};
+
+// the size of one output frame in bytes
+u32 get_frame_size(PPUFrameFormat format);
+// converts a frame of the given format to RGBA, dst holds PPU_XRES * PPU_YRES * 4 bytes
+void expand_frame_to_rgba(const u8* src, PPUFrameFormat format, u8* dst);
 
 class Emulator;
+class StateWriter;
+class StateReader;
+
+//! Receives every frame the PPU completes, called on the emulation thread.
+//! The hook is owned by the subscriber, the PPU only keeps a pointer to it.
+class PPUFrameHook {
+public:
+    virtual ~PPUFrameHook() = default;
+
+    // frame holds get_frame_size(format) bytes and is only valid during the call
+    virtual void OnFrame(const u8* frame, PPUFrameFormat format, u64 frameId) = 0;
+};
 
 inline void* pixel_offset(void* base, u32 x, u32 y, u32 bytes_per_pixel, u32 row_pitch)
 {
@@ -200,6 +241,10 @@ public:
 
     void init();
     void tick(Emulator* emu);
+    // the clock cycles tick() only counts line_cycles for, UINT32_MAX while the LCD is off.
+    u32 quiet_cycles() const;
+    // advances line_cycles by cycles, at most quiet_cycles().
+    void skip_cycles(u32 cycles);
     u8 bus_read(u16 addr);
     void bus_write(u16 addr, u8 data);
 
@@ -213,19 +258,44 @@ public:
     void fetcher_push_pixels();
     void lcd_draw_pixel();
 
-    u8 pixels[PPU_XRES * PPU_YRES * 4 * 2];
-    u8 current_back_buffer;
+    //! The output frames in frame_format, read them from other threads with frames.CopyLatest().
+    FrameExchange frames;
+    //! Kept across init, change it with set_frame_format().
+    PPUFrameFormat frame_format = PPUFrameFormat::RGBA;
+    // reallocates the output frames, takes effect from the next frame on
+    void set_frame_format(PPUFrameFormat format);
+    //! Called with every completed frame before it is published, null if unused.
+    PPUFrameHook* frame_hook = nullptr;
+    //! The number of frames completed since init, used by the host to pace per-frame work.
+    //! Not part of the save state.
+    u64 frame_count;
     void set_pixel(i32 x, i32 y, u8 r, u8 g, u8 b, u8 a)
     {
-        assert(x >= 0 || x < PPU_XRES);
-        assert(y >= 0 || y < PPU_YRES);
-        u8* dst = pixels + current_back_buffer * PPU_XRES * PPU_YRES * 4;
+        assert(x >= 0 && (u32)x < PPU_XRES);
+        assert(y >= 0 && (u32)y < PPU_YRES);
+        u8* dst = frames.BackBuffer();
         u8* pixel = (u8*)pixel_offset(dst, (u64)x, (u64)y, 4, 4 * PPU_XRES);
         pixel[0] = r;
         pixel[1] = g;
         pixel[2] = b;
         pixel[3] = a;
     }
+    void set_shade(i32 x, i32 y, u8 shade)
+    {
+        assert(x >= 0 && (u32)x < PPU_XRES);
+        assert(y >= 0 && (u32)y < PPU_YRES);
+        u8* dst = frames.BackBuffer();
+        u32 index = (u32)y * PPU_XRES + (u32)x;
+        if(frame_format == PPUFrameFormat::SHADE_INDEX)
+        {
+            dst[index] = shade;
+        }
+        else
+        {
+            u8 shift = (index & 3) * 2;
+            dst[index / 4] = (u8)((dst[index / 4] & ~(3 << shift)) | (shade << shift));
+        }
+    }
 
     void fetcher_get_background_tile(Emulator* emu);
     void fetcher_push_bgw_pixels();
@@ -236,6 +306,10 @@ public:
 
     void tick_dma(Emulator* emu);
 
+    //! The frame buffers are output only and not part of the state.
+    void save_state(StateWriter& writer) const;
+    void load_state(StateReader& reader);
+
     bool obj_enable() const { return bitTest(&lcdc, 1); }
     u8 obj_height() const
     {
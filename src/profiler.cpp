@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file           : profiler.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/3
+  ******************************************************************************
+  */
+
+
+
+#include "profiler.h"
+
+#include <cstring>
+
+static const c8* PROFILE_SECTION_NAMES[(u8)ProfileSection::Count] = {
+    "CPU dispatch",
+    "Bus ROM",
+    "Bus VRAM",
+    "Bus cartridge RAM",
+    "Bus WRAM",
+    "Bus OAM",
+    "Bus I/O",
+    "Bus HRAM",
+    "PPU OAM scan",
+    "PPU drawing",
+    "PPU h-blank",
+    "PPU v-blank",
+    "OAM DMA",
+    "Timer",
+    "Serial",
+    "APU",
+    "Outside the core",
+};
+
+const c8* GetProfileSectionName(ProfileSection section) {
+    return section < ProfileSection::Count ? PROFILE_SECTION_NAMES[(u8)section] : "";
+}
+
+ProfileSection ProfileBusSection(u16 addr) {
+    if(addr <= 0x7FFF) return ProfileSection::BusRom;
+    if(addr <= 0x9FFF) return ProfileSection::BusVram;
+    if(addr <= 0xBFFF) return ProfileSection::BusCartRam;
+    if(addr <= 0xFDFF) return ProfileSection::BusWram;
+    if(addr <= 0xFE9F) return ProfileSection::BusOam;
+    if(addr >= 0xFF80 && addr <= 0xFFFE) return ProfileSection::BusHram;
+    return ProfileSection::BusIo;
+}
+
+void Profiler::Reset() {
+    memset(ticks, 0, sizeof(ticks));
+    memset(calls, 0, sizeof(calls));
+    current = ProfileSection::Outside;
+    resetTime = std::chrono::steady_clock::now();
+    resetTimestamp = ProfilerTimestamp();
+    lastTimestamp = resetTimestamp;
+}
+
+u64 Profiler::TotalTicks() const {
+    u64 total = 0;
+    for(u64 t : ticks) {
+        total += t;
+    }
+    return total;
+}
+
+f64 Profiler::NsPerTick() const {
+#if GB_PROFILER_RDTSC
+    u64 elapsedTicks = ProfilerTimestamp() - resetTimestamp;
+    f64 elapsedNs = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - resetTime).count();
+    return elapsedTicks ? elapsedNs / (f64)elapsedTicks : 0.0;
+#else
+    return 1.0;
+#endif
+}
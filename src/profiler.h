@@ -0,0 +1,148 @@
+/**
+  ******************************************************************************
+  * @file           : profiler.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/3
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_PROFILER_H
+#define GAMEBOY_EMULATOR_PROFILER_H
+
+#include "type.h"
+
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define GB_PROFILER_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define GB_PROFILER_RDTSC 1
+#else
+#define GB_PROFILER_RDTSC 0
+#endif
+
+//! Set to 0 to compile the profiling probes out of the core entirely.
+#ifndef GB_ENABLE_PROFILER
+#define GB_ENABLE_PROFILER 1
+#endif
+
+//! The subsystems host time is attributed to.
+enum class ProfileSection : u8 {
+    //! Instruction fetch, decode and execution, interrupt dispatch and the tick loop.
+    CpuDispatch,
+    BusRom,
+    BusVram,
+    BusCartRam,
+    BusWram,
+    BusOam,
+    BusIo,
+    BusHram,
+    PpuOamScan,
+    PpuDrawing,
+    PpuHBlank,
+    PpuVBlank,
+    Dma,
+    Timer,
+    Serial,
+    Apu,
+    //! Time spent outside the core, e.g. drawing the GUI and waiting for the next frame.
+    Outside,
+    Count,
+};
+
+const c8* GetProfileSectionName(ProfileSection section);
+
+// the bus section an address belongs to
+ProfileSection ProfileBusSection(u16 addr);
+
+// host timestamp in profiler ticks, TSC ticks on x86 and nanoseconds elsewhere
+inline u64 ProfilerTimestamp() {
+#if GB_PROFILER_RDTSC
+    return __rdtsc();
+#else
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//! Flat profiler measuring the exclusive host time and the number of calls of every section.
+//! Sections nest: entering a section pauses the current one until the entered section is left,
+//! so every tick is attributed to exactly one section and the sections sum up to the wall time.
+//! Attach it with emu->profiler, the probes cost one pointer test when no profiler is attached.
+//! The probes themselves take a few ns each, so absolute numbers are inflated for the
+//! per-cycle sections (timer and PPU), compare the sections relative to each other.
+class Profiler {
+public:
+    Profiler() { Reset(); }
+
+    void Reset();
+
+    // switches to section and returns the section to pass to Leave()
+    ProfileSection Enter(ProfileSection section) {
+        u64 now = ProfilerTimestamp();
+        ticks[(u8)current] += now - lastTimestamp;
+        lastTimestamp = now;
+        ++calls[(u8)section];
+        ProfileSection previous = current;
+        current = section;
+        return previous;
+    }
+    // switches back to the section returned by Enter()
+    void Leave(ProfileSection previous) {
+        u64 now = ProfilerTimestamp();
+        ticks[(u8)current] += now - lastTimestamp;
+        lastTimestamp = now;
+        current = previous;
+    }
+
+    u64 Ticks(ProfileSection section) const { return ticks[(u8)section]; }
+    u64 Calls(ProfileSection section) const { return calls[(u8)section]; }
+    // the ticks of all sections, the host time since Reset() up to the last probe
+    u64 TotalTicks() const;
+    // nanoseconds per profiler tick, calibrated against the steady clock since Reset()
+    f64 NsPerTick() const;
+
+private:
+    u64 ticks[(u8)ProfileSection::Count];
+    u64 calls[(u8)ProfileSection::Count];
+    ProfileSection current;
+    u64 lastTimestamp;
+
+    u64 resetTimestamp;
+    std::chrono::steady_clock::time_point resetTime;
+};
+
+//! Enters a section for the lifetime of the scope, does nothing if profiler is null.
+class ProfileScope {
+public:
+    ProfileScope(Profiler* profiler, ProfileSection section) : profiler(profiler) {
+        if(profiler) previous = profiler->Enter(section);
+    }
+    ~ProfileScope() {
+        if(profiler) profiler->Leave(previous);
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler* profiler;
+    ProfileSection previous = ProfileSection::Outside;
+};
+
+// profiles the rest of the enclosing scope as section if a profiler is attached to emu,
+// section is only evaluated when profiling.
+#if GB_ENABLE_PROFILER
+#define GB_PROFILE_SCOPE(emu, section) \
+    ProfileScope profileScope((emu)->profiler, (emu)->profiler ? (section) : ProfileSection::Outside)
+#else
+#define GB_PROFILE_SCOPE(emu, section)
+#endif
+
+
+#endif //GAMEBOY_EMULATOR_PROFILER_H
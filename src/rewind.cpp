@@ -0,0 +1,182 @@
+/**
+  ******************************************************************************
+  * @file           : rewind.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/29
+  ******************************************************************************
+  */
+
+
+
+#include "rewind.h"
+#include "emulator.h"
+#include "log-min.h"
+
+#include <cstring>
+
+// A literal run ends at the first run of this many zero bytes.
+constexpr u64 REWIND_MIN_ZERO_RUN = 4;
+
+inline u8* PutVarint(u8* p, u64 v) {
+    while(v >= 0x80) {
+        *p++ = (u8)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (u8)v;
+    return p;
+}
+
+inline u64 GetVarint(const u8*& p) {
+    u64 v = 0;
+    for(u32 shift = 0; ; shift += 7) {
+        u8 b = *p++;
+        v |= (u64)(b & 0x7F) << shift;
+        if(!(b & 0x80)) return v;
+    }
+}
+
+// the worst-case encoded size of a delta between two states of the given size
+inline u64 DeltaBound(u64 size) {
+    return size + size / 2 + 32;
+}
+
+// encodes (a XOR b) as a sequence of (zero run, literal run, literal bytes), returns the encoded size.
+static u64 EncodeXorDelta(const u8* a, const u8* b, u64 size, u8* dst) {
+    u8* p = dst;
+    u64 i = 0;
+    while(i < size) {
+        u64 zeros = 0;
+        while(i + zeros < size && a[i + zeros] == b[i + zeros]) {
+            ++zeros;
+        }
+        u64 litBegin = i + zeros;
+        u64 litEnd = litBegin;
+        u64 zeroRun = 0;
+        while(litEnd + zeroRun < size && zeroRun < REWIND_MIN_ZERO_RUN) {
+            if(a[litEnd + zeroRun] == b[litEnd + zeroRun]) {
+                ++zeroRun;
+            }
+            else {
+                litEnd += zeroRun + 1;
+                zeroRun = 0;
+            }
+        }
+        p = PutVarint(p, zeros);
+        p = PutVarint(p, litEnd - litBegin);
+        for(u64 j = litBegin; j < litEnd; ++j) {
+            *p++ = a[j] ^ b[j];
+        }
+        i = litEnd;
+    }
+    return (u64)(p - dst);
+}
+
+static void ApplyXorDelta(u8* state, const u8* delta, u64 deltaSize) {
+    const u8* p = delta;
+    const u8* end = delta + deltaSize;
+    u8* dst = state;
+    while(p < end) {
+        dst += GetVarint(p);
+        u64 literals = GetVarint(p);
+        for(u64 j = 0; j < literals; ++j) {
+            dst[j] ^= p[j];
+        }
+        dst += literals;
+        p += literals;
+    }
+}
+
+void RewindBuffer::Init(u64 stateSize, u64 memoryBudget, u32 framesPerSnapshot) {
+    this->stateSize = stateSize;
+    this->framesPerSnapshot = framesPerSnapshot ? framesPerSnapshot : 1;
+    current.resize(stateSize);
+    scratch.resize(stateSize);
+    delta.resize(DeltaBound(stateSize));
+    u64 fixedSize = current.size() + scratch.size() + delta.size();
+    storage.resize(memoryBudget > fixedSize ? memoryBudget - fixedSize : 0);
+    Clear();
+}
+
+void RewindBuffer::Clear() {
+    hasCurrent = false;
+    entries.clear();
+    head = 0;
+    usedBytes = 0;
+}
+
+// The frames of emulated time, these keep advancing while the LCD is off, unlike the PPU frames.
+static u64 EmulatedFrame(const Emulator* emu) {
+    return emu->clockCycles / Emulator::GB_CLOCK_CYCLES_PER_FRAME;
+}
+
+void RewindBuffer::Update(Emulator *emu) {
+    u64 frame = EmulatedFrame(emu);
+    if(frame - lastCaptureFrame >= framesPerSnapshot) {
+        Capture(emu);
+    }
+}
+
+void RewindBuffer::Capture(Emulator *emu) {
+    lastCaptureFrame = EmulatedFrame(emu);
+    if(!emu->SaveState(scratch.data(), scratch.size())) {
+        ERROR("rewind buffer does not match the emulator state size.");
+        return;
+    }
+    if(hasCurrent) {
+        // Store the delta that turns the new snapshot back into the previous one.
+        u64 size = EncodeXorDelta(current.data(), scratch.data(), stateSize, delta.data());
+        u8* dst = Allocate(size);
+        if(dst) {
+            memcpy(dst, delta.data(), size);
+        }
+    }
+    current.swap(scratch);
+    hasCurrent = true;
+}
+
+bool RewindBuffer::Rewind(Emulator *emu) {
+    if(!hasCurrent) return false;
+    emu->LoadState(current.data(), current.size());
+    lastCaptureFrame = EmulatedFrame(emu);
+    if(entries.empty()) {
+        hasCurrent = false;
+        return true;
+    }
+    Entry newest = entries.back();
+    entries.pop_back();
+    ApplyXorDelta(current.data(), storage.data() + newest.offset, newest.size);
+    head = newest.offset;
+    usedBytes -= newest.size;
+    return true;
+}
+
+u8 *RewindBuffer::Allocate(u64 size) {
+    if(size > storage.size()) {
+        // The chain is broken, older snapshots can no longer be reached.
+        entries.clear();
+        head = 0;
+        usedBytes = 0;
+        return nullptr;
+    }
+    if(head + size > storage.size()) {
+        // Wrap around, everything stored past head is older than the entries before it.
+        while(!entries.empty() && entries.front().offset >= head) {
+            usedBytes -= entries.front().size;
+            entries.pop_front();
+        }
+        head = 0;
+    }
+    while(!entries.empty() && entries.front().offset >= head && entries.front().offset < head + size) {
+        usedBytes -= entries.front().size;
+        entries.pop_front();
+    }
+    Entry entry;
+    entry.offset = head;
+    entry.size = size;
+    entries.push_back(entry);
+    head += size;
+    usedBytes += size;
+    return storage.data() + entry.offset;
+}
@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file           : rewind.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/29
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_REWIND_H
+#define GAMEBOY_EMULATOR_REWIND_H
+
+#include "type.h"
+
+#include <deque>
+#include <vector>
+
+class Emulator;
+
+//! Keeps a history of save states for rewinding.
+//! The latest snapshot is kept in full, older ones are stored as XOR deltas against the
+//! snapshot that follows them, with runs of zero bytes (unchanged memory) run-length encoded.
+//! Deltas live in a byte ring buffer, the oldest ones are dropped when it is full, so the
+//! history length is bounded by memory rather than by a frame count.
+class RewindBuffer {
+public:
+    // memoryBudget covers the delta ring buffer plus the full state buffers.
+    void Init(u64 stateSize, u64 memoryBudget, u32 framesPerSnapshot);
+    void Clear();
+
+    // captures a snapshot if framesPerSnapshot frames of emulated time passed since the last one,
+    // the LCD being on or off
+    void Update(Emulator* emu);
+    void Capture(Emulator* emu);
+    // restores the latest snapshot and removes it from the history, returns false if empty
+    bool Rewind(Emulator* emu);
+
+    u32 SnapshotCount() const { return hasCurrent ? (u32)entries.size() + 1 : 0; }
+    u64 DeltaBytesUsed() const { return usedBytes; }
+    u64 DeltaCapacity() const { return storage.size(); }
+
+private:
+    struct Entry {
+        u64 offset;
+        u64 size;
+    };
+
+    // reserves space for a delta of the given size, dropping the oldest deltas if needed
+    u8* Allocate(u64 size);
+
+    u64 stateSize = 0;
+    u32 framesPerSnapshot = 1;
+    u64 lastCaptureFrame = 0;
+
+    std::vector<u8> current;
+    bool hasCurrent = false;
+    std::vector<u8> scratch;
+    std::vector<u8> delta;
+
+    std::vector<u8> storage;
+    // Oldest first.
+    std::deque<Entry> entries;
+    u64 head = 0;
+    u64 usedBytes = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_REWIND_H
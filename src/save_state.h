@@ -0,0 +1,135 @@
+/**
+  ******************************************************************************
+  * @file           : save_state.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/28
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_SAVE_STATE_H
+#define GAMEBOY_EMULATOR_SAVE_STATE_H
+
+#include "type.h"
+
+#include <cstring>
+
+//! "GBSS" in little endian.
+constexpr u32 SAVE_STATE_MAGIC = 0x53534247;
+//! Increase this whenever the layout changes, LoadState rejects newer versions.
+//! 2: the APU state.
+constexpr u32 SAVE_STATE_VERSION = 2;
+
+//! Serializes values in little endian into a caller-provided buffer.
+//! Writing past the end sets overflow instead of writing, so callers can check once at the end.
+//! With a null buffer nothing is written and only the size is counted.
+class StateWriter {
+public:
+    StateWriter(void* buffer, u64 capacity) : data((u8*)buffer), capacity(capacity) {}
+
+    u64 Size() const { return offset; }
+    bool Overflow() const { return overflow; }
+
+    void WriteU8(u8 v) { u8* p = Reserve(1); if(p) p[0] = v; }
+    void WriteBool(bool v) { WriteU8(v ? 1 : 0); }
+    void WriteU16(u16 v) {
+        u8* p = Reserve(2);
+        if(p) { p[0] = (u8)v; p[1] = (u8)(v >> 8); }
+    }
+    void WriteU32(u32 v) {
+        u8* p = Reserve(4);
+        if(p) for(u32 i = 0; i < 4; ++i) p[i] = (u8)(v >> (i * 8));
+    }
+    void WriteU64(u64 v) {
+        u8* p = Reserve(8);
+        if(p) for(u32 i = 0; i < 8; ++i) p[i] = (u8)(v >> (i * 8));
+    }
+    void WriteF64(f64 v) {
+        u64 bits;
+        memcpy(&bits, &v, 8);
+        WriteU64(bits);
+    }
+    void WriteBytes(const void* src, u64 size) {
+        u8* p = Reserve(size);
+        if(p) memcpy(p, src, size);
+    }
+
+private:
+    u8* Reserve(u64 size) {
+        u64 begin = offset;
+        offset += size;
+        if(!data) return nullptr;
+        if(offset > capacity) {
+            overflow = true;
+            return nullptr;
+        }
+        return data + begin;
+    }
+
+    u8* data;
+    u64 capacity;
+    u64 offset = 0;
+    bool overflow = false;
+};
+
+//! Reads values written by StateWriter.
+//! Reading past the end returns zeros and sets failed.
+class StateReader {
+public:
+    StateReader(const void* buffer, u64 size) : data((const u8*)buffer), size(size) {}
+
+    u64 Offset() const { return offset; }
+    bool Failed() const { return failed; }
+
+    u8 ReadU8() { const u8* p = Consume(1); return p ? p[0] : 0; }
+    bool ReadBool() { return ReadU8() != 0; }
+    u16 ReadU16() {
+        const u8* p = Consume(2);
+        return p ? (u16)(p[0] | (p[1] << 8)) : 0;
+    }
+    u32 ReadU32() {
+        const u8* p = Consume(4);
+        u32 v = 0;
+        if(p) for(u32 i = 0; i < 4; ++i) v |= (u32)p[i] << (i * 8);
+        return v;
+    }
+    u64 ReadU64() {
+        const u8* p = Consume(8);
+        u64 v = 0;
+        if(p) for(u32 i = 0; i < 8; ++i) v |= (u64)p[i] << (i * 8);
+        return v;
+    }
+    f64 ReadF64() {
+        u64 bits = ReadU64();
+        f64 v;
+        memcpy(&v, &bits, 8);
+        return v;
+    }
+    void ReadBytes(void* dst, u64 count) {
+        const u8* p = Consume(count);
+        if(p) memcpy(dst, p, count);
+        else memset(dst, 0, count);
+    }
+
+private:
+    const u8* Consume(u64 count) {
+        if(failed || offset + count > size) {
+            failed = true;
+            return nullptr;
+        }
+        const u8* p = data + offset;
+        offset += count;
+        return p;
+    }
+
+    const u8* data;
+    u64 size;
+    u64 offset = 0;
+    bool failed = false;
+};
+
+
+#endif //GAMEBOY_EMULATOR_SAVE_STATE_H
@@ -12,6 +12,9 @@
 
 #include "serial.h"
 #include "emulator.h"
+#include "save_state.h"
+
+#include <cassert>
 
 void Serial::BeginTransfer() {
     transferring = true;
@@ -69,3 +72,50 @@ void Serial::BusWrite(u16 addr, u8 data) {
         return;
     }
 }
+
+void Serial::SaveState(StateWriter &writer) const {
+    writer.WriteU8(sb);
+    writer.WriteU8(sc);
+    writer.WriteBool(transferring);
+    writer.WriteU8(outByte);
+    writer.WriteU8((u8)transferBit);
+}
+
+void Serial::LoadState(StateReader &reader) {
+    sb = reader.ReadU8();
+    sc = reader.ReadU8();
+    transferring = reader.ReadBool();
+    outByte = reader.ReadU8();
+    transferBit = (i8)reader.ReadU8();
+}
+
+void SerialTestMonitor::Reset() {
+    output.clear();
+    result = SerialTestResult::Running;
+}
+
+static bool EndsWith(const std::string& text, const char* suffix, size_t suffixLength) {
+    return text.size() >= suffixLength && text.compare(text.size() - suffixLength, suffixLength, suffix) == 0;
+}
+
+SerialTestResult SerialTestMonitor::Feed(u8 c) {
+    output.push_back((char)c);
+    if(result == SerialTestResult::Running) {
+        // Only the tail can complete a marker, so every byte is checked in constant time.
+        if(EndsWith(output, "Passed", 6)) {
+            result = SerialTestResult::Passed;
+        }
+        else if(EndsWith(output, "Failed", 6)) {
+            result = SerialTestResult::Failed;
+        }
+    }
+    return result;
+}
+
+SerialTestResult SerialTestMonitor::Drain(Serial &serial) {
+    while(!serial.outputBuffer.empty()) {
+        Feed(serial.outputBuffer.front());
+        serial.outputBuffer.pop();
+    }
+    return result;
+}
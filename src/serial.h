@@ -17,8 +17,11 @@
 #include "bit_oper.h"
 
 #include <queue>
+#include <string>
 
 class Emulator;
+class StateWriter;
+class StateReader;
 
 class Serial {
 public:
@@ -53,11 +56,50 @@ public:
         sb = 0xFF;
         sc = 0x7C;
         transferring = false;
+        outByte = 0;
+        transferBit = 0;
     }
 
     void Tick(Emulator* emu);
+    // the clock cycles from clockCycles on that Tick() does nothing for, UINT32_MAX if idle.
+    u32 QuietCycles(u64 clockCycles) const {
+        if(!transferring && !(TransferEnable() && IsMaster())) return UINT32_MAX;
+        // Ticked every 512 cycles.
+        return 511 - (u32)(clockCycles % 512);
+    }
     u8 BusRead(u16 addr);
     void BusWrite(u16 addr, u8 data);
+
+    // outputBuffer is not part of the state, it is drained by the host.
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+};
+
+enum class SerialTestResult : u8 {
+    Running,
+    Passed,
+    Failed,
+};
+
+//! Detects the result of Blargg's test ROMs, which print their output to the serial port
+//! and end with a line starting with "Passed" or "Failed".
+//! The output is scanned as it arrives, so headless runs can stop as soon as a test finishes.
+class SerialTestMonitor {
+public:
+    void Reset();
+
+    // scans one output byte, returns the result once a marker has been seen
+    SerialTestResult Feed(u8 c);
+    // feeds everything in serial.outputBuffer, draining it
+    SerialTestResult Drain(Serial& serial);
+
+    SerialTestResult Result() const { return result; }
+    // the serial output scanned so far
+    const std::string& Output() const { return output; }
+
+private:
+    std::string output;
+    SerialTestResult result = SerialTestResult::Running;
 };
 
 
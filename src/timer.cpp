@@ -12,6 +12,9 @@
 
 #include "timer.h"
 #include "emulator.h"
+#include "save_state.h"
+
+#include <cassert>
 
 void Timer::Tick(Emulator *emu) {
     // increase DIV
@@ -46,6 +49,25 @@ void Timer::Tick(Emulator *emu) {
     }
 }
 
+u32 Timer::QuietCycles() const {
+    if(!IsTimaEnabled()) return UINT32_MAX;
+    u32 period = 2u << TimaBit();
+    // The cycles up to the next falling edge, then one period per increment up to 0xFF.
+    u32 first = period - (div & (period - 1));
+    return first + (0xFFu - tima) * period - 1;
+}
+
+void Timer::SkipCycles(u32 cycles) {
+    if(IsTimaEnabled()) {
+        u32 period = 2u << TimaBit();
+        u32 first = period - (div & (period - 1));
+        if(cycles >= first) {
+            tima += (u8)(1 + (cycles - first) / period);
+        }
+    }
+    div += (u16)cycles;
+}
+
 u8 Timer::BusRead(u16 addr) {
     assert(addr >= 0xFF04 && addr <= 0xFF07 && "timer register address illegal!");
     switch (addr) {
@@ -82,3 +104,17 @@ void Timer::BusWrite(u16 addr, u8 data) {
             return;
     }
 }
+
+void Timer::SaveState(StateWriter &writer) const {
+    writer.WriteU16(div);
+    writer.WriteU8(tima);
+    writer.WriteU8(tma);
+    writer.WriteU8(tac);
+}
+
+void Timer::LoadState(StateReader &reader) {
+    div = reader.ReadU16();
+    tima = reader.ReadU8();
+    tma = reader.ReadU8();
+    tac = reader.ReadU8();
+}
@@ -17,6 +17,8 @@
 #include "bit_oper.h"
 
 class Emulator;
+class StateWriter;
+class StateReader;
 
 class Timer {
 public:
@@ -42,6 +44,11 @@ public:
 
     u8 ClockSelect() const { return tac & 0x03; }
     bool IsTimaEnabled() const { return bitTest(&tac, 2); }
+    // TIMA increments when this bit of DIV falls.
+    u32 TimaBit() const {
+        static const u32 bits[4] = {9, 3, 5, 7};
+        return bits[ClockSelect()];
+    }
 
     void Init() {
         div = 0xAC00;
@@ -51,8 +58,15 @@ public:
     }
 
     void Tick(Emulator* emu);
+    // the clock cycles Tick() may be skipped for before TIMA overflows, UINT32_MAX if it is stopped.
+    u32 QuietCycles() const;
+    // advances DIV and TIMA by cycles, at most QuietCycles().
+    void SkipCycles(u32 cycles);
     u8 BusRead(u16 addr);
     void BusWrite(u16 addr, u8 data);
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 };
 
 
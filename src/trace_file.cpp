@@ -0,0 +1,361 @@
+/**
+  ******************************************************************************
+  * @file           : trace_file.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/27
+  ******************************************************************************
+  */
+
+
+
+#include "trace_file.h"
+#include "lz_codec.h"
+#include "log-min.h"
+
+#include <cstring>
+
+static const c8 TRACE_FILE_MAGIC[8] = {'G', 'B', 'T', 'R', 'A', 'C', 'E', '\0'};
+
+// The largest encoded record: cycles varint (10), register mask (1), registers (8),
+// flags (1), PC delta varint (3), SP (2), PCMEM (4).
+constexpr u32 TRACE_MAX_RECORD_SIZE = 32;
+
+// Delta record flags.
+constexpr u8 TRACE_RECORD_SP = 0x01;
+constexpr u8 TRACE_RECORD_PCMEM = 0x02;
+
+inline void PutU32(u8* p, u32 v) {
+    for(u32 i = 0; i < 4; ++i) p[i] = (u8)(v >> (i * 8));
+}
+
+inline void PutU64(u8* p, u64 v) {
+    for(u32 i = 0; i < 8; ++i) p[i] = (u8)(v >> (i * 8));
+}
+
+inline u32 GetU32(const u8* p) {
+    u32 v = 0;
+    for(u32 i = 0; i < 4; ++i) v |= (u32)p[i] << (i * 8);
+    return v;
+}
+
+inline u64 GetU64(const u8* p) {
+    u64 v = 0;
+    for(u32 i = 0; i < 8; ++i) v |= (u64)p[i] << (i * 8);
+    return v;
+}
+
+inline u8* PutVarint(u8* p, u64 v) {
+    while(v >= 0x80) {
+        *p++ = (u8)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (u8)v;
+    return p;
+}
+
+inline bool GetVarint(const u8*& p, const u8* end, u64& v) {
+    v = 0;
+    for(u32 shift = 0; shift < 64; shift += 7) {
+        if(p >= end) return false;
+        u8 b = *p++;
+        v |= (u64)(b & 0x7F) << shift;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline u8* TraceRegisters(CPUTraceEntry& e) { return &e.a; }
+inline const u8* TraceRegisters(const CPUTraceEntry& e) { return &e.a; }
+
+// encodes "cur" against "prev", returns the end of the written record.
+static u8* EncodeRecord(const CPUTraceEntry& prev, const CPUTraceEntry& cur, u8* p) {
+    p = PutVarint(p, cur.cycles - prev.cycles);
+    const u8* prevRegs = TraceRegisters(prev);
+    const u8* curRegs = TraceRegisters(cur);
+    u8* mask = p++;
+    *mask = 0;
+    for(u32 i = 0; i < 8; ++i) {
+        if(curRegs[i] != prevRegs[i]) {
+            *mask |= (u8)(1 << i);
+            *p++ = curRegs[i];
+        }
+    }
+    u8 flags = 0;
+    if(cur.sp != prev.sp) flags |= TRACE_RECORD_SP;
+    if(memcmp(cur.pcmem, prev.pcmem, 4) != 0) flags |= TRACE_RECORD_PCMEM;
+    *p++ = flags;
+    // Zigzag encoded, sequential code gives a one-byte delta.
+    i32 pcDelta = (i32)cur.pc - (i32)prev.pc;
+    p = PutVarint(p, (u64)(u32)((pcDelta << 1) ^ (pcDelta >> 31)));
+    if(flags & TRACE_RECORD_SP) {
+        *p++ = (u8)(cur.sp & 0xFF);
+        *p++ = (u8)(cur.sp >> 8);
+    }
+    if(flags & TRACE_RECORD_PCMEM) {
+        memcpy(p, cur.pcmem, 4);
+        p += 4;
+    }
+    return p;
+}
+
+static bool DecodeRecord(const CPUTraceEntry& prev, CPUTraceEntry& cur, const u8*& p, const u8* end) {
+    u64 v;
+    if(!GetVarint(p, end, v)) return false;
+    cur = prev;
+    cur.cycles = prev.cycles + v;
+    if(p >= end) return false;
+    u8 mask = *p++;
+    u8* regs = TraceRegisters(cur);
+    for(u32 i = 0; i < 8; ++i) {
+        if(mask & (1 << i)) {
+            if(p >= end) return false;
+            regs[i] = *p++;
+        }
+    }
+    if(p >= end) return false;
+    u8 flags = *p++;
+    if(!GetVarint(p, end, v)) return false;
+    u32 zigzag = (u32)v;
+    i32 pcDelta = (i32)(zigzag >> 1) ^ -(i32)(zigzag & 1);
+    cur.pc = (u16)((i32)prev.pc + pcDelta);
+    if(flags & TRACE_RECORD_SP) {
+        if(end - p < 2) return false;
+        cur.sp = (u16)(p[0] | (p[1] << 8));
+        p += 2;
+    }
+    if(flags & TRACE_RECORD_PCMEM) {
+        if(end - p < 4) return false;
+        memcpy(cur.pcmem, p, 4);
+        p += 4;
+    }
+    return true;
+}
+
+TraceFileWriter::TraceFileWriter() : bytesWritten(0) {
+    for(u32 i = 0; i < NUM_CHUNKS; ++i) {
+        chunks[i] = new CPUTraceEntry[CHUNK_ENTRIES];
+        chunkSizes[i] = 0;
+    }
+}
+
+TraceFileWriter::~TraceFileWriter() {
+    Close();
+    for(u32 i = 0; i < NUM_CHUNKS; ++i) {
+        delete[] chunks[i];
+    }
+}
+
+bool TraceFileWriter::Open(const char *path) {
+    Close();
+    file = fopen(path, "wb");
+    if(!file) {
+        ERROR("failed to open trace file: %s", path);
+        return false;
+    }
+    u8 header[TRACE_FILE_HEADER_SIZE];
+    memcpy(header, TRACE_FILE_MAGIC, 8);
+    PutU32(header + 8, TRACE_FILE_VERSION);
+    PutU32(header + 12, 0);
+    fwrite(header, 1, sizeof(header), file);
+
+    submitted = 0;
+    consumed = 0;
+    fill = 0;
+    recordCount = 0;
+    stopping = false;
+    bytesWritten.store(TRACE_FILE_HEADER_SIZE, std::memory_order_relaxed);
+    rawBuffer.resize(CHUNK_ENTRIES * TRACE_MAX_RECORD_SIZE);
+    compressedBuffer.resize(LZCompressBound((u32)rawBuffer.size()));
+    worker = std::thread(&TraceFileWriter::WorkerMain, this);
+    return true;
+}
+
+void TraceFileWriter::Close() {
+    if(!file) return;
+    if(fill) {
+        SubmitChunk();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+    fclose(file);
+    file = nullptr;
+}
+
+void TraceFileWriter::OnInstruction(Emulator *emu) {
+    CaptureTraceEntry(emu, chunks[submitted % NUM_CHUNKS][fill]);
+    ++recordCount;
+    if(++fill == CHUNK_ENTRIES) {
+        SubmitChunk();
+    }
+}
+
+void TraceFileWriter::SubmitChunk() {
+    std::unique_lock<std::mutex> lock(mutex);
+    chunkSizes[submitted % NUM_CHUNKS] = fill;
+    ++submitted;
+    fill = 0;
+    cv.notify_all();
+    // Wait until the next chunk has been written out.
+    cv.wait(lock, [this] { return submitted - consumed < NUM_CHUNKS; });
+}
+
+void TraceFileWriter::WorkerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        cv.wait(lock, [this] { return consumed < submitted || stopping; });
+        if(consumed == submitted) {
+            // Stopping and everything is written.
+            break;
+        }
+        u32 index = (u32)(consumed % NUM_CHUNKS);
+        lock.unlock();
+        WriteBlock(chunks[index], chunkSizes[index]);
+        lock.lock();
+        ++consumed;
+        cv.notify_all();
+    }
+}
+
+void TraceFileWriter::WriteBlock(const CPUTraceEntry *entries, u32 count) {
+    if(!count) return;
+    CPUTraceEntry prev;
+    memset(&prev, 0, sizeof(prev));
+    prev.cycles = entries[0].cycles;
+    u8* p = rawBuffer.data();
+    for(u32 i = 0; i < count; ++i) {
+        p = EncodeRecord(prev, entries[i], p);
+        prev = entries[i];
+    }
+    u32 rawSize = (u32)(p - rawBuffer.data());
+    u32 compressedSize = LZCompress(rawBuffer.data(), rawSize, compressedBuffer.data(), (u32)compressedBuffer.size());
+
+    u8 header[TRACE_BLOCK_HEADER_SIZE];
+    PutU64(header, entries[0].cycles);
+    PutU64(header + 8, entries[count - 1].cycles);
+    PutU32(header + 16, count);
+    PutU32(header + 20, rawSize);
+    PutU32(header + 24, compressedSize);
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(compressedBuffer.data(), 1, compressedSize, file);
+    bytesWritten.fetch_add(TRACE_BLOCK_HEADER_SIZE + compressedSize, std::memory_order_relaxed);
+}
+
+TraceFileReader::~TraceFileReader() {
+    Close();
+}
+
+bool TraceFileReader::Open(const char *path) {
+    Close();
+    file = fopen(path, "rb");
+    if(!file) {
+        ERROR("failed to open trace file: %s", path);
+        return false;
+    }
+    u8 header[TRACE_FILE_HEADER_SIZE];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) ||
+       memcmp(header, TRACE_FILE_MAGIC, 8) != 0) {
+        ERROR("not a trace file: %s", path);
+        Close();
+        return false;
+    }
+    if(GetU32(header + 8) != TRACE_FILE_VERSION) {
+        ERROR("unsupported trace file version: %u", GetU32(header + 8));
+        Close();
+        return false;
+    }
+    // Build the block index, only the block headers are read.
+    u64 offset = TRACE_FILE_HEADER_SIZE;
+    u8 blockHeader[TRACE_BLOCK_HEADER_SIZE];
+    while(fread(blockHeader, 1, sizeof(blockHeader), file) == sizeof(blockHeader)) {
+        BlockInfo block;
+        block.fileOffset = offset + TRACE_BLOCK_HEADER_SIZE;
+        block.firstCycles = GetU64(blockHeader);
+        block.lastCycles = GetU64(blockHeader + 8);
+        block.recordCount = GetU32(blockHeader + 16);
+        block.rawSize = GetU32(blockHeader + 20);
+        block.compressedSize = GetU32(blockHeader + 24);
+        blocks.push_back(block);
+        recordCount += block.recordCount;
+        offset = block.fileOffset + block.compressedSize;
+        if(fseek(file, (long)offset, SEEK_SET) != 0) break;
+    }
+    if(blocks.empty()) return true;
+    return SeekCycle(0);
+}
+
+void TraceFileReader::Close() {
+    if(file) {
+        fclose(file);
+        file = nullptr;
+    }
+    blocks.clear();
+    blockEntries.clear();
+    recordCount = 0;
+    currentBlock = 0;
+    position = 0;
+}
+
+bool TraceFileReader::LoadBlock(u32 index) {
+    blockEntries.clear();
+    currentBlock = index;
+    position = 0;
+    if(index >= blocks.size()) return false;
+    const BlockInfo& block = blocks[index];
+    compressedBuffer.resize(block.compressedSize);
+    rawBuffer.resize(block.rawSize);
+    if(fseek(file, (long)block.fileOffset, SEEK_SET) != 0 ||
+       fread(compressedBuffer.data(), 1, block.compressedSize, file) != block.compressedSize) {
+        ERROR("trace block %u is truncated", index);
+        return false;
+    }
+    if(LZDecompress(compressedBuffer.data(), block.compressedSize, rawBuffer.data(), block.rawSize) != block.rawSize) {
+        ERROR("trace block %u is corrupted", index);
+        return false;
+    }
+    CPUTraceEntry prev;
+    memset(&prev, 0, sizeof(prev));
+    prev.cycles = block.firstCycles;
+    blockEntries.resize(block.recordCount);
+    const u8* p = rawBuffer.data();
+    const u8* end = p + block.rawSize;
+    for(u32 i = 0; i < block.recordCount; ++i) {
+        if(!DecodeRecord(prev, blockEntries[i], p, end)) {
+            ERROR("trace block %u is corrupted", index);
+            blockEntries.resize(i);
+            return false;
+        }
+        prev = blockEntries[i];
+    }
+    return true;
+}
+
+bool TraceFileReader::SeekCycle(u64 cycles) {
+    // Binary search for the first block that ends at or after the requested cycle.
+    u32 lo = 0;
+    u32 hi = (u32)blocks.size();
+    while(lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if(blocks[mid].lastCycles < cycles) lo = mid + 1;
+        else hi = mid;
+    }
+    if(!LoadBlock(lo)) return false;
+    while(position < blockEntries.size() && blockEntries[position].cycles < cycles) {
+        ++position;
+    }
+    return true;
+}
+
+bool TraceFileReader::Next(CPUTraceEntry &entry) {
+    while(position >= blockEntries.size()) {
+        if(currentBlock + 1 >= blocks.size()) return false;
+        if(!LoadBlock(currentBlock + 1)) return false;
+    }
+    entry = blockEntries[position++];
+    return true;
+}
@@ -0,0 +1,127 @@
+/**
+  ******************************************************************************
+  * @file           : trace_file.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/8/27
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_TRACE_FILE_H
+#define GAMEBOY_EMULATOR_TRACE_FILE_H
+
+#include "type.h"
+#include "cpu_trace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Trace file layout (all integers little endian):
+//   file header  : "GBTRACE\0", u32 version, u32 reserved
+//   block header : u64 first cycles, u64 last cycles, u32 record count, u32 raw size, u32 compressed size
+//   block data   : LZ compressed records, delta-encoded against the previous record of the same block,
+//                  so every block can be decoded on its own.
+
+constexpr u32 TRACE_FILE_VERSION = 1;
+constexpr u32 TRACE_FILE_HEADER_SIZE = 16;
+constexpr u32 TRACE_BLOCK_HEADER_SIZE = 28;
+
+//! Streams CPU trace records to a compressed file.
+//! The emulation thread only copies records into a chunk, encoding, compression and
+//! file IO run on a background thread. If the writer falls NUM_CHUNKS chunks behind,
+//! the emulation thread waits instead of dropping records.
+class TraceFileWriter : public CPUTraceHook {
+public:
+    static constexpr u32 CHUNK_ENTRIES = 16384;
+    static constexpr u32 NUM_CHUNKS = 4;
+
+    TraceFileWriter();
+    ~TraceFileWriter() override;
+    TraceFileWriter(const TraceFileWriter&) = delete;
+    TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+
+    bool Open(const char* path);
+    // flushes the pending records and closes the file
+    void Close();
+    bool IsOpen() const { return file != nullptr; }
+
+    void OnInstruction(Emulator* emu) override;
+
+    u64 RecordCount() const { return recordCount; }
+    u64 BytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+
+private:
+    void SubmitChunk();
+    void WorkerMain();
+    void WriteBlock(const CPUTraceEntry* entries, u32 count);
+
+    FILE* file = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    CPUTraceEntry* chunks[NUM_CHUNKS];
+    u32 chunkSizes[NUM_CHUNKS];
+    // Chunks are filled in order, chunk (submitted % NUM_CHUNKS) is the one being filled.
+    u64 submitted = 0;
+    u64 consumed = 0;
+    u32 fill = 0;
+
+    u64 recordCount = 0;
+    std::atomic<u64> bytesWritten;
+
+    // Worker thread buffers.
+    std::vector<u8> rawBuffer;
+    std::vector<u8> compressedBuffer;
+};
+
+//! Reads trace files written by TraceFileWriter, with random access by cycle count.
+class TraceFileReader {
+public:
+    ~TraceFileReader();
+
+    bool Open(const char* path);
+    void Close();
+
+    u64 RecordCount() const { return recordCount; }
+    u64 FirstCycles() const { return blocks.empty() ? 0 : blocks.front().firstCycles; }
+    u64 LastCycles() const { return blocks.empty() ? 0 : blocks.back().lastCycles; }
+
+    // positions the reader at the first record whose cycle count is >= cycles
+    bool SeekCycle(u64 cycles);
+    // reads the next record, returns false at the end of the trace
+    bool Next(CPUTraceEntry& entry);
+
+private:
+    struct BlockInfo {
+        u64 fileOffset;
+        u64 firstCycles;
+        u64 lastCycles;
+        u32 recordCount;
+        u32 rawSize;
+        u32 compressedSize;
+    };
+
+    bool LoadBlock(u32 index);
+
+    FILE* file = nullptr;
+    std::vector<BlockInfo> blocks;
+    u64 recordCount = 0;
+
+    std::vector<CPUTraceEntry> blockEntries;
+    std::vector<u8> rawBuffer;
+    std::vector<u8> compressedBuffer;
+    u32 currentBlock = 0;
+    u32 position = 0;
+};
+
+
+#endif //GAMEBOY_EMULATOR_TRACE_FILE_H
@@ -0,0 +1,145 @@
+/**
+  ******************************************************************************
+  * @file           : vec_emulator.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#include "vec_emulator.h"
+#include "emulator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+VecEmulator::~VecEmulator() {
+    Close();
+}
+
+void VecEmulator::Init(Emulator *source, u32 count, u32 threads) {
+    assert(source->isCartLoaded && "no cartridge loaded!");
+    Close();
+
+    initialState.resize(source->GetStateSize());
+    source->SaveState(initialState.data(), initialState.size());
+    emulators.resize(count);
+    for(std::unique_ptr<Emulator>& emu : emulators) {
+        emu.reset(new Emulator);
+        // Observations are copied out as they are, one shade index per pixel.
+        emu->ppu.set_frame_format(PPUFrameFormat::SHADE_INDEX);
+        source->Fork(*emu);
+        emu->input.Clear();
+    }
+
+    if(threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = std::max(std::min(threads, count), 1u);
+    stopping = false;
+    for(u32 i = 1; i < threads; ++i) {
+        workers.emplace_back(&VecEmulator::WorkerMain, this);
+    }
+}
+
+void VecEmulator::Close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stepCv.notify_all();
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    emulators.clear();
+}
+
+void VecEmulator::Reset() {
+    for(u32 i = 0; i < Size(); ++i) {
+        Reset(i);
+    }
+}
+
+void VecEmulator::Reset(u32 index) {
+    Emulator* emu = emulators[index].get();
+    emu->input.Clear();
+    emu->LoadState(initialState.data(), initialState.size());
+    // Lines the PPU skips keep what the buffer held before, start from blank buffers like a
+    // fresh fork does. The buffers keep their size, nothing is reallocated.
+    emu->ppu.frames.Init(VEC_OBSERVATION_SIZE);
+}
+
+void VecEmulator::Step(const u8 *actions, u32 frames, u8 *observations, const u16 *ramAddresses, u32 ramCount, u8 *ram) {
+    if(emulators.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->actions = actions;
+        this->frames = frames;
+        this->observations = observations;
+        this->ramAddresses = ramAddresses;
+        this->ramCount = ramCount;
+        this->ram = ram;
+        // A worker late from the last step may claim an index as soon as nextIndex is reset,
+        // so the count has to be in place before.
+        remaining.store(Size());
+        nextIndex.store(0);
+        ++stepId;
+    }
+    stepCv.notify_all();
+    RunJob();
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCv.wait(lock, [this] { return remaining.load() == 0; });
+}
+
+void VecEmulator::WorkerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    u64 lastStepId = stepId;
+    while(true) {
+        stepCv.wait(lock, [this, lastStepId] { return stopping || stepId != lastStepId; });
+        if(stopping) return;
+        lastStepId = stepId;
+        lock.unlock();
+        RunJob();
+        lock.lock();
+    }
+}
+
+void VecEmulator::RunJob() {
+    u32 count = Size();
+    for(u32 index = nextIndex.fetch_add(1); index < count; index = nextIndex.fetch_add(1)) {
+        StepOne(index);
+        if(remaining.fetch_sub(1) == 1) {
+            // Taking the lock keeps the notification from slipping in before Step() waits.
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCv.notify_all();
+        }
+    }
+}
+
+void VecEmulator::StepOne(u32 index) {
+    Emulator* emu = emulators[index].get();
+    if(actions) {
+        emu->input.SetButtons(actions[index]);
+    }
+    emu->RunFrames(frames);
+    if(observations) {
+        u8* dst = observations + (u64)index * VEC_OBSERVATION_SIZE;
+        if(emu->ppu.enabled() && emu->ppu.frames.LatestFrameId() != 0) {
+            emu->ppu.frames.CopyLatest(dst);
+        }
+        else {
+            memset(dst, 0, VEC_OBSERVATION_SIZE);
+        }
+    }
+    if(ram) {
+        u8* dst = ram + (u64)index * ramCount;
+        for(u32 i = 0; i < ramCount; ++i) {
+            dst[i] = emu->BusRead(ramAddresses[i]);
+        }
+    }
+}
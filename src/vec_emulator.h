@@ -0,0 +1,103 @@
+/**
+  ******************************************************************************
+  * @file           : vec_emulator.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/5
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_VEC_EMULATOR_H
+#define GAMEBOY_EMULATOR_VEC_EMULATOR_H
+
+#include "type.h"
+#include "ppu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Emulator;
+
+//! The bytes of one observation: the shade index 0~3 of every pixel, row by row.
+constexpr u32 VEC_OBSERVATION_SIZE = PPU_XRES * PPU_YRES;
+
+//! N emulators of one cartridge stepped in lockstep, for agents training on many games at once.
+//! Every step sets the buttons of all emulators, runs them the same number of frames on a pool
+//! of threads and writes the observations of all of them into one N x 144 x 160 array of
+//! shade indices in caller memory, plus the bytes at a list of addresses of each emulator.
+//! The emulators are forks of one source state, they share its ROM and only copy the memory
+//! pages they write. A step does not allocate once every emulator has written its pages, and
+//! the results do not depend on the number of threads.
+class VecEmulator {
+public:
+    VecEmulator() = default;
+    ~VecEmulator();
+    VecEmulator(const VecEmulator&) = delete;
+    VecEmulator& operator=(const VecEmulator&) = delete;
+
+    // forks count emulators from the current state of source, which is also the state Reset()
+    // returns to. threads is the number of threads stepping them, the calling thread included,
+    // 0 uses one per core. source may be changed or closed afterwards.
+    void Init(Emulator* source, u32 count, u32 threads);
+    // stops the threads and releases the emulators.
+    void Close();
+
+    u32 Size() const { return (u32)emulators.size(); }
+    u32 ThreadCount() const { return (u32)workers.size() + 1; }
+    // the emulator at index, for reading more than the observations. Not while stepping.
+    Emulator* Get(u32 index) const { return emulators[index].get(); }
+
+    // returns all emulators / the emulator at index to the initial state, pending input dropped.
+    void Reset();
+    void Reset(u32 index);
+
+    // holds actions[i] (see Joypad::get_buttons()) on emulator i and runs all emulators frames
+    // frames in parallel, blocks until all are done. Then writes the latest frame of emulator i
+    // to observations + i * VEC_OBSERVATION_SIZE, blank (shade 0) while the LCD is off and
+    // before the first frame since the reset, and the bytes at the ramCount addresses of
+    // ramAddresses, as the CPU reads them, to ram + i * ramCount.
+    // actions null keeps the buttons, observations or ram null skips them.
+    void Step(const u8* actions, u32 frames, u8* observations, const u16* ramAddresses, u32 ramCount, u8* ram);
+
+private:
+    void WorkerMain();
+    // steps the emulators of the current step not claimed yet by another thread.
+    void RunJob();
+    void StepOne(u32 index);
+
+    std::vector<std::unique_ptr<Emulator>> emulators;
+    std::vector<u8> initialState;
+
+    //! The current step, written by Step() while no worker runs it.
+    const u8* actions = nullptr;
+    u32 frames = 0;
+    u8* observations = nullptr;
+    const u16* ramAddresses = nullptr;
+    u32 ramCount = 0;
+    u8* ram = nullptr;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    //! Wakes the workers for a new step.
+    std::condition_variable stepCv;
+    //! Wakes Step() when the last emulator is done.
+    std::condition_variable doneCv;
+    bool stopping = false;
+    //! Incremented for every step, workers run each one once.
+    u64 stepId = 0;
+    //! The index of the next emulator to step, claimed by the threads one by one so that slow
+    //! emulators do not hold up a thread with a fixed share.
+    std::atomic<u32> nextIndex{0};
+    //! The emulators of the current step not done yet.
+    std::atomic<u32> remaining{0};
+};
+
+
+#endif //GAMEBOY_EMULATOR_VEC_EMULATOR_H
@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file           : video_recorder.cpp
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/1
+  ******************************************************************************
+  */
+
+
+
+#include "video_recorder.h"
+#include "emulator.h"
+#include "log-min.h"
+
+#include <cstring>
+
+constexpr u32 VIDEO_SLOT_SIZE = PPU_XRES * PPU_YRES * 4;
+
+VideoRecorder::~VideoRecorder() {
+    Close();
+}
+
+bool VideoRecorder::Open(const char *path) {
+    Close();
+    file = fopen(path, "wb");
+    if(!file) {
+        ERROR("failed to open video file: %s", path);
+        return false;
+    }
+    fprintf(file, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C444 XCOLORRANGE=FULL\n",
+            PPU_XRES, PPU_YRES, (u32)Emulator::GB_CLOCK_FREQUENCY, Emulator::GB_CLOCK_CYCLES_PER_FRAME);
+
+    slots.resize((u64)VIDEO_SLOT_SIZE * QUEUE_FRAMES);
+    rgbaBuffer.resize(VIDEO_SLOT_SIZE);
+    yuvBuffer.resize(PPU_XRES * PPU_YRES * 3);
+    submitted = 0;
+    consumed = 0;
+    droppedSinceQueued = 0;
+    stopping = false;
+    framesWritten.store(0, std::memory_order_relaxed);
+    framesDropped.store(0, std::memory_order_relaxed);
+    worker = std::thread(&VideoRecorder::WorkerMain, this);
+    return true;
+}
+
+void VideoRecorder::Close() {
+    if(!file) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+    // The frames dropped after the last queued one, yuvBuffer still holds that one.
+    if(framesWritten.load(std::memory_order_relaxed) != 0) {
+        for(u32 i = 0; i < droppedSinceQueued; ++i) {
+            WriteYuv();
+        }
+    }
+    fclose(file);
+    file = nullptr;
+    if(framesDropped.load(std::memory_order_relaxed)) {
+        WARN("video recorder dropped %llu frames, repeated the previous ones in their place.", (unsigned long long)framesDropped.load(std::memory_order_relaxed));
+    }
+}
+
+void VideoRecorder::OnFrame(const u8 *frame, PPUFrameFormat format, u64) {
+    if(!file) return;
+    u64 index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(submitted - consumed == QUEUE_FRAMES) {
+            framesDropped.fetch_add(1, std::memory_order_relaxed);
+            ++droppedSinceQueued;
+            return;
+        }
+        index = submitted % QUEUE_FRAMES;
+    }
+    // The worker does not touch this slot until it is submitted.
+    memcpy(slots.data() + index * VIDEO_SLOT_SIZE, frame, get_frame_size(format));
+    slotFormats[index] = format;
+    slotGaps[index] = droppedSinceQueued;
+    droppedSinceQueued = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++submitted;
+    }
+    cv.notify_all();
+}
+
+void VideoRecorder::WorkerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        cv.wait(lock, [this] { return consumed < submitted || stopping; });
+        if(consumed == submitted) {
+            // Stopping and everything is written.
+            break;
+        }
+        u32 index = (u32)(consumed % QUEUE_FRAMES);
+        lock.unlock();
+        // yuvBuffer still holds the previous frame.
+        if(framesWritten.load(std::memory_order_relaxed) != 0) {
+            for(u32 i = 0; i < slotGaps[index]; ++i) {
+                WriteYuv();
+            }
+        }
+        WriteFrame(slots.data() + (u64)index * VIDEO_SLOT_SIZE, slotFormats[index]);
+        lock.lock();
+        ++consumed;
+    }
+}
+
+void VideoRecorder::WriteFrame(const u8 *frame, PPUFrameFormat format) {
+    const u8* rgba = frame;
+    if(format != PPUFrameFormat::RGBA) {
+        expand_frame_to_rgba(frame, format, rgbaBuffer.data());
+        rgba = rgbaBuffer.data();
+    }
+    // Full range BT.601 in 16.16 fixed point.
+    constexpr u32 num_pixels = PPU_XRES * PPU_YRES;
+    u8* y = yuvBuffer.data();
+    u8* u = y + num_pixels;
+    u8* v = u + num_pixels;
+    for(u32 i = 0; i < num_pixels; ++i) {
+        i32 r = rgba[i * 4];
+        i32 g = rgba[i * 4 + 1];
+        i32 b = rgba[i * 4 + 2];
+        y[i] = (u8)((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+        u[i] = (u8)((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16);
+        v[i] = (u8)((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32768) >> 16);
+    }
+    WriteYuv();
+}
+
+void VideoRecorder::WriteYuv() {
+    fwrite("FRAME\n", 1, 6, file);
+    fwrite(yuvBuffer.data(), 1, yuvBuffer.size(), file);
+    framesWritten.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,82 @@
+/**
+  ******************************************************************************
+  * @file           : video_recorder.h
+  * @author         : toastoffee
+  * @brief          : None
+  * @attention      : None
+  * @date           : 2024/9/1
+  ******************************************************************************
+  */
+
+
+
+#ifndef GAMEBOY_EMULATOR_VIDEO_RECORDER_H
+#define GAMEBOY_EMULATOR_VIDEO_RECORDER_H
+
+#include "type.h"
+#include "ppu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! Records the PPU output to an uncompressed YUV4MPEG2 (.y4m) video at the exact Game Boy
+//! frame rate (4194304:70224), 4:4:4 full range, playable with ffmpeg/mpv.
+//! The emulation thread only copies frames into a bounded queue, color conversion and file
+//! IO run on a background thread. If the writer falls QUEUE_FRAMES frames behind, new frames
+//! are dropped and counted instead of stalling the emulation. The previous frame is written
+//! again in place of every dropped one, so the video keeps its nominal frame rate.
+class VideoRecorder : public PPUFrameHook {
+public:
+    static constexpr u32 QUEUE_FRAMES = 64;
+
+    VideoRecorder() = default;
+    ~VideoRecorder() override;
+    VideoRecorder(const VideoRecorder&) = delete;
+    VideoRecorder& operator=(const VideoRecorder&) = delete;
+
+    bool Open(const char* path);
+    // writes the queued frames and closes the file
+    void Close();
+    bool IsOpen() const { return file != nullptr; }
+
+    void OnFrame(const u8* frame, PPUFrameFormat format, u64) override;
+
+    u64 FramesWritten() const { return framesWritten.load(std::memory_order_relaxed); }
+    u64 FramesDropped() const { return framesDropped.load(std::memory_order_relaxed); }
+
+private:
+    void WorkerMain();
+    void WriteFrame(const u8* frame, PPUFrameFormat format);
+    // writes yuvBuffer as the next frame
+    void WriteYuv();
+
+    FILE* file = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    // Frames are queued in order, slot (submitted % QUEUE_FRAMES) is the next one to fill.
+    std::vector<u8> slots;
+    PPUFrameFormat slotFormats[QUEUE_FRAMES];
+    //! The frames dropped before the frame of each slot, the previous frame is repeated for them.
+    u32 slotGaps[QUEUE_FRAMES];
+    u64 submitted = 0;
+    u64 consumed = 0;
+
+    std::atomic<u64> framesWritten{0};
+    std::atomic<u64> framesDropped{0};
+    //! The frames dropped since the last queued one. Only used on the emulation thread.
+    u32 droppedSinceQueued = 0;
+
+    // Worker thread buffers.
+    std::vector<u8> rgbaBuffer;
+    std::vector<u8> yuvBuffer;
+};
+
+
+#endif //GAMEBOY_EMULATOR_VIDEO_RECORDER_H
@@ -0,0 +1,619 @@
+/**
+  ******************************************************************************
+  * @file           : bench.cpp
+  * @author         : toastoffee
+  * @brief          : Microbenchmarks for the emulator hot paths and end-to-end frame rate benchmarks.
+  * @attention      : None
+  * @date           : 2024/9/3
+  ******************************************************************************
+  */
+
+
+
+#include "emulator.h"
+#include "instruction.h"
+#include "cpu_trace.h"
+#include "log-min.h"
+#include "movie.h"
+#include "vec_emulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every benchmark runs one untimed warm-up batch and then --reps timed batches.
+// The median of the per-operation times is reported together with the minimum and the
+// median absolute deviation, so noisy runs are easy to spot when comparing numbers.
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchStats {
+    f64 median = 0;
+    f64 min = 0;
+    //! The median absolute deviation relative to the median, in percent.
+    f64 deviation = 0;
+};
+
+struct BenchOptions {
+    std::string root = ".";
+    u32 reps = 9;
+    u32 frames = 300;
+    const char* filter = nullptr;
+    const char* movie = nullptr;
+    u32 vec = 0;
+};
+
+//! Keeps the compiler from optimizing away the benchmarked reads.
+static volatile u32 benchSink;
+
+static void PrintUsage() {
+    printf("usage: gb_bench [--root <dir>] [--reps <n>] [--frames <n>] [--filter <text>] [--movie <file>]\n"
+           "                [--vec <n>]\n"
+           "  --root    the directory containing gb/, default .\n"
+           "  --reps    the number of timed batches per benchmark, default 9\n"
+           "  --frames  the number of frames per end-to-end batch, default 300\n"
+           "  --filter  only run benchmarks whose name contains this text\n"
+           "  --movie   also replay this movie (<name>.gbm next to <name>.gb) end to end\n"
+           "  --vec     also step n emulators in lockstep with random input, on one and several threads\n");
+}
+
+static f64 ElapsedNs(BenchClock::time_point begin, BenchClock::time_point end) {
+    return (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
+static BenchStats MakeStats(std::vector<f64>& samples) {
+    BenchStats stats;
+    std::sort(samples.begin(), samples.end());
+    stats.median = samples[samples.size() / 2];
+    stats.min = samples.front();
+    std::vector<f64> deviations;
+    for(f64 sample : samples) {
+        deviations.push_back(std::fabs(sample - stats.median));
+    }
+    std::sort(deviations.begin(), deviations.end());
+    stats.deviation = stats.median > 0 ? deviations[deviations.size() / 2] / stats.median * 100.0 : 0;
+    return stats;
+}
+
+// runs batch once to warm up and then reps times, batch returns the number of operations it did.
+template<typename Batch>
+static BenchStats Measure(u32 reps, Batch batch) {
+    batch();
+    std::vector<f64> samples;
+    for(u32 i = 0; i < reps; ++i) {
+        BenchClock::time_point begin = BenchClock::now();
+        u64 ops = batch();
+        BenchClock::time_point end = BenchClock::now();
+        samples.push_back(ElapsedNs(begin, end) / (f64)std::max<u64>(ops, 1));
+    }
+    return MakeStats(samples);
+}
+
+static bool Selected(const BenchOptions& options, const std::string& name) {
+    return !options.filter || name.find(options.filter) != std::string::npos;
+}
+
+static void PrintStats(const std::string& name, const BenchStats& stats, const c8* unit) {
+    printf("  %-34s %10.2f %-9s (min %.2f, mad %.1f%%)\n", name.c_str(), stats.median, unit, stats.min,
+           stats.deviation);
+}
+
+static std::unique_ptr<Emulator> LoadRom(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file) return nullptr;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<char> rom((size_t)size);
+    fread(rom.data(), 1, rom.size(), file);
+    fclose(file);
+
+    std::unique_ptr<Emulator> emu(new Emulator);
+    emu->useSaveFile = false;
+    emu->Init(path, rom.data(), rom.size());
+    return emu;
+}
+
+// Bus benchmarks, one address per memory region.
+
+struct BusRegion {
+    const c8* name;
+    u16 addr;
+    u8 data;
+};
+
+static const BusRegion BUS_REGIONS[] = {
+    {"rom bank 0", 0x0150, 0x00},
+    {"rom bank n / mbc", 0x4150, 0x00},
+    {"vram", 0x8800, 0x00},
+    {"wram", 0xC100, 0x00},
+    {"oam", 0xFE10, 0x00},
+    {"io (bgp)", 0xFF47, 0xE4},
+    {"hram", 0xFF90, 0x00},
+};
+
+static void BenchBus(const BenchOptions& options, Emulator* emu) {
+    printf("bus\n");
+    const u32 accesses = 1 << 20;
+    for(const BusRegion& region : BUS_REGIONS) {
+        std::string name = std::string("BusRead ") + region.name;
+        if(!Selected(options, name)) continue;
+        BenchStats stats = Measure(options.reps, [&] {
+            u32 sum = 0;
+            for(u32 i = 0; i < accesses; ++i) {
+                sum += emu->BusRead((u16)(region.addr + (i & 0x0F)));
+            }
+            benchSink = sum;
+            return (u64)accesses;
+        });
+        PrintStats(name, stats, "ns/read");
+    }
+    for(const BusRegion& region : BUS_REGIONS) {
+        std::string name = std::string("BusWrite ") + region.name;
+        if(!Selected(options, name)) continue;
+        // Writes to the ROM area go to the MBC, keep them on the ROM bank register with bank 1.
+        u16 addr = region.addr <= 0x7FFF ? 0x2100 : region.addr;
+        u8 data = region.addr <= 0x7FFF ? 0x01 : region.data;
+        u32 mask = region.addr <= 0x7FFF || region.addr == 0xFF47 ? 0 : 0x0F;
+        BenchStats stats = Measure(options.reps, [&] {
+            for(u32 i = 0; i < accesses; ++i) {
+                emu->BusWrite((u16)(addr + (i & mask)), data);
+            }
+            return (u64)accesses;
+        });
+        PrintStats(name, stats, "ns/write");
+    }
+}
+
+// Instruction benchmarks, every opcode of a group is executed in turn from WRAM.
+
+enum InstructionGroup : u8 {
+    GROUP_MISC,
+    GROUP_LD_R_R,
+    GROUP_LD_R_HL,
+    GROUP_LD_IMM,
+    GROUP_LD_INDIRECT,
+    GROUP_ALU_R,
+    GROUP_ALU_HL_IMM,
+    GROUP_INC_DEC,
+    GROUP_ADD_16,
+    GROUP_JUMP,
+    GROUP_CALL_RET,
+    GROUP_PUSH_POP,
+    GROUP_CB,
+    GROUP_COUNT,
+    GROUP_NONE = 0xFF,
+};
+
+static const c8* INSTRUCTION_GROUP_NAMES[GROUP_COUNT] = {
+    "nop/rotate a/daa/cpl/scf/ccf/di/ei",
+    "ld r,r",
+    "ld r,(hl) / ld (hl),r",
+    "ld r,d8 / ld rr,d16",
+    "ld indirect / ldh",
+    "alu a,r",
+    "alu a,(hl) / alu a,d8",
+    "inc/dec",
+    "add hl,rr / add sp,r8",
+    "jr/jp",
+    "call/ret/rst",
+    "push/pop",
+    "cb prefixed",
+};
+
+static InstructionGroup ClassifyOpcode(u8 op) {
+    u8 low = op & 0x07;
+    if(!instructionsMap[op] || op == 0x76 || op == 0x10) return GROUP_NONE;     // HALT and STOP stop the CPU
+    if(op == 0xCB) return GROUP_CB;
+    if(op >= 0x40 && op <= 0x7F) {
+        return (low == 6 || (op >= 0x70 && op <= 0x77)) ? GROUP_LD_R_HL : GROUP_LD_R_R;
+    }
+    if(op >= 0x80 && op <= 0xBF) {
+        return low == 6 ? GROUP_ALU_HL_IMM : GROUP_ALU_R;
+    }
+    if(op < 0x40) {
+        u8 column = op & 0x0F;
+        if(column == 0x01 || low == 6) return GROUP_LD_IMM;
+        if(column == 0x02 || column == 0x0A || op == 0x08) return GROUP_LD_INDIRECT;
+        if(column == 0x03 || column == 0x0B || low == 4 || low == 5) return GROUP_INC_DEC;
+        if(column == 0x09) return GROUP_ADD_16;
+        if(op == 0x18 || (op >= 0x20 && low == 0)) return GROUP_JUMP;
+        return GROUP_MISC;
+    }
+    if(low == 6) return GROUP_ALU_HL_IMM;
+    if(low == 7) return GROUP_CALL_RET;
+    switch(op) {
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+            return GROUP_PUSH_POP;
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+            return GROUP_JUMP;
+        case 0xE8:
+            return GROUP_ADD_16;
+        case 0xF3: case 0xFB:
+            return GROUP_MISC;
+        case 0xE0: case 0xF0: case 0xE2: case 0xF2: case 0xEA: case 0xFA: case 0xF8: case 0xF9:
+            return GROUP_LD_INDIRECT;
+        default:
+            return GROUP_CALL_RET;
+    }
+}
+
+static constexpr u16 BENCH_CODE_ADDR = 0xC000;
+static constexpr u16 BENCH_DATA_ADDR = 0xC100;
+//! Holds the bytes 0x00-0xFF, CB prefixed instructions read their second byte from here.
+static constexpr u16 BENCH_CB_TABLE_ADDR = 0xC200;
+static constexpr u16 BENCH_STACK_ADDR = 0xDFF0;
+
+// puts the CPU back in front of the benchmarked opcode, so that jumps and stack operations
+// do not drift between executions.
+static inline void ResetBenchCpu(Emulator* emu) {
+    emu->cpu.pc = BENCH_CODE_ADDR;
+    emu->cpu.sp = BENCH_STACK_ADDR;
+    emu->cpu.bc(BENCH_DATA_ADDR);
+    emu->cpu.de(BENCH_DATA_ADDR);
+    emu->cpu.hl(BENCH_DATA_ADDR);
+    emu->cpu.halted = false;
+}
+
+static void BenchInstructions(const BenchOptions& options, Emulator* emu) {
+    printf("instructions (ns include the timer/PPU ticks every instruction drives)\n");
+    std::vector<u8> groups[GROUP_COUNT];
+    for(u32 op = 0; op < 256; ++op) {
+        InstructionGroup group = ClassifyOpcode((u8)op);
+        if(group != GROUP_NONE && group != GROUP_CB) {
+            groups[group].push_back((u8)op);
+        }
+    }
+    for(u32 op = 0; op < 256; ++op) {
+        groups[GROUP_CB].push_back((u8)op);
+    }
+
+    // The operands following the opcode are zero: jumps go to 0x0000, a16 accesses hit the MBC
+    // and ldh accesses hit the joypad register.
+    for(u16 i = 0; i < 0x200; ++i) {
+        emu->BusWrite(BENCH_CODE_ADDR + i, 0x00);
+    }
+    for(u16 i = 0; i < 0x100; ++i) {
+        emu->BusWrite(BENCH_CB_TABLE_ADDR + i, (u8)i);
+    }
+    const u32 rounds = 1 << 12;
+    for(u32 group = 0; group < GROUP_COUNT; ++group) {
+        std::string name = INSTRUCTION_GROUP_NAMES[group];
+        if(!Selected(options, name)) continue;
+        const std::vector<u8>& ops = groups[group];
+        u64 cycles = 0;
+        u64 executed = 0;
+        BenchStats stats = Measure(options.reps, [&] {
+            u64 beginCycles = emu->clockCycles;
+            for(u32 round = 0; round < rounds; ++round) {
+                for(u8 op : ops) {
+                    ResetBenchCpu(emu);
+                    if(group == GROUP_CB) {
+                        emu->cpu.pc = BENCH_CB_TABLE_ADDR + op;
+                        instructionsMap[0xCB](emu);
+                    }
+                    else {
+                        instructionsMap[op](emu);
+                    }
+                }
+            }
+            cycles = emu->clockCycles - beginCycles;
+            executed = (u64)rounds * ops.size();
+            return executed;
+        });
+        PrintStats(name, stats, "ns/instr");
+        printf("  %-34s %10.2f cycles/instr, %u opcodes\n", "", (f64)cycles / (f64)executed, (u32)ops.size());
+    }
+    emu->cpu.DisableInterruptMaster();
+}
+
+// PPU benchmark, runs only the PPU over whole frames and splits the time by the mode each tick started in.
+
+static const c8* PPU_MODE_NAMES[4] = {"h-blank", "v-blank", "oam scan", "drawing"};
+
+static void BenchPPU(const BenchOptions& options, Emulator* emu) {
+    printf("ppu\n");
+    if(!emu->ppu.enabled()) {
+        printf("  the LCD is off, skipped\n");
+        return;
+    }
+    const u32 frames = 60;
+    f64 modeNs[4] = {};
+    u64 modeTicks[4] = {};
+    std::vector<f64> samples[4];
+    // The first batch warms up.
+    for(u32 rep = 0; rep <= options.reps; ++rep) {
+        std::fill(modeNs, modeNs + 4, 0.0);
+        std::fill(modeTicks, modeTicks + 4, 0);
+        PPU& ppu = emu->ppu;
+        PPUMode mode = ppu.get_mode();
+        u64 runTicks = 0;
+        BenchClock::time_point runBegin = BenchClock::now();
+        // Time runs of ticks starting in the same mode, so the clock is read a few times per line only.
+        for(u64 i = 0; i < (u64)frames * Emulator::GB_CLOCK_CYCLES_PER_FRAME; ++i) {
+            ++emu->clockCycles;
+            ppu.tick(emu);
+            ++runTicks;
+            PPUMode newMode = ppu.get_mode();
+            if(newMode != mode) {
+                BenchClock::time_point now = BenchClock::now();
+                modeNs[(u8)mode] += ElapsedNs(runBegin, now);
+                modeTicks[(u8)mode] += runTicks;
+                runBegin = now;
+                runTicks = 0;
+                mode = newMode;
+            }
+        }
+        modeNs[(u8)mode] += ElapsedNs(runBegin, BenchClock::now());
+        modeTicks[(u8)mode] += runTicks;
+        if(rep == 0) continue;
+        for(u32 m = 0; m < 4; ++m) {
+            if(modeTicks[m]) samples[m].push_back(modeNs[m] / (f64)modeTicks[m]);
+        }
+    }
+    // Report in the order the modes occur.
+    const u8 order[4] = {(u8)PPUMode::OAM_SCAN, (u8)PPUMode::DRAWING, (u8)PPUMode::H_BLANK, (u8)PPUMode::V_BLANK};
+    for(u8 m : order) {
+        std::string name = std::string("PPU::tick ") + PPU_MODE_NAMES[m];
+        if(!Selected(options, name) || samples[m].empty()) continue;
+        PrintStats(name, MakeStats(samples[m]), "ns/tick");
+        printf("  %-34s %10.1f ticks/frame\n", "", (f64)modeTicks[m] / frames);
+    }
+}
+
+static void BenchTimer(const BenchOptions& options, Emulator* emu) {
+    printf("timer\n");
+    const u32 ticks = 1 << 22;
+    const u8 controls[2] = {0xF8, 0xFD};
+    const c8* names[2] = {"Timer::Tick tima off", "Timer::Tick tima on (262144Hz)"};
+    u8 savedTac = emu->timer.tac;
+    for(u32 i = 0; i < 2; ++i) {
+        if(!Selected(options, names[i])) continue;
+        emu->timer.tac = controls[i];
+        BenchStats stats = Measure(options.reps, [&] {
+            for(u32 t = 0; t < ticks; ++t) {
+                emu->timer.Tick(emu);
+            }
+            return (u64)ticks;
+        });
+        PrintStats(names[i], stats, "ns/tick");
+    }
+    emu->timer.tac = savedTac;
+}
+
+// End-to-end benchmarks, every batch runs the same frames from the same save state.
+
+class InstructionCounter : public CPUTraceHook {
+public:
+    void OnInstruction(Emulator* emu) override { ++count; }
+
+    u64 count = 0;
+};
+
+static const c8* BENCH_ROMS[] = {
+    "gb/Alleyway (World).gb",
+    "gb/Super Mario Land (World).gb",
+    "gb/Pokemon Red (UE).gb",
+};
+
+// The frames run before measuring, past the boot logos.
+static constexpr u32 BENCH_WARMUP_FRAMES = 240;
+// The audio output rate of the end to end runs with sound.
+static constexpr u32 BENCH_AUDIO_RATE = 48000;
+
+static void BenchFrames(const BenchOptions& options) {
+    printf("end to end (%u frames per batch, after %u warm-up frames)\n", options.frames, BENCH_WARMUP_FRAMES);
+    for(const c8* romPath : BENCH_ROMS) {
+        if(!Selected(options, romPath)) continue;
+        std::unique_ptr<Emulator> emu = LoadRom(options.root + "/" + romPath);
+        if(!emu) {
+            printf("  %-34s missing\n", romPath);
+            continue;
+        }
+        emu->RunFrames(BENCH_WARMUP_FRAMES);
+        std::vector<u8> state(emu->GetStateSize());
+        emu->SaveState(state.data(), state.size());
+
+        BenchStats stats = Measure(options.reps, [&] {
+            emu->LoadState(state.data(), state.size());
+            emu->RunFrames(options.frames);
+            return (u64)options.frames;
+        });
+
+        // The same frames with the audio output on, read once per frame like a host would.
+        std::vector<i16> samples(BENCH_AUDIO_RATE);
+        emu->apu.SetOutputRate(BENCH_AUDIO_RATE);
+        BenchStats audioStats = Measure(options.reps, [&] {
+            emu->LoadState(state.data(), state.size());
+            for(u32 i = 0; i < options.frames; ++i) {
+                emu->RunFrames(1);
+                emu->apu.ReadSamples(emu.get(), samples.data(), BENCH_AUDIO_RATE / 2);
+            }
+            return (u64)options.frames;
+        });
+        emu->apu.SetOutputRate(0);
+
+        InstructionCounter counter;
+        emu->LoadState(state.data(), state.size());
+        emu->cpu.traceHook = &counter;
+        u64 beginCycles = emu->clockCycles;
+        emu->RunFrames(options.frames);
+        u64 cycles = emu->clockCycles - beginCycles;
+        emu->cpu.traceHook = nullptr;
+
+        std::string name = romPath;
+        name = name.substr(name.find('/') + 1);
+        PrintStats(name, stats, "ns/frame");
+        PrintStats("  with 48kHz audio output", audioStats, "ns/frame");
+        f64 instructionsPerFrame = (f64)counter.count / options.frames;
+        printf("  %-34s %10.1f fps, %.1fx real time\n", "", 1e9 / stats.median,
+               1e9 / stats.median / (Emulator::GB_CLOCK_FREQUENCY / Emulator::GB_CLOCK_CYCLES_PER_FRAME));
+        // HALT steps are not instructions, games waiting for v-blank raise the cycles per instruction.
+        printf("  %-34s %10.2f cycles/instr (halt included), %.0f instr/frame\n", "",
+               counter.count ? (f64)cycles / (f64)counter.count : 0.0, instructionsPerFrame);
+    }
+}
+
+static u64 StateHash(Emulator* emu) {
+    std::vector<u8> state(emu->GetStateSize());
+    emu->SaveState(state.data(), state.size());
+    u64 hash = 14695981039346656037ULL;
+    for(u8 byte : state) {
+        hash = (hash ^ byte) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Replays a recorded movie, real gameplay instead of title screens. Every replay must end in
+// the same state, otherwise the emulation is not deterministic.
+static void BenchMovie(const BenchOptions& options) {
+    std::string moviePath = options.movie;
+    Movie movie;
+    if(!movie.Load(moviePath.c_str())) {
+        printf("movie %s could not be loaded\n", moviePath.c_str());
+        return;
+    }
+    std::string romPath = moviePath.substr(0, moviePath.length() - 3) + "gb";
+    std::unique_ptr<Emulator> emu = LoadRom(romPath);
+    if(!emu) {
+        printf("movie %s: %s is missing\n", moviePath.c_str(), romPath.c_str());
+        return;
+    }
+    printf("movie replay (%u frames, %zu input changes)\n", movie.Frames(), movie.events.size());
+    MoviePlayer player;
+    u64 firstHash = 0;
+    bool deterministic = true;
+    bool started = true;
+    BenchStats stats = Measure(options.reps, [&] {
+        if(!player.Start(emu.get(), &movie)) {
+            started = false;
+            return (u64)1;
+        }
+        while(player.Run(emu.get(), Emulator::GB_CLOCK_CYCLES_PER_FRAME)) {}
+        u64 hash = StateHash(emu.get());
+        if(!firstHash) firstHash = hash;
+        deterministic = deterministic && hash == firstHash;
+        return (u64)std::max(movie.Frames(), 1u);
+    });
+    if(!started) {
+        printf("  the movie does not belong to %s\n", romPath.c_str());
+        return;
+    }
+    std::string name = romPath.substr(romPath.find_last_of('/') + 1);
+    PrintStats(name, stats, "ns/frame");
+    printf("  %-34s %10.1f fps, final state %016llx%s\n", "", 1e9 / stats.median,
+           (unsigned long long)firstHash, deterministic ? "" : ", NOT DETERMINISTIC");
+}
+
+// Steps a VecEmulator of count emulators one frame at a time with random input, like a training
+// loop. The observations and RAM must not depend on the number of threads.
+static void BenchVec(const BenchOptions& options) {
+    std::unique_ptr<Emulator> source = LoadRom(options.root + "/" + BENCH_ROMS[1]);
+    if(!source) {
+        printf("%s/%s is missing, the vectorized run is skipped\n", options.root.c_str(), BENCH_ROMS[1]);
+        return;
+    }
+    source->RunFrames(BENCH_WARMUP_FRAMES);
+    u32 count = options.vec;
+    printf("vectorized (%u emulators, %u steps of one frame per batch)\n", count, options.frames);
+
+    // The player state and position of Super Mario Land.
+    const u16 ramAddresses[] = {0xC201, 0xC202, 0xC203, 0xFFA4, 0xDA1D};
+    const u32 ramCount = sizeof(ramAddresses) / sizeof(ramAddresses[0]);
+    std::vector<u8> actions(count);
+    std::vector<u8> observations((u64)count * VEC_OBSERVATION_SIZE);
+    std::vector<u8> ram((u64)count * ramCount);
+
+    u64 hashes[2] = {};
+    for(u32 pass = 0; pass < 2; ++pass) {
+        VecEmulator vec;
+        // One thread per core, at least two so that the pool is exercised.
+        vec.Init(source.get(), count, pass == 0 ? 1 : std::max(std::thread::hardware_concurrency(), 2u));
+        u64 hash = 0;
+        BenchStats stats = Measure(options.reps, [&] {
+            vec.Reset();
+            u32 seed = 12345;
+            hash = 14695981039346656037ULL;
+            for(u32 step = 0; step < options.frames; ++step) {
+                for(u8& action : actions) {
+                    seed = seed * 1103515245 + 12345;
+                    action = (u8)(seed >> 24);
+                }
+                vec.Step(actions.data(), 1, observations.data(), ramAddresses, ramCount, ram.data());
+                for(u8 byte : ram) {
+                    hash = (hash ^ byte) * 1099511628211ULL;
+                }
+            }
+            for(u8 byte : observations) {
+                hash = (hash ^ byte) * 1099511628211ULL;
+            }
+            return (u64)options.frames * count;
+        });
+        hashes[pass] = hash;
+        std::string name = std::to_string(vec.ThreadCount()) + (vec.ThreadCount() == 1 ? " thread" : " threads");
+        PrintStats(name, stats, "ns/frame");
+        printf("  %-34s %10.1f fps over all emulators\n", "", 1e9 / stats.median);
+    }
+    printf("  %-34s %s\n", "", hashes[0] == hashes[1] ? "same results with one and several threads"
+                                                       : "DIFFERENT RESULTS with one and several threads");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--root") && i + 1 < argc) {
+            options.root = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            options.reps = std::max(1u, (u32)strtoul(argv[++i], nullptr, 0));
+        }
+        else if(!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            options.frames = std::max(1u, (u32)strtoul(argv[++i], nullptr, 0));
+        }
+        else if(!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--movie") && i + 1 < argc) {
+            options.movie = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--vec") && i + 1 < argc) {
+            options.vec = std::max(1u, (u32)strtoul(argv[++i], nullptr, 0));
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // The emulator logs an error for every unsupported register access, keep the report readable.
+    setLogLevel(LogLevel::Critical);
+
+    // The microbenchmarks run on a game in progress, so the PPU sees real tiles and sprites.
+    std::unique_ptr<Emulator> emu = LoadRom(options.root + "/" + BENCH_ROMS[1]);
+    if(!emu) {
+        printf("%s/%s is missing, the microbenchmarks are skipped\n", options.root.c_str(), BENCH_ROMS[1]);
+    }
+    else {
+        emu->RunFrames(BENCH_WARMUP_FRAMES);
+        BenchBus(options, emu.get());
+        BenchTimer(options, emu.get());
+        BenchPPU(options, emu.get());
+        BenchInstructions(options, emu.get());
+    }
+    BenchFrames(options);
+    if(options.movie) {
+        BenchMovie(options);
+    }
+    if(options.vec) {
+        BenchVec(options);
+    }
+    return 0;
+}
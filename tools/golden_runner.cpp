@@ -0,0 +1,282 @@
+/**
+  ******************************************************************************
+  * @file           : golden_runner.cpp
+  * @author         : toastoffee
+  * @brief          : Runs test ROMs headless and compares their final frames with golden hashes.
+  * @attention      : None
+  * @date           : 2024/9/2
+  ******************************************************************************
+  */
+
+
+
+#include "emulator.h"
+#include "log-min.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Golden file lines: <hash> <frames> <rom path relative to the root directory>
+// '#' starts a comment line.
+
+struct GoldenEntry {
+    std::string romPath;
+    u32 frames = 0;
+    u64 expectedHash = 0;
+    u64 hash = 0;
+    bool loaded = false;
+    //! Serial mode results.
+    SerialTestResult serialResult = SerialTestResult::Running;
+    u64 cycles = 0;
+    u32 framesRun = 0;
+};
+
+static void PrintUsage() {
+    printf("usage: gb_golden_runner [--golden <file>] [--root <dir>] [--jobs <n>] [--filter <text>] [--update | --serial [--frames <n>]]\n"
+           "  --golden  the golden hash file, default tools/golden_hashes.txt\n"
+           "  --root    the directory ROM paths are relative to, default .\n"
+           "  --jobs    the number of ROMs run in parallel, default all cores\n"
+           "  --filter  only run ROMs whose path contains this text\n"
+           "  --update  write the new hashes back to the golden file instead of comparing\n"
+           "  --serial  report the Passed/Failed result the ROMs print to the serial port or write to\n"
+           "            the cartridge RAM instead of comparing hashes, every ROM stops as soon as it\n"
+           "            reports (at most its frame count)\n"
+           "  --frames  the most frames a ROM runs in serial mode, instead of its frame count\n");
+}
+
+// 64-bit FNV-1a.
+static u64 HashBytes(const u8* data, u64 size) {
+    u64 hash = 14695981039346656037ull;
+    for(u64 i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool LoadGoldenFile(const char* path, std::vector<std::string>& lines, std::vector<GoldenEntry>& entries,
+                           std::vector<i32>& entryLines) {
+    std::ifstream file(path);
+    if(!file) {
+        ERROR("failed to open golden file: %s", path);
+        return false;
+    }
+    std::string line;
+    while(std::getline(file, line)) {
+        lines.push_back(line);
+        if(line.empty() || line[0] == '#') {
+            entryLines.push_back(-1);
+            continue;
+        }
+        std::istringstream stream(line);
+        std::string hash;
+        GoldenEntry entry;
+        stream >> hash >> entry.frames;
+        std::getline(stream >> std::ws, entry.romPath);
+        if(hash.empty() || entry.romPath.empty()) {
+            ERROR("invalid golden file line: %s", line.c_str());
+            return false;
+        }
+        entry.expectedHash = strtoull(hash.c_str(), nullptr, 16);
+        entryLines.push_back((i32)entries.size());
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+// Blargg's newer test ROMs (dmg_sound, cgb_sound) also report to the cartridge RAM: 0xA000 holds
+// 0x80 while running and the result code (0: passed) once finished, valid when 0xA001~0xA003
+// hold the signature DE B0 61.
+static SerialTestResult MemoryTestResult(Emulator* emu) {
+    if(emu->cRam_size < 4 || emu->cRam.Read(1) != 0xDE || emu->cRam.Read(2) != 0xB0 || emu->cRam.Read(3) != 0x61) {
+        return SerialTestResult::Running;
+    }
+    u8 status = emu->cRam.Read(0);
+    if(status == 0x80) {
+        return SerialTestResult::Running;
+    }
+    return status ? SerialTestResult::Failed : SerialTestResult::Passed;
+}
+
+static void RunEntry(const std::string& root, GoldenEntry& entry, bool serialMode, u32 serialFrames) {
+    std::string path = root + "/" + entry.romPath;
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file) return;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<char> rom((size_t)size);
+    fread(rom.data(), 1, rom.size(), file);
+    fclose(file);
+
+    std::unique_ptr<Emulator> emu(new Emulator);
+    // Hash shade indices, so that goldens do not depend on the display palette.
+    emu->ppu.set_frame_format(PPUFrameFormat::SHADE_INDEX);
+    emu->useSaveFile = false;
+    emu->Init(path, rom.data(), rom.size());
+    if(serialMode) {
+        SerialTestMonitor monitor;
+        u32 frames = serialFrames ? serialFrames : entry.frames;
+        while(entry.framesRun < frames && entry.serialResult == SerialTestResult::Running) {
+            emu->RunFrames(1);
+            ++entry.framesRun;
+            entry.serialResult = monitor.Drain(emu->serial);
+            if(entry.serialResult == SerialTestResult::Running) {
+                entry.serialResult = MemoryTestResult(emu.get());
+            }
+        }
+    }
+    else {
+        emu->RunFrames(entry.frames);
+        entry.framesRun = entry.frames;
+    }
+    entry.cycles = emu->clockCycles;
+
+    std::vector<u8> frame(emu->ppu.frames.FrameSize());
+    emu->ppu.frames.CopyLatest(frame.data());
+    entry.hash = HashBytes(frame.data(), frame.size());
+    entry.loaded = true;
+}
+
+int main(int argc, char** argv) {
+    const char* goldenPath = "tools/golden_hashes.txt";
+    std::string root = ".";
+    u32 jobs = std::max(1u, std::thread::hardware_concurrency());
+    const char* filter = nullptr;
+    bool update = false;
+    bool serialMode = false;
+    u32 serialFrames = 0;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--golden") && i + 1 < argc) {
+            goldenPath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--root") && i + 1 < argc) {
+            root = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+            jobs = std::max(1u, (u32)strtoul(argv[++i], nullptr, 0));
+        }
+        else if(!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--update")) {
+            update = true;
+        }
+        else if(!strcmp(argv[i], "--serial")) {
+            serialMode = true;
+        }
+        else if(!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            serialFrames = (u32)strtoul(argv[++i], nullptr, 0);
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::vector<std::string> lines;
+    std::vector<GoldenEntry> entries;
+    std::vector<i32> entryLines;
+    if((update && serialMode) || (serialFrames && !serialMode)) {
+        PrintUsage();
+        return 1;
+    }
+    if(!LoadGoldenFile(goldenPath, lines, entries, entryLines)) {
+        return 1;
+    }
+
+    std::vector<u32> selected;
+    for(u32 i = 0; i < (u32)entries.size(); ++i) {
+        if(!filter || entries[i].romPath.find(filter) != std::string::npos) {
+            selected.push_back(i);
+        }
+    }
+
+    // The emulator logs an error for every unsupported register access, keep the report readable.
+    setLogLevel(LogLevel::Critical);
+    std::atomic<u32> next(0);
+    std::vector<std::thread> workers;
+    for(u32 i = 0; i < std::min(jobs, (u32)selected.size()); ++i) {
+        workers.emplace_back([&] {
+            for(u32 j = next++; j < (u32)selected.size(); j = next++) {
+                RunEntry(root, entries[selected[j]], serialMode, serialFrames);
+            }
+        });
+    }
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    setLogLevel(LogLevel::Debug);
+
+    if(serialMode) {
+        u32 passed = 0;
+        u32 failed = 0;
+        u64 totalFrames = 0;
+        for(u32 index : selected) {
+            const GoldenEntry& entry = entries[index];
+            const char* result = "MISSING";
+            if(entry.loaded) {
+                switch(entry.serialResult) {
+                    case SerialTestResult::Passed: result = "PASSED"; ++passed; break;
+                    case SerialTestResult::Failed: result = "FAILED"; ++failed; break;
+                    case SerialTestResult::Running: result = "NO RESULT"; break;
+                }
+            }
+            totalFrames += entry.framesRun;
+            printf("%-9s %11llu cycles %6u frames  %s\n", result, (unsigned long long)entry.cycles,
+                   entry.framesRun, entry.romPath.c_str());
+        }
+        printf("%u ROMs run in %llu frames: %u passed, %u failed, %u without result\n", (u32)selected.size(),
+               (unsigned long long)totalFrames, passed, failed, (u32)selected.size() - passed - failed);
+        return failed ? 1 : 0;
+    }
+
+    u32 failed = 0;
+    for(u32 index : selected) {
+        const GoldenEntry& entry = entries[index];
+        const char* result;
+        if(!entry.loaded) {
+            result = "MISSING";
+            ++failed;
+        }
+        else if(update) {
+            result = entry.hash == entry.expectedHash ? "SAME" : "UPDATED";
+        }
+        else if(entry.hash == entry.expectedHash) {
+            result = "PASS";
+        }
+        else {
+            result = "FAIL";
+            ++failed;
+        }
+        printf("%-8s %016llx %6u %s\n", result, (unsigned long long)entry.hash, entry.frames, entry.romPath.c_str());
+    }
+
+    if(update) {
+        std::ofstream file(goldenPath, std::ios::out | std::ios::trunc);
+        for(u32 i = 0; i < (u32)lines.size(); ++i) {
+            if(entryLines[i] < 0) {
+                file << lines[i] << "\n";
+                continue;
+            }
+            const GoldenEntry& entry = entries[entryLines[i]];
+            char hash[17];
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)(entry.loaded ? entry.hash : entry.expectedHash));
+            file << hash << " " << entry.frames << " " << entry.romPath << "\n";
+        }
+        printf("%u ROMs run, golden file updated: %s\n", (u32)selected.size(), goldenPath);
+        return failed ? 1 : 0;
+    }
+
+    printf("%u ROMs run, %u failed\n", (u32)selected.size(), failed);
+    return failed ? 1 : 0;
+}
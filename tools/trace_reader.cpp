@@ -0,0 +1,82 @@
+/**
+  ******************************************************************************
+  * @file           : trace_reader.cpp
+  * @author         : toastoffee
+  * @brief          : Prints CPU trace files recorded by TraceFileWriter as text.
+  * @attention      : None
+  * @date           : 2024/8/27
+  ******************************************************************************
+  */
+
+
+
+#include "trace_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void PrintUsage() {
+    printf("usage: gb_trace_reader <trace file> [--from <cycles>] [--count <n>] [--registers] [--info]\n"
+           "  --from       start at the first instruction executed at or after this cycle\n"
+           "  --count      print at most n instructions\n"
+           "  --registers  use the register format instead of the Gameboy Doctor format\n"
+           "  --info       print the trace summary only\n");
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+    const char* path = nullptr;
+    u64 from = 0;
+    u64 count = ~0ull;
+    bool infoOnly = false;
+    CPUTraceFormat format = CPUTraceFormat::Doctor;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--from") && i + 1 < argc) {
+            from = strtoull(argv[++i], nullptr, 0);
+        }
+        else if(!strcmp(argv[i], "--count") && i + 1 < argc) {
+            count = strtoull(argv[++i], nullptr, 0);
+        }
+        else if(!strcmp(argv[i], "--registers")) {
+            format = CPUTraceFormat::Registers;
+        }
+        else if(!strcmp(argv[i], "--info")) {
+            infoOnly = true;
+        }
+        else if(argv[i][0] == '-') {
+            PrintUsage();
+            return 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if(!path) {
+        PrintUsage();
+        return 1;
+    }
+
+    TraceFileReader reader;
+    if(!reader.Open(path)) {
+        return 1;
+    }
+    if(infoOnly) {
+        printf("records : %llu\n", (unsigned long long)reader.RecordCount());
+        printf("cycles  : %llu - %llu\n", (unsigned long long)reader.FirstCycles(), (unsigned long long)reader.LastCycles());
+        return 0;
+    }
+    if(!reader.SeekCycle(from)) {
+        return 0;
+    }
+    CPUTraceEntry entry;
+    c8 line[128];
+    for(u64 i = 0; i < count && reader.Next(entry); ++i) {
+        u32 len = FormatTraceEntry(entry, format, line, sizeof(line));
+        fwrite(line, 1, len, stdout);
+    }
+    return 0;
+}